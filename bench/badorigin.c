@@ -0,0 +1,328 @@
+/*
+ * badorigin.c - 말 안 듣는 원격 서버 흉내 (성능 시험용 origin)
+ *
+ * 요청마다 query string 으로 동작을 정한다. -d 로 준 기본값 뒤에 요청의
+ * query 를 이어 붙여 읽으므로 같은 이름이면 요청 쪽이 이긴다. 경로는
+ * 보지 않으므로 /a?size=10 과 /b?size=10 은 캐시 키만 다른 같은 응답이다.
+ *
+ *   size=N      바디 바이트 수 (기본 1024, 수 GB 도 됨. 미리 만들지 않고 흘려 보냄)
+ *   status=N    상태 코드 (기본 200)
+ *   ttfb=MS     요청을 읽고 나서 응답 헤더를 보내기까지 기다림
+ *   rate=B      초당 B 바이트로 찔끔찔끔 보냄 (0 이면 제한 없음)
+ *   stall=P     조각(slice)을 보낼 때마다 P% 확률로 stallms 동안 멈춤
+ *   stallms=MS  멈추는 시간 (기본 1000)
+ *   reset=N     바디 N 바이트를 보낸 뒤 RST 로 연결을 끊음
+ *   chunked=1   Transfer-Encoding: chunked, 청크 크기는 chunk=N (기본 4096)
+ *   nolen=1     Content-length 없이 보내고 닫아서 끝을 알림
+ *   cc=V        Cache-Control: V (%XX 와 + 는 풀어서 씀)
+ *   hang=1      요청을 읽고 아무것도 보내지 않음
+ *
+ * 바디는 오프셋마다 정해진 글자(PATTERN 반복)라서 받은 쪽이 검사할 수 있다.
+ * 멈춤 여부는 -s 시드와 요청 uri 로 만든 난수로 정하므로 같은 uri 는 매번
+ * 같은 곳에서 멈춘다. 응답 길이를 알 수 있고 reset 이 없으면 HTTP/1.1 keep-alive
+ * 를 지원한다. -n 은 nop-server.py 처럼 연결을 받기만 하고 읽지도 않는다.
+ *
+ * 예: 첫 바이트 300ms, 100KB/s 로 1MB, 중간 20% 확률 멈춤, 60 초 캐시 허용
+ *   GET /x?ttfb=300&rate=102400&size=1048576&stall=20&cc=max-age%3D60
+ *
+ * usage: badorigin [-d defaults] [-s seed] [-n] [-v] <port>
+ */
+#include "csapp.h"
+#include "httpparse.h"
+
+#define PATTERN   "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ-_"
+#define PATLEN    64            /* strlen(PATTERN), BODYBUF 의 약수 */
+#define BODYBUF   65536         /* 바디를 보낼 때 쓰는 패턴 버퍼 */
+#define MAXSLICE  16384         /* 한 번에 write 하는 최대 바이트 */
+
+/* 요청 하나의 동작 */
+typedef struct {
+  long long size;
+  int status;
+  int ttfb, stall, stallms, chunked, chunk, nolen, hang;
+  long long rate, reset;
+  char cc[MAXLINE];
+} behavior_t;
+
+static char *defaults = "";
+static unsigned int seed = 1;
+static int verbose;
+static char body[BODYBUF + PATLEN];
+
+/*
+ * sleep_ms - ms 밀리초 동안 쉼
+ */
+static void sleep_ms(long ms) {
+  struct timespec ts = {ms / 1000, ms % 1000 * 1000000L};
+
+  while (nanosleep(&ts, &ts) < 0 && errno == EINTR)
+    ;
+}
+
+/*
+ * unescape - %XX 와 + 를 풀어서 dst 에 복사
+ */
+static void unescape(char *dst, size_t size, const char *src, size_t len) {
+  size_t i, n = 0;
+  unsigned int c;
+
+  for (i = 0; i < len && n + 1 < size; i++) {
+    if (src[i] == '%' && i + 2 < len && sscanf(src + i + 1, "%2x", &c) == 1) {
+      dst[n++] = c;
+      i += 2;
+    } else {
+      dst[n++] = src[i] == '+' ? ' ' : src[i];
+    }
+  }
+  dst[n] = '\0';
+}
+
+/*
+ * apply - "a=1&b=2" 형태의 설정을 b 에 덮어씀. 모르는 이름은 무시
+ */
+static void apply(behavior_t *b, const char *q) {
+  const char *p = q, *end, *eq;
+  size_t klen;
+  long long v;
+
+  while (*p) {
+    end = strchr(p, '&');
+    if (!end) {
+      end = p + strlen(p);
+    }
+    if ((eq = memchr(p, '=', end - p)) != NULL) {
+      klen = eq - p;
+      v = strtoll(eq + 1, NULL, 10);
+#define KEY(name) (klen == strlen(name) && !strncmp(p, name, klen))
+      if (KEY("size")) b->size = v;
+      else if (KEY("status")) b->status = v;
+      else if (KEY("ttfb")) b->ttfb = v;
+      else if (KEY("rate")) b->rate = v;
+      else if (KEY("stall")) b->stall = v;
+      else if (KEY("stallms")) b->stallms = v;
+      else if (KEY("reset")) b->reset = v;
+      else if (KEY("chunked")) b->chunked = v;
+      else if (KEY("chunk")) b->chunk = v > 0 ? v : 4096;
+      else if (KEY("nolen")) b->nolen = v;
+      else if (KEY("hang")) b->hang = v;
+      else if (KEY("cc")) unescape(b->cc, sizeof(b->cc), eq + 1, end - eq - 1);
+#undef KEY
+    }
+    p = *end ? end + 1 : end;
+  }
+}
+
+/*
+ * hash_str - 요청마다 난수 시드를 만들 FNV-1a 해시
+ */
+static unsigned int hash_str(const char *s) {
+  unsigned int h = 2166136261u;
+
+  while (*s) {
+    h = (h ^ (unsigned char)*s++) * 16777619u;
+  }
+  return h;
+}
+
+/*
+ * send_all - n 바이트를 모두 씀
+ * @return 성공 0, 클라이언트가 끊었으면 -1
+ */
+static int send_all(int fd, const char *p, size_t n) {
+  return rio_writen(fd, (char *)p, n) == (ssize_t)n ? 0 : -1;
+}
+
+/*
+ * send_reset - RST 로 연결을 끊음 (SO_LINGER 0 으로 close)
+ */
+static void send_reset(int fd) {
+  struct linger lg = {1, 0};
+
+  setsockopt(fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+  close(fd);
+}
+
+/*
+ * send_body - 바디를 동작대로 보냄
+ * @return 끝까지 보냈으면 0, 끊겼으면 -1, reset 으로 끊었으면 1 (fd 는 이미 닫힘)
+ */
+static int send_body(int fd, behavior_t *b, unsigned int *rnd) {
+  long long off = 0, limit = b->size, n;
+  long long slice = MAXSLICE;
+  char head[32];
+  double start = 0, due;
+  struct timespec ts;
+  int hl;
+
+  if (b->reset >= 0 && b->reset < limit) {
+    limit = b->reset;
+  }
+  // rate 가 있으면 초당 20 조각 정도로 나눠서 일정한 간격으로 보냄
+  if (b->rate > 0) {
+    slice = b->rate / 20 > 0 ? b->rate / 20 : 1;
+    if (slice > MAXSLICE) {
+      slice = MAXSLICE;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    start = ts.tv_sec + ts.tv_nsec / 1e9;
+  }
+  if (b->chunked && slice > b->chunk) {
+    slice = b->chunk;
+  }
+
+  while (off < limit) {
+    n = limit - off < slice ? limit - off : slice;
+    if (b->chunked) {
+      hl = sprintf(head, "%llx\r\n", n);
+      if (send_all(fd, head, hl) < 0) {
+        return -1;
+      }
+    }
+    if (send_all(fd, body + off % PATLEN, n) < 0 ||
+        (b->chunked && send_all(fd, "\r\n", 2) < 0)) {
+      return -1;
+    }
+    off += n;
+    if (b->stall > 0 && (int)(rand_r(rnd) % 100) < b->stall) {
+      sleep_ms(b->stallms);
+    }
+    if (b->rate > 0) {
+      // 시작 시각 기준으로 off 바이트를 보냈어야 할 시각까지 기다림 (멈춘 시간은 따라잡지 않음)
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      due = start + (double)off / b->rate - (ts.tv_sec + ts.tv_nsec / 1e9);
+      if (due > 0) {
+        sleep_ms((long)(due * 1000));
+      } else if (due < -1) {
+        start -= due + 1;
+      }
+    }
+  }
+  if (limit < b->size) {
+    send_reset(fd);
+    return 1;
+  }
+  if (b->chunked && send_all(fd, "0\r\n\r\n", 5) < 0) {
+    return -1;
+  }
+  return 0;
+}
+
+/*
+ * serve - 요청 하나에 응답
+ * @return 같은 연결로 다음 요청을 받을 수 있으면 1, 닫아야 하면 0, fd 가 이미 닫혔으면 -1
+ */
+static int serve(int fd, rio_t *rp) {
+  char uri[MAXLINE], hdr[MAXBUF], *q;
+  behavior_t b;
+  http_msg_t m;
+  http_header_t *h;
+  unsigned int rnd;
+  int keepalive, n, rc;
+
+  if (http_read_head(rp, &m, 0) <= 0) {
+    return 0;
+  }
+  view_cstr(uri, sizeof(uri), http_view(&m, m.uri));
+  keepalive = http_slice_is(&m, m.version, "HTTP/1.1");
+  if ((h = http_find_header(&m, "Connection")) != NULL) {
+    keepalive = http_has_token(&m, h->value, "keep-alive") ||
+                (keepalive && !http_has_token(&m, h->value, "close"));
+  }
+
+  memset(&b, 0, sizeof(b));
+  b.size = 1024;
+  b.status = 200;
+  b.stallms = 1000;
+  b.chunk = 4096;
+  b.reset = -1;
+  apply(&b, defaults);
+  if ((q = strchr(uri, '?')) != NULL) {
+    apply(&b, q + 1);
+  }
+  rnd = seed ^ hash_str(uri);
+  if (verbose) {
+    printf("%s\n", uri);
+    fflush(stdout);
+  }
+
+  if (b.hang) {
+    // 클라이언트가 끊을 때까지 아무것도 보내지 않음
+    while (read(fd, hdr, sizeof(hdr)) > 0)
+      ;
+    return 0;
+  }
+  if (b.ttfb > 0) {
+    sleep_ms(b.ttfb);
+  }
+
+  keepalive = keepalive && !b.nolen && b.reset < 0;
+  n = snprintf(hdr, sizeof(hdr), "HTTP/1.1 %d %s\r\nServer: badorigin\r\n"
+               "Content-type: text/plain\r\n", b.status, b.status == 200 ? "OK" : "Status");
+  if (b.chunked) {
+    n += snprintf(hdr + n, sizeof(hdr) - n, "Transfer-Encoding: chunked\r\n");
+  } else if (!b.nolen) {
+    n += snprintf(hdr + n, sizeof(hdr) - n, "Content-length: %lld\r\n", b.size);
+  }
+  if (b.cc[0]) {
+    n += snprintf(hdr + n, sizeof(hdr) - n, "Cache-Control: %s\r\n", b.cc);
+  }
+  n += snprintf(hdr + n, sizeof(hdr) - n, "Connection: %s\r\n\r\n",
+                keepalive ? "keep-alive" : "close");
+  if (send_all(fd, hdr, n) < 0) {
+    return 0;
+  }
+  if ((rc = send_body(fd, &b, &rnd)) != 0) {
+    return rc > 0 ? -1 : 0;
+  }
+  return keepalive;
+}
+
+static void *conn_thread(void *vargp) {
+  int fd = (int)(long)vargp, rc;
+  rio_t rio;
+
+  Pthread_detach(pthread_self());
+  Rio_readinitb(&rio, fd);
+  while ((rc = serve(fd, &rio)) > 0)
+    ;
+  if (rc == 0) {
+    close(fd);
+  }
+  return NULL;
+}
+
+int main(int argc, char **argv) {
+  int listenfd, connfd, c, nop = 0;
+  pthread_t tid;
+  size_t i;
+
+  while ((c = getopt(argc, argv, "d:s:nv")) != -1) {
+    switch (c) {
+    case 'd': defaults = optarg; break;
+    case 's': seed = strtoul(optarg, NULL, 10); break;
+    case 'n': nop = 1; break;
+    case 'v': verbose = 1; break;
+    default:
+      goto usage;
+    }
+  }
+  if (optind != argc - 1) {
+  usage:
+    fprintf(stderr, "usage: %s [-d defaults] [-s seed] [-n] [-v] <port>\n", argv[0]);
+    exit(1);
+  }
+  signal(SIGPIPE, SIG_IGN);
+  for (i = 0; i < sizeof(body); i++) {
+    body[i] = PATTERN[i % PATLEN];
+  }
+
+  listenfd = Open_listenfd(argv[optind]);
+  while (1) {
+    connfd = Accept(listenfd, NULL, NULL);
+    if (nop) {
+      // nop-server.py 처럼 받기만 하고 아무것도 하지 않음 (fd 도 닫지 않음)
+      continue;
+    }
+    Pthread_create(&tid, NULL, conn_thread, (void *)(long)connfd);
+  }
+}
@@ -0,0 +1,282 @@
+/*
+ * cachebench.c - 프록시 캐시(S3-FIFO) 와 단순 LRU 비교 벤치마크
+ *
+ * 1) hit ratio: zipf 분포의 hot set 요청 사이에 한 번씩만 지나가는 크롤링
+ *    요청을 섞어서 두 정책의 hit ratio 를 비교한다.
+ * 2) hit latency: 캐시를 hot set 으로 채운 뒤 여러 쓰레드가 hit 만 반복할 때
+ *    요청 하나에 걸리는 시간을 비교한다. LRU 는 hit 마다 리스트를 옮기느라
+ *    전역 mutex 를 잡는다.
+ *
+ * usage: cachebench [-t threads] [-n requests] [-s scan_percent]
+ */
+#include "csapp.h"
+#include "cache.h"
+
+#define MAX_CACHE_SIZE 1049000
+#define MAX_OBJECT_SIZE 102400
+
+#define NKEYS      4000        /* hot set 후보 키 개수 */
+#define ZIPF_ALPHA 0.9
+#define LRU_NBUCKETS 1024
+
+/*****************************************
+ * 비교 대상: 전역 mutex 하나를 쓰는 단순 LRU
+ *****************************************/
+typedef struct lru_obj {
+  char *key;
+  char *data;
+  size_t size;
+  struct lru_obj *hnext, *prev, *next;
+} lru_obj_t;
+
+static struct {
+  pthread_mutex_t lock;
+  lru_obj_t *buckets[LRU_NBUCKETS];
+  lru_obj_t *head, *tail;
+  size_t used;
+} lru;
+
+static unsigned int lru_hash(const char *key) {
+  unsigned int h = 2166136261u;
+
+  while (*key) {
+    h ^= (unsigned char)*key++;
+    h *= 16777619u;
+  }
+  return h % LRU_NBUCKETS;
+}
+
+static void lru_unlink(lru_obj_t *o) {
+  if (o->prev) o->prev->next = o->next; else lru.head = o->next;
+  if (o->next) o->next->prev = o->prev; else lru.tail = o->prev;
+}
+
+static void lru_pushfront(lru_obj_t *o) {
+  o->prev = NULL;
+  o->next = lru.head;
+  if (lru.head) lru.head->prev = o; else lru.tail = o;
+  lru.head = o;
+}
+
+/*
+ * lru_get - hit 이면 리스트 맨 앞으로 옮기고 응답을 복사해 감 (lock 안에서)
+ */
+static int lru_get(char *key, char *out) {
+  lru_obj_t *o;
+
+  pthread_mutex_lock(&lru.lock);
+  for (o = lru.buckets[lru_hash(key)]; o; o = o->hnext) {
+    if (!strcmp(o->key, key)) {
+      break;
+    }
+  }
+  if (o) {
+    lru_unlink(o);
+    lru_pushfront(o);
+    out[0] = o->data[0];
+  }
+  pthread_mutex_unlock(&lru.lock);
+  return o != NULL;
+}
+
+static void lru_put(char *key, char *data, size_t size) {
+  lru_obj_t *o, **pp;
+
+  pthread_mutex_lock(&lru.lock);
+  while (lru.used + size > MAX_CACHE_SIZE && lru.tail) {
+    o = lru.tail;
+    lru_unlink(o);
+    for (pp = &lru.buckets[lru_hash(o->key)]; *pp != o; pp = &(*pp)->hnext)
+      ;
+    *pp = o->hnext;
+    lru.used -= o->size;
+    Free(o->key);
+    Free(o->data);
+    Free(o);
+  }
+  o = Malloc(sizeof(lru_obj_t));
+  o->key = strdup(key);
+  o->data = Malloc(size);
+  memcpy(o->data, data, size);
+  o->size = size;
+  o->hnext = lru.buckets[lru_hash(key)];
+  lru.buckets[lru_hash(key)] = o;
+  lru_pushfront(o);
+  lru.used += size;
+  pthread_mutex_unlock(&lru.lock);
+}
+
+/*****************
+ * 워크로드 생성
+ *****************/
+static double zipf_cdf[NKEYS];
+static char payload[MAX_OBJECT_SIZE];
+
+static void zipf_init(void) {
+  double sum = 0;
+  int i;
+
+  for (i = 0; i < NKEYS; i++) {
+    sum += 1.0 / pow(i + 1, ZIPF_ALPHA);
+    zipf_cdf[i] = sum;
+  }
+  for (i = 0; i < NKEYS; i++) {
+    zipf_cdf[i] /= sum;
+  }
+}
+
+static int zipf_next(unsigned int *seed) {
+  double u = (double)rand_r(seed) / RAND_MAX;
+  int lo = 0, hi = NKEYS - 1, mid;
+
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+    if (zipf_cdf[mid] < u) lo = mid + 1; else hi = mid;
+  }
+  return lo;
+}
+
+/* 키마다 고정된 객체 크기 (1KB ~ 16KB) */
+static size_t obj_size(int id) {
+  return 1024 + (size_t)(id * 2654435761u % (15 * 1024));
+}
+
+static double now_sec(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * run_ratio - 같은 요청열을 두 캐시에 흘려서 hit ratio 측정
+ */
+static void run_ratio(long nreq, int scan_pct) {
+  unsigned int seed = 1;
+  long i, s3_hits = 0, lru_hits = 0, scan_id = 0;
+  char key[MAXLINE], out[1];
+  cache_obj_t *obj;
+  int id;
+
+  for (i = 0; i < nreq; i++) {
+    // scan_pct % 확률로 두 번 다시 오지 않는 크롤링 요청
+    if (rand_r(&seed) % 100 < scan_pct) {
+      id = NKEYS + scan_id++;
+      snprintf(key, MAXLINE, "crawl.example:80/page/%d", id);
+    } else {
+      id = zipf_next(&seed);
+      snprintf(key, MAXLINE, "hot.example:80/obj/%d", id);
+    }
+
+    if ((obj = cache_get(key)) != NULL) {
+      s3_hits++;
+      cache_release(obj);
+    } else {
+      cache_put(key, payload, obj_size(id));
+    }
+    if (lru_get(key, out)) {
+      lru_hits++;
+    } else {
+      lru_put(key, payload, obj_size(id));
+    }
+  }
+  printf("hit ratio (%ld requests, %d%% scan)\n", nreq, scan_pct);
+  printf("  s3-fifo : %6.2f%%\n", 100.0 * s3_hits / nreq);
+  printf("  lru     : %6.2f%%\n", 100.0 * lru_hits / nreq);
+}
+
+/*
+ * hit latency 측정용 쓰레드
+ */
+struct lat_arg {
+  int use_lru;
+  long nops;
+  unsigned int seed;
+};
+
+static int hot_ids[NKEYS];   /* 두 캐시에 모두 들어 있는 키 */
+static int nhot;
+
+static void *lat_thread(void *vargp) {
+  struct lat_arg *a = vargp;
+  char key[MAXLINE], out[1];
+  cache_obj_t *obj;
+  long i;
+
+  for (i = 0; i < a->nops; i++) {
+    snprintf(key, MAXLINE, "hot.example:80/obj/%d", hot_ids[rand_r(&a->seed) % nhot]);
+    if (a->use_lru) {
+      lru_get(key, out);
+    } else if ((obj = cache_get(key)) != NULL) {
+      out[0] = obj->data[0];
+      cache_release(obj);
+    }
+  }
+  return NULL;
+}
+
+static double run_latency(int use_lru, int nthreads, long nops) {
+  pthread_t tids[nthreads];
+  struct lat_arg args[nthreads];
+  double start;
+  int i;
+
+  start = now_sec();
+  for (i = 0; i < nthreads; i++) {
+    args[i].use_lru = use_lru;
+    args[i].nops = nops;
+    args[i].seed = i + 1;
+    Pthread_create(&tids[i], NULL, lat_thread, &args[i]);
+  }
+  for (i = 0; i < nthreads; i++) {
+    Pthread_join(tids[i], NULL);
+  }
+  return (now_sec() - start) * 1e9 / nops;
+}
+
+int main(int argc, char **argv) {
+  int c, nthreads = 4, scan_pct = 30;
+  long nreq = 500000, nops = 1000000;
+  char key[MAXLINE], out[1];
+  cache_obj_t *obj;
+  int i;
+
+  while ((c = getopt(argc, argv, "t:n:s:")) != -1) {
+    switch (c) {
+    case 't': nthreads = atoi(optarg); break;
+    case 'n': nreq = atol(optarg); break;
+    case 's': scan_pct = atoi(optarg); break;
+    default:
+      fprintf(stderr, "usage: %s [-t threads] [-n requests] [-s scan_percent]\n", argv[0]);
+      exit(1);
+    }
+  }
+
+  zipf_init();
+  cache_init(MAX_CACHE_SIZE, MAX_OBJECT_SIZE);
+  pthread_mutex_init(&lru.lock, NULL);
+  run_ratio(nreq, scan_pct);
+
+  // latency 측정: 두 캐시가 모두 hit 하는 키만 요청
+  for (i = 0; i < NKEYS; i++) {
+    snprintf(key, MAXLINE, "hot.example:80/obj/%d", i);
+    if ((obj = cache_get(key)) != NULL) {
+      hot_ids[nhot++] = i;
+      cache_release(obj);
+    }
+  }
+  for (i = 0; i < nhot; i++) {
+    snprintf(key, MAXLINE, "hot.example:80/obj/%d", hot_ids[i]);
+    if (!lru_get(key, out)) {
+      lru_put(key, payload, obj_size(hot_ids[i]));
+    }
+  }
+  if (nhot == 0) {
+    printf("no resident hot keys, skipping latency test\n");
+    return 0;
+  }
+  printf("hit latency (%d threads, %d hot keys)\n", nthreads, nhot);
+  printf("  s3-fifo : %7.1f ns/hit\n", run_latency(0, nthreads, nops));
+  printf("  lru     : %7.1f ns/hit\n", run_latency(1, nthreads, nops));
+  return 0;
+}
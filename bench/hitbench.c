@@ -0,0 +1,153 @@
+/*
+ * hitbench.c - 프록시 처리량(requests/sec) 측정용 closed-loop 클라이언트
+ *
+ * 쓰레드 conns 개가 각자 "연결 -> GET 한 번 -> EOF 까지 읽기 -> 닫기" 를
+ * seconds 초 동안 반복하고, 끝나면 초당 완료한 요청 수와 요청 지연의
+ * p50/p99 를 출력한다.
+ * 같은 URL 만 요청하므로 첫 요청 이후로는 모두 프록시 캐시 hit 이고,
+ * 원격 서버가 아니라 프록시의 accept/응답 경로를 잰다.
+ * -u 를 주면 요청마다 "?번호" 를 붙여서 모든 요청이 캐시 miss 가 되므로
+ * 원격 서버까지 가는 경로(연결, 이름 해석, 중계)를 잰다.
+ *
+ * usage: hitbench [-c conns] [-d seconds] [-u] <proxy_host> <proxy_port> <url>
+ */
+#include <stdatomic.h>
+#include "csapp.h"
+
+#define MAXSAMPLES 200000    /* 쓰레드 하나가 기록할 최대 지연 샘플 수 */
+
+static char *proxy_host, *proxy_port, *url;
+static int unique;
+static atomic_long seq;
+static volatile int stop;
+
+struct worker {
+  long done;
+  long errors;
+  double *lat;        /* 요청별 지연 (초) */
+};
+
+static double now_sec(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int cmp_double(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+
+  return x < y ? -1 : x > y;
+}
+
+/*
+ * fetch - 요청 하나 보내고 응답을 EOF 까지 읽어 버림
+ * @return 성공이면 0, 실패면 -1
+ */
+static int fetch(void) {
+  char buf[MAXBUF];
+  ssize_t n, total = 0;
+  int fd, len;
+
+  if ((fd = open_clientfd(proxy_host, proxy_port)) < 0) {
+    return -1;
+  }
+  if (unique) {
+    len = snprintf(buf, MAXBUF, "GET %s?%ld HTTP/1.0\r\n\r\n", url, atomic_fetch_add(&seq, 1));
+  } else {
+    len = snprintf(buf, MAXBUF, "GET %s HTTP/1.0\r\n\r\n", url);
+  }
+  if (rio_writen(fd, buf, len) != len) {
+    close(fd);
+    return -1;
+  }
+  while ((n = read(fd, buf, MAXBUF)) > 0) {
+    total += n;
+  }
+  close(fd);
+  return n < 0 || total == 0 ? -1 : 0;
+}
+
+static void *worker(void *vargp) {
+  struct worker *w = vargp;
+  double start;
+
+  while (!stop) {
+    start = now_sec();
+    if (fetch() == 0) {
+      if (w->done < MAXSAMPLES) {
+        w->lat[w->done] = now_sec() - start;
+      }
+      w->done++;
+    } else {
+      w->errors++;
+    }
+  }
+  return NULL;
+}
+
+int main(int argc, char **argv) {
+  int c, i, conns = 64, seconds = 5;
+  long done = 0, errors = 0, nlat = 0, n;
+  double *lat;
+
+  while ((c = getopt(argc, argv, "c:d:u")) != -1) {
+    switch (c) {
+    case 'c': conns = atoi(optarg); break;
+    case 'd': seconds = atoi(optarg); break;
+    case 'u': unique = 1; break;
+    default:
+      goto usage;
+    }
+  }
+  if (optind != argc - 3 || conns <= 0 || seconds <= 0) {
+  usage:
+    fprintf(stderr, "usage: %s [-c conns] [-d seconds] [-u] <proxy_host> <proxy_port> <url>\n", argv[0]);
+    exit(1);
+  }
+  proxy_host = argv[optind];
+  proxy_port = argv[optind + 1];
+  url = argv[optind + 2];
+  signal(SIGPIPE, SIG_IGN);
+
+  // 캐시를 채워 두기
+  if (fetch() < 0) {
+    fprintf(stderr, "warm-up request failed\n");
+    exit(1);
+  }
+
+  pthread_t tids[conns];
+  struct worker ws[conns];
+
+  memset(ws, 0, sizeof(ws));
+  for (i = 0; i < conns; i++) {
+    ws[i].lat = Malloc(MAXSAMPLES * sizeof(double));
+    Pthread_create(&tids[i], NULL, worker, &ws[i]);
+  }
+  sleep(seconds);
+  stop = 1;
+  for (i = 0; i < conns; i++) {
+    Pthread_join(tids[i], NULL);
+    done += ws[i].done;
+    errors += ws[i].errors;
+  }
+
+  // 모든 쓰레드의 지연 샘플을 모아 정렬
+  lat = Malloc((done < (long)conns * MAXSAMPLES ? done : (long)conns * MAXSAMPLES) * sizeof(double) + 1);
+  for (i = 0; i < conns; i++) {
+    n = ws[i].done < MAXSAMPLES ? ws[i].done : MAXSAMPLES;
+    memcpy(lat + nlat, ws[i].lat, n * sizeof(double));
+    nlat += n;
+    Free(ws[i].lat);
+  }
+  qsort(lat, nlat, sizeof(double), cmp_double);
+
+  printf("%.0f req/s (%ld requests, %ld errors, %d conns, %d s)", (double)done / seconds,
+         done, errors, conns, seconds);
+  if (nlat > 0) {
+    printf(" p50 %.3f ms p99 %.3f ms", lat[nlat / 2] * 1e3, lat[nlat * 99 / 100] * 1e3);
+  }
+  printf("\n");
+  Free(lat);
+  return 0;
+}
@@ -0,0 +1,393 @@
+/*
+ * loadgen.c - 프록시와 tiny 용 부하 발생기
+ *
+ * URL 집합은 tiny 문서 디렉터리(기본 ../tiny)에 있는 정적 파일 중 tiny 가
+ * 아는 확장자(.html .gif .jpg .jpeg .mp4)를 이름 순으로 모은 것이다. 시드를
+ * 고정한 난수로 고르므로 같은 옵션이면 어느 리눅스 박스에서나 같은 요청
+ * 순서가 나오고 네트워크가 필요 없다. 받은 바디 길이는 파일 크기와 비교한다.
+ *
+ *   closed loop (기본) : 연결 conns 개가 각자 응답을 받자마자 다음 요청
+ *   open loop  (-r)    : 응답과 상관없이 전체 rate req/s 일정 간격으로 요청.
+ *                        지연은 보내기로 한 시각부터 재므로 서버가 밀려서
+ *                        늦게 보낸 시간도 지연에 들어간다 (coordinated omission 보정)
+ *
+ * -x 로 프록시를 주면 절대 URI 로 프록시에 보내고, 없으면 tiny 에 직접 보낸다.
+ * -k 면 HTTP/1.1 keep-alive 로 연결을 재사용하고, 없으면 요청마다 연결한다.
+ * 지연은 프록시의 통계와 같은 log-linear 히스토그램(stats.c)에 모은다.
+ *
+ * usage: loadgen [-c conns] [-d seconds] [-w warmup] [-r rate] [-k] [-x proxy_host:port]
+ *                [-D docroot] [-m maxbytes] [-s seed] <host> <port>
+ */
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <netinet/tcp.h>
+#include "csapp.h"
+#include "httpparse.h"
+#include "stats.h"
+
+#define MAXURLS  256
+#define RBUFSIZE 65536      /* 응답 읽기 버퍼 */
+
+typedef struct {
+  char path[MAXLINE];       /* "/home.html" */
+  long size;                /* 파일 크기 = 200 응답 바디 길이 */
+} url_t;
+
+/* 연결 쓰레드 하나 */
+typedef struct {
+  pthread_t tid;
+  int id;
+  int fd;                   /* keep-alive 로 들고 있는 연결, 없으면 -1 */
+  unsigned int seed;
+  long requests;            /* 측정 구간에 끝난 요청 */
+  long long bytes;
+  long err_connect, err_io, err_short;
+  long status[6];           /* 1xx..5xx, [0] 은 알 수 없음 */
+  char *buf;
+} worker_t;
+
+static url_t urls[MAXURLS];
+static int nurls;
+static char *host, *port, *via_host, *via_port;
+static int keepalive, conns = 16;
+static double rate;                 /* open loop 전체 req/s, 0 이면 closed loop */
+static volatile int stop, recording;
+static stats_hist_t latency;
+
+static double now_sec(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int cmp_url(const void *a, const void *b) {
+  return strcmp(((const url_t *)a)->path, ((const url_t *)b)->path);
+}
+
+/*
+ * load_urls - docroot 에서 tiny 가 정적 파일로 주는 파일을 모아 이름 순으로 정렬
+ */
+static void load_urls(char *docroot, long maxbytes) {
+  static const char *exts[] = {".html", ".gif", ".jpg", ".jpeg", ".mp4"};
+  char file[MAXLINE];
+  struct dirent *de;
+  struct stat st;
+  char *ext;
+  DIR *dir;
+  int i;
+
+  if ((dir = opendir(docroot)) == NULL) {
+    unix_error("opendir");
+  }
+  while ((de = readdir(dir)) != NULL && nurls < MAXURLS) {
+    if ((ext = strrchr(de->d_name, '.')) == NULL) {
+      continue;
+    }
+    for (i = 0; i < (int)(sizeof(exts) / sizeof(exts[0])); i++) {
+      if (!strcmp(ext, exts[i])) {
+        break;
+      }
+    }
+    snprintf(file, MAXLINE, "%s/%s", docroot, de->d_name);
+    if (i == (int)(sizeof(exts) / sizeof(exts[0])) || stat(file, &st) < 0 ||
+        !S_ISREG(st.st_mode) || (maxbytes > 0 && st.st_size > maxbytes)) {
+      continue;
+    }
+    snprintf(urls[nurls].path, MAXLINE, "/%s", de->d_name);
+    urls[nurls].size = st.st_size;
+    nurls++;
+  }
+  closedir(dir);
+  qsort(urls, nurls, sizeof(url_t), cmp_url);
+}
+
+/*
+ * drop - 들고 있는 연결을 닫음
+ */
+static void drop(worker_t *w) {
+  if (w->fd >= 0) {
+    close(w->fd);
+    w->fd = -1;
+  }
+}
+
+/*
+ * fetch_once - 요청 하나를 보내고 응답을 끝까지 읽음
+ * @return 응답 상태 코드, 연결 실패면 -1, 응답을 못 받았으면 -2
+ *   *bytes 에 받은 바디 길이, *fresh 에 이번에 새로 연결했는지
+ */
+static int fetch_once(worker_t *w, url_t *u, long *bytes, int *fresh) {
+  char req[MAXLINE];
+  size_t len = 0;
+  ssize_t n, hlen = 0;
+  long clen = -1, got;
+  int one = 1, close_after = !keepalive, rlen;
+  http_msg_t m;
+  http_header_t *h;
+
+  *bytes = 0;
+  *fresh = w->fd < 0;
+  if (w->fd < 0) {
+    if ((w->fd = open_clientfd(via_host ? via_host : host, via_host ? via_port : port)) < 0) {
+      return -1;
+    }
+    setsockopt(w->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  }
+
+  // 프록시에는 절대 URI, tiny 에는 경로만
+  rlen = snprintf(req, MAXLINE, "GET %s%s%s%s%s HTTP/%s\r\nHost: %s:%s\r\n%s\r\n",
+                  via_host ? "http://" : "", via_host ? host : "", via_host ? ":" : "",
+                  via_host ? port : "", u->path, keepalive ? "1.1" : "1.0", host, port,
+                  keepalive ? "Connection: keep-alive\r\n" : "Connection: close\r\n");
+  if (rio_writen(w->fd, req, rlen) != rlen) {
+    drop(w);
+    return -2;
+  }
+
+  // 헤더 블록이 다 올 때까지 읽음
+  while (1) {
+    if ((n = read(w->fd, w->buf + len, RBUFSIZE - len)) <= 0) {
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      drop(w);
+      return -2;
+    }
+    len += n;
+    if ((hlen = http_parse_response(w->buf, len, &m)) != 0) {
+      break;
+    }
+    if (len == RBUFSIZE) {
+      hlen = -1;
+      break;
+    }
+  }
+  if (hlen < 0) {
+    drop(w);
+    return -2;
+  }
+  if ((h = http_find_header(&m, "Content-length")) != NULL) {
+    clen = strtol(HTTP_PTR(&m, h->value), NULL, 10);
+  }
+  if ((h = http_find_header(&m, "Connection")) != NULL) {
+    close_after = close_after || http_has_token(&m, h->value, "close");
+  } else if (!http_slice_is(&m, m.version, "HTTP/1.1")) {
+    close_after = 1;
+  }
+  if (clen < 0) {
+    close_after = 1;
+  }
+
+  // 바디: 길이를 알면 그만큼, 모르면 EOF 까지
+  got = len - hlen;
+  while (clen < 0 || got < clen) {
+    if ((n = read(w->fd, w->buf, RBUFSIZE)) < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      break;
+    }
+    got += n;
+  }
+  *bytes = got;
+  if (close_after || (clen >= 0 && got != clen)) {
+    drop(w);
+  }
+  return m.status;
+}
+
+/*
+ * fetch - 요청 하나를 처리하고 결과를 센다. keep-alive 로 들고 있던 연결이
+ *   그 사이 닫혀서 실패했으면 새 연결로 한 번 다시 보냄
+ */
+static void fetch(worker_t *w, double intended) {
+  url_t *u = &urls[rand_r(&w->seed) % nurls];
+  long bytes;
+  int status, fresh;
+  double done;
+
+  status = fetch_once(w, u, &bytes, &fresh);
+  if (status == -2 && !fresh) {
+    status = fetch_once(w, u, &bytes, &fresh);
+  }
+  done = now_sec();
+  if (!recording) {
+    return;
+  }
+  if (status == -1) {
+    w->err_connect++;
+    return;
+  }
+  if (status == -2) {
+    w->err_io++;
+    return;
+  }
+  w->requests++;
+  w->bytes += bytes;
+  w->status[status >= 100 && status < 600 ? status / 100 : 0]++;
+  if (status == 200 && bytes != u->size) {
+    w->err_short++;
+  }
+  stats_hist_add(&latency, (long long)((done - intended) * 1e9));
+}
+
+static void *worker(void *vargp) {
+  worker_t *w = vargp;
+  double interval, next;
+
+  if (rate <= 0) {
+    while (!stop) {
+      fetch(w, now_sec());
+    }
+  } else {
+    // 연결마다 rate / conns 로 나누고, 시작 시각을 조금씩 어긋나게 해서 고르게 퍼뜨림
+    interval = conns / rate;
+    next = now_sec() + interval * w->id / conns;
+    while (!stop) {
+      struct timespec ts;
+      double wait = next - now_sec();
+
+      if (wait > 0) {
+        ts.tv_sec = (time_t)wait;
+        ts.tv_nsec = (long)((wait - ts.tv_sec) * 1e9);
+        nanosleep(&ts, NULL);
+        continue;
+      }
+      fetch(w, next);
+      next += interval;
+    }
+  }
+  drop(w);
+  return NULL;
+}
+
+/*
+ * split_hostport - "host:port" 를 나눔
+ */
+static int split_hostport(char *s, char **h, char **p) {
+  char *colon = strrchr(s, ':');
+
+  if (!colon || colon == s || !colon[1]) {
+    return -1;
+  }
+  *colon = '\0';
+  *h = s;
+  *p = colon + 1;
+  return 0;
+}
+
+static void usage(char *prog) {
+  fprintf(stderr, "usage: %s [-c conns] [-d seconds] [-w warmup] [-r rate] [-k] "
+          "[-x proxy_host:port] [-D docroot] [-m maxbytes] [-s seed] <host> <port>\n", prog);
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  static const double spectrum[] = {0.0, 0.10, 0.25, 0.50, 0.75, 0.90, 0.95, 0.99, 0.995,
+                                    0.999, 0.9999, 1.0};
+  int nspec = sizeof(spectrum) / sizeof(spectrum[0]);
+  unsigned long vals[sizeof(spectrum) / sizeof(spectrum[0])];
+  char *docroot = "../tiny";
+  int c, i, seconds = 5, warmup = 1;
+  unsigned int seed = 1;
+  long maxbytes = 0, requests = 0, err_connect = 0, err_io = 0, err_short = 0, status[6] = {0};
+  long long bytes = 0;
+  unsigned long count;
+  double start, elapsed;
+  worker_t *ws;
+
+  while ((c = getopt(argc, argv, "c:d:w:r:kx:D:m:s:")) != -1) {
+    switch (c) {
+    case 'c': conns = atoi(optarg); break;
+    case 'd': seconds = atoi(optarg); break;
+    case 'w': warmup = atoi(optarg); break;
+    case 'r': rate = atof(optarg); break;
+    case 'k': keepalive = 1; break;
+    case 'x':
+      if (split_hostport(optarg, &via_host, &via_port) < 0) {
+        usage(argv[0]);
+      }
+      break;
+    case 'D': docroot = optarg; break;
+    case 'm': maxbytes = atol(optarg); break;
+    case 's': seed = strtoul(optarg, NULL, 10); break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (optind != argc - 2 || conns <= 0 || seconds <= 0 || warmup < 0 || rate < 0) {
+    usage(argv[0]);
+  }
+  host = argv[optind];
+  port = argv[optind + 1];
+  signal(SIGPIPE, SIG_IGN);
+
+  load_urls(docroot, maxbytes);
+  if (nurls == 0) {
+    fprintf(stderr, "no static files under %s\n", docroot);
+    exit(1);
+  }
+
+  if (via_host) {
+    printf("target   : %s:%s via proxy %s:%s\n", host, port, via_host, via_port);
+  } else {
+    printf("target   : %s:%s\n", host, port);
+  }
+  printf("urls     : %d static files from %s\n", nurls, docroot);
+  if (rate > 0) {
+    printf("mode     : open loop %.0f req/s, %d conns, %s, %d s (+%d s warm-up)\n", rate, conns,
+           keepalive ? "keep-alive" : "connection per request", seconds, warmup);
+  } else {
+    printf("mode     : closed loop, %d conns, %s, %d s (+%d s warm-up)\n", conns,
+           keepalive ? "keep-alive" : "connection per request", seconds, warmup);
+  }
+
+  ws = Calloc(conns, sizeof(worker_t));
+  for (i = 0; i < conns; i++) {
+    ws[i].id = i;
+    ws[i].fd = -1;
+    ws[i].seed = seed + i;
+    ws[i].buf = Malloc(RBUFSIZE);
+    Pthread_create(&ws[i].tid, NULL, worker, &ws[i]);
+  }
+  sleep(warmup);
+  recording = 1;
+  start = now_sec();
+  sleep(seconds);
+  stop = 1;
+  elapsed = now_sec() - start;
+  for (i = 0; i < conns; i++) {
+    Pthread_join(ws[i].tid, NULL);
+    requests += ws[i].requests;
+    bytes += ws[i].bytes;
+    err_connect += ws[i].err_connect;
+    err_io += ws[i].err_io;
+    err_short += ws[i].err_short;
+    for (c = 0; c < 6; c++) {
+      status[c] += ws[i].status[c];
+    }
+    Free(ws[i].buf);
+  }
+  Free(ws);
+
+  printf("requests : %ld in %.2f s, %.1f req/s, %.2f MB/s\n", requests, elapsed,
+         requests / elapsed, bytes / elapsed / 1e6);
+  printf("status   : 2xx %ld, 3xx %ld, 4xx %ld, 5xx %ld, other %ld\n", status[2], status[3],
+         status[4], status[5], status[0] + status[1]);
+  printf("errors   : connect %ld, io %ld, short body %ld\n", err_connect, err_io, err_short);
+
+  count = atomic_load(&latency.count);
+  if (count == 0) {
+    return 0;
+  }
+  printf("latency  : mean %.3f ms, max %.3f ms\n", atomic_load(&latency.sum) / 1e6 / count,
+         atomic_load(&latency.max) / 1e6);
+  printf("  %9s %12s %10s\n", "percentile", "latency(ms)", "requests");
+  stats_hist_quantiles(&latency, spectrum, nspec, vals);
+  for (i = 0; i < nspec; i++) {
+    printf("  %9.2f%% %12.3f %10lu\n", spectrum[i] * 100, vals[i] / 1e6,
+           (unsigned long)(spectrum[i] * count + 0.5));
+  }
+  return 0;
+}
@@ -0,0 +1,159 @@
+/*
+ * relaybench.c - 응답 바디 전달 방식별 처리량 비교
+ *
+ *   line   : 예전 forward_request 처럼 Rio_readlineb 한 줄마다 Rio_writen
+ *   block  : relay_copy (RELAY_BLOCK 단위 read/write)
+ *   splice : relay_splice (pipe 를 거친 splice, user space 복사 없음)
+ *
+ * origin 쓰레드가 loopback TCP 로 헤더 + 바디를 보내고, 측정 대상 relay 가
+ * 그것을 다른 loopback TCP 연결로 넘기면 sink 쓰레드가 읽어서 버린다.
+ *
+ * usage: relaybench [-m megabytes] [-r rounds]
+ */
+#include "csapp.h"
+#include "relay.h"
+
+#define ORIGIN_BLOCK 1048576
+
+static size_t body_size;
+
+/*
+ * tcp_pair - loopback 으로 서로 연결된 TCP 소켓 한 쌍 만들기
+ */
+static void tcp_pair(int fds[2]) {
+  struct sockaddr_in addr;
+  socklen_t len = sizeof(addr);
+  int listenfd;
+
+  listenfd = Socket(AF_INET, SOCK_STREAM, 0);
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  Bind(listenfd, (SA *)&addr, sizeof(addr));
+  Listen(listenfd, 1);
+  getsockname(listenfd, (SA *)&addr, &len);
+  fds[0] = Socket(AF_INET, SOCK_STREAM, 0);
+  Connect(fds[0], (SA *)&addr, sizeof(addr));
+  fds[1] = Accept(listenfd, NULL, NULL);
+  Close(listenfd);
+}
+
+/*
+ * origin - 헤더와 body_size 바이트의 바디를 쓰고 닫음
+ */
+static void *origin(void *vargp) {
+  int fd = *(int *)vargp;
+  char hdr[MAXLINE], *block = Malloc(ORIGIN_BLOCK);
+  size_t left = body_size, n;
+  unsigned int seed = 1;
+
+  // 실제 바이너리처럼 '\n' 이 평균 256 바이트마다 한 번씩 나오는 바디
+  for (n = 0; n < ORIGIN_BLOCK; n++) {
+    block[n] = rand_r(&seed);
+  }
+  sprintf(hdr, "HTTP/1.0 200 OK\r\nContent-length: %zu\r\nContent-type: video/mp4\r\n\r\n", body_size);
+  Rio_writen(fd, hdr, strlen(hdr));
+  while (left > 0) {
+    n = left < ORIGIN_BLOCK ? left : ORIGIN_BLOCK;
+    Rio_writen(fd, block, n);
+    left -= n;
+  }
+  Close(fd);
+  Free(block);
+  return NULL;
+}
+
+/*
+ * sink - EOF 까지 읽어서 버림
+ */
+static void *sink(void *vargp) {
+  int fd = *(int *)vargp;
+  char *buf = Malloc(ORIGIN_BLOCK);
+
+  while (read(fd, buf, ORIGIN_BLOCK) > 0)
+    ;
+  Close(fd);
+  Free(buf);
+  return NULL;
+}
+
+static double now_sec(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * run - mode 로 한 번 전달하고 걸린 시간(초) 반환
+ */
+static double run(const char *mode) {
+  int up[2], down[2];
+  pthread_t otid, stid;
+  char line[MAXBUF];
+  ssize_t n;
+  double start;
+  rio_t rio;
+
+  tcp_pair(up);
+  tcp_pair(down);
+  start = now_sec();
+  Pthread_create(&otid, NULL, origin, &up[1]);
+  Pthread_create(&stid, NULL, sink, &down[1]);
+
+  Rio_readinitb(&rio, up[0]);
+  if (!strcmp(mode, "line")) {
+    while ((n = Rio_readlineb(&rio, line, MAXBUF)) != 0) {
+      Rio_writen(down[0], line, n);
+    }
+  } else {
+    while ((n = Rio_readlineb(&rio, line, MAXBUF)) > 0) {
+      Rio_writen(down[0], line, n);
+      if (!strcmp(line, "\r\n")) {
+        break;
+      }
+    }
+    if (!strcmp(mode, "block")) {
+      relay_copy(&rio, down[0], -1, NULL);
+    } else {
+      relay_splice(&rio, down[0], -1, NULL);
+    }
+  }
+  Close(up[0]);
+  Close(down[0]);
+  Pthread_join(otid, NULL);
+  Pthread_join(stid, NULL);
+  return now_sec() - start;
+}
+
+int main(int argc, char **argv) {
+  static char *modes[] = {"line", "block", "splice"};
+  int c, i, r, rounds = 3;
+  long mb = 100;
+  double t, best;
+
+  while ((c = getopt(argc, argv, "m:r:")) != -1) {
+    switch (c) {
+    case 'm': mb = atol(optarg); break;
+    case 'r': rounds = atoi(optarg); break;
+    default:
+      fprintf(stderr, "usage: %s [-m megabytes] [-r rounds]\n", argv[0]);
+      exit(1);
+    }
+  }
+  body_size = (size_t)mb << 20;
+  signal(SIGPIPE, SIG_IGN);
+
+  printf("relay %ld MB body, best of %d\n", mb, rounds);
+  for (i = 0; i < 3; i++) {
+    best = 0;
+    for (r = 0; r < rounds; r++) {
+      t = run(modes[i]);
+      if (best == 0 || t < best) {
+        best = t;
+      }
+    }
+    printf("  %-6s : %8.1f MB/s (%.3f s)\n", modes[i], mb / best, best);
+  }
+  return 0;
+}
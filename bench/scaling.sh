@@ -0,0 +1,50 @@
+#!/bin/bash
+#
+# scaling.sh - epoll 엔진의 코어 수별 처리량 비교
+#
+# 코어 수 n = 1, 2, 4, 8 마다 프록시를 taskset 으로 CPU 0..n-1 에 묶어서
+#   shared    : -e epoll -r n     (리슨 소켓 하나를 reactor 들이 같이 씀)
+#   reuseport : -e epoll -r n -R  (reactor 마다 SO_REUSEPORT 소켓 + CPU 고정)
+# 두 가지로 띄우고, hitbench 로 캐시 hit 요청의 requests/sec 를 잰다.
+# 머신의 코어 수보다 큰 n 은 건너뛴다. 클라이언트도 같은 머신에서 돌기
+# 때문에 코어가 n 개보다 넉넉해야 프록시 쪽 확장성이 제대로 보인다.
+#
+# usage: scaling.sh [seconds] [conns]
+#
+
+SECONDS_PER_RUN=${1:-5}
+CONNS=${2:-64}
+NCPU=$(nproc)
+
+cd "$(dirname "$0")"
+make -s hitbench || exit 1
+
+TINY_PORT=$(( 20000 + RANDOM % 10000 ))
+PROXY_PORT=$(( TINY_PORT + 1 ))
+
+(cd ../tiny && exec ./tiny ${TINY_PORT} >/dev/null 2>&1) &
+TINY_PID=$!
+trap 'kill ${TINY_PID} 2>/dev/null' EXIT
+sleep 0.5
+
+# run <cores> <proxy args...>
+run() {
+  local n=$1
+  shift
+  taskset -c 0-$(( n - 1 )) ../proxy "$@" ${PROXY_PORT} >/dev/null 2>&1 &
+  local pid=$!
+  sleep 0.5
+  ./hitbench -c ${CONNS} -d ${SECONDS_PER_RUN} localhost ${PROXY_PORT} \
+    http://localhost:${TINY_PORT}/home.html
+  kill ${pid}
+  wait ${pid} 2>/dev/null
+}
+
+for n in 1 2 4 8; do
+  if [ ${n} -gt ${NCPU} ]; then
+    echo "cores=${n}: skipped (only ${NCPU} CPUs)"
+    continue
+  fi
+  echo -n "cores=${n} shared    : "; run ${n} -e epoll -r ${n}
+  echo -n "cores=${n} reuseport : "; run ${n} -e epoll -r ${n} -R
+done
@@ -0,0 +1,777 @@
+/*
+ * cache.c - 프록시용 샤딩된 인메모리 웹 객체 캐시 (S3-FIFO 교체 정책)
+ *
+ * - 키 해시로 샤드를 고르고, 샤드 안에서는 버킷 체인으로 객체를 찾는다.
+ * - 해시 테이블, FIFO 두 개(S, M), ghost 목록, 사용 바이트 수는 qlock 하나로
+ *   보호한다. qlock 은 miss 후 cache_put 에서만 잡는다.
+ * - 조회(cache_get)는 lock 을 잡지 않는다. 버킷 체인은 atomic 포인터라서
+ *   qlock 을 잡은 쪽이 바꾸는 중에도 따라갈 수 있다. 조회하는 동안은 자기
+ *   쓰레드의 epoch 기록에 전역 epoch 를 적어 둔다. 테이블에서 뺀 객체는 전역
+ *   epoch 를 올리면서 그 값을 찍어 retired 목록에 넣는다. 그보다 오래된
+ *   epoch 로 조회 중인 쓰레드가 하나도 없을 때 테이블의 참조를 놓는다 (reclaim).
+ *   hit 마다 쓰는 공유 메모리는 객체의 참조 카운트뿐이다. freq 는 상한이면
+ *   쓰지 않고, hit/miss 카운터는 쓰레드마다 따로 센다.
+ * - 새 객체는 먼저 필요한 만큼 쫓아낸 뒤에 들어가므로 저장된 바이트 합이
+ *   max_cache 를 넘는 순간이 없다.
+ * - 쫓겨난 객체도 누군가 클라이언트로 보내는 중이면 refcnt 가 0 이 될
+ *   때까지 메모리에 남아 있다가 마지막 cache_release 에서 해제된다.
+ * - 받아오는 중인 객체(flight)는 샤드마다 따로 있는 flock 아래의 목록에
+ *   걸어 둔다. 객체가 max_object 를 넘으면 목록에서 빼서 새 요청이 더
+ *   붙지 못하게 하고, 이미 붙은 follower 를 위해 최근 CACHE_WINDOW
+ *   바이트만 남겨 둔다. 그보다 뒤처진 follower 는 끊긴다.
+ */
+#include <limits.h>
+#include "cache.h"
+
+typedef struct {
+  _Atomic(cache_obj_t *) buckets[CACHE_NBUCKETS];
+  pthread_mutex_t flock;        /* flights 보호 */
+  flight_t *flights;            /* 받아오는 중인 객체 목록 */
+} cache_shard_t;
+
+/* 쓰레드마다 하나. 다른 쓰레드와 캐시 라인을 나누지 않도록 64 바이트에 맞춤 */
+typedef struct cache_reader {
+  _Alignas(64) atomic_ulong epoch;  /* 조회 중이면 시작할 때의 전역 epoch, 아니면 0 */
+  atomic_ulong hits, misses;    /* 이 쓰레드의 조회 결과, 이 쓰레드만 씀 */
+  struct cache_reader *next;
+} cache_reader_t;
+
+/* ghost 해시 셋의 칸 하나. hash 가 0 이면 빈 칸 */
+typedef struct {
+  unsigned int hash;
+  int pos;                      /* ghosts 안에서 이 기록의 위치 */
+} ghost_slot_t;
+
+#define GHOST_SLOTS (1 << CACHE_GHOSTBITS)
+
+/* FIFO 하나. head 가 가장 최근에 들어온 객체 */
+typedef struct {
+  cache_obj_t *head, *tail;
+  size_t bytes;
+} cache_queue_t;
+
+static struct {
+  cache_shard_t shards[CACHE_NSHARDS];
+  size_t max_cache;             /* 전체 바이트 예산 */
+  size_t max_object;            /* 객체 하나의 최대 크기 */
+  pthread_mutex_t qlock;        /* 해시 테이블 변경과 아래 필드들 보호 */
+  cache_queue_t small, main;    /* S3-FIFO 의 S, M */
+  unsigned int ghosts[CACHE_GHOSTS];  /* 기록한 순서 (원형), 가장 오래된 기록부터 덮어씀 */
+  int ghost_next;
+  ghost_slot_t ghostset[GHOST_SLOTS]; /* 기록된 해시 -> ghosts 위치 (open addressing) */
+  cache_obj_t *retired, *retired_tail;  /* 테이블에서 빠졌고 놓아 주기를 기다리는 객체 */
+  atomic_ulong epoch;           /* 테이블에서 객체를 뺄 때마다 올라감, 0 은 쓰지 않음 */
+  pthread_mutex_t rlock;        /* readers 보호 */
+  cache_reader_t *readers;      /* 조회한 적 있는 쓰레드들 */
+  atomic_size_t used;           /* 현재 저장된 바이트 수 */
+  atomic_ulong inserts, evictions, promotions, coalesced;
+} cache;
+
+static __thread cache_reader_t *reader;   /* 이 쓰레드의 epoch 기록 */
+
+/*
+ * hash_key - FNV-1a 문자열 해시
+ */
+static unsigned int hash_key(const char *key) {
+  unsigned int h = 2166136261u;
+
+  while (*key) {
+    h ^= (unsigned char)*key++;
+    h *= 16777619u;
+  }
+  return h;
+}
+
+/*
+ * cache_init - 캐시 초기화, main 에서 쓰레드를 만들기 전에 한 번 호출
+ */
+void cache_init(size_t max_cache, size_t max_object) {
+  int i;
+
+  memset(&cache, 0, sizeof(cache));
+  for (i = 0; i < CACHE_NSHARDS; i++) {
+    pthread_mutex_init(&cache.shards[i].flock, NULL);
+  }
+  pthread_mutex_init(&cache.qlock, NULL);
+  pthread_mutex_init(&cache.rlock, NULL);
+  atomic_init(&cache.epoch, 1);
+  cache.max_cache = max_cache;
+  cache.max_object = max_object;
+}
+
+/*
+ * cache_makekey - parse_uri 결과로 캐시 키 만들기
+ */
+void cache_makekey(char *key, view_t hostname, view_t port, view_t pathname) {
+  snprintf(key, MAXLINE, "%.*s:%.*s%.*s", hostname.len, hostname.p, port.len, port.p,
+           pathname.len, pathname.p);
+}
+
+/*
+ * obj_free - 객체 메모리 해제
+ */
+static void obj_free(cache_obj_t *obj) {
+  Free(obj->key);
+  Free(obj->data);
+  Free(obj);
+}
+
+/*
+ * cache_release - cache_get 으로 얻은 객체 사용 종료
+ */
+void cache_release(cache_obj_t *obj) {
+  if (atomic_fetch_sub(&obj->refcnt, 1) == 1) {
+    obj_free(obj);
+  }
+}
+
+/*
+ * shard_of / bucket_of - 해시 값으로 샤드와 버킷 찾기
+ */
+static cache_shard_t *shard_of(unsigned int h) {
+  return &cache.shards[h % CACHE_NSHARDS];
+}
+
+static _Atomic(cache_obj_t *) *bucket_of(cache_shard_t *sp, unsigned int h) {
+  return &sp->buckets[(h / CACHE_NSHARDS) % CACHE_NBUCKETS];
+}
+
+/*
+ * reader_self - 이 쓰레드의 epoch 기록, 처음 조회할 때 만들어서 등록
+ *   쓰레드가 끝나도 기록은 남지만 epoch 가 0 이므로 reclaim 을 막지 않음
+ */
+static cache_reader_t *reader_self(void) {
+  cache_reader_t *r = NULL;
+
+  if (reader) {
+    return reader;
+  }
+  if (posix_memalign((void **)&r, 64, sizeof(cache_reader_t)) != 0) {
+    unix_error("posix_memalign error");
+  }
+  memset(r, 0, sizeof(cache_reader_t));
+  pthread_mutex_lock(&cache.rlock);
+  r->next = cache.readers;
+  cache.readers = r;
+  pthread_mutex_unlock(&cache.rlock);
+  return reader = r;
+}
+
+/*
+ * count - 이 쓰레드만 쓰는 카운터 올리기 (다른 쓰레드는 읽기만 하므로 RMW 가 필요 없음)
+ */
+static void count(atomic_ulong *c) {
+  atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + 1,
+                        memory_order_relaxed);
+}
+
+/*
+ * cache_get - 키에 해당하는 객체를 찾아 참조 카운트를 올려서 반환
+ *   다 쓰고 나면 반드시 cache_release 호출. 없으면 NULL
+ */
+cache_obj_t *cache_get(char *key) {
+  unsigned int h = hash_key(key);
+  cache_shard_t *sp = shard_of(h);
+  cache_reader_t *r = reader_self();
+  cache_obj_t *obj;
+  int f;
+
+  // epoch 를 적어 둔 뒤로 본 객체는 테이블에서 빠져도 놓이지 않음 (reclaim 의
+  // fence 와 짝). 테이블이 잡고 있는 참조가 남아 있으므로 참조 카운트를 그냥 올림
+  atomic_store_explicit(&r->epoch, atomic_load_explicit(&cache.epoch, memory_order_acquire),
+                        memory_order_relaxed);
+  atomic_thread_fence(memory_order_seq_cst);
+  for (obj = atomic_load_explicit(bucket_of(sp, h), memory_order_acquire); obj;
+       obj = atomic_load_explicit(&obj->hnext, memory_order_acquire)) {
+    if (obj->hash == h && !strcmp(obj->key, key)) {
+      atomic_fetch_add(&obj->refcnt, 1);
+      break;
+    }
+  }
+  atomic_store_explicit(&r->epoch, 0, memory_order_release);
+
+  if (!obj) {
+    count(&r->misses);
+    return NULL;
+  }
+
+  // 참조 비트만 올림. 이미 상한이면 캐시 라인에 쓰지도 않음
+  f = atomic_load_explicit(&obj->freq, memory_order_relaxed);
+  while (f < CACHE_MAXFREQ &&
+         !atomic_compare_exchange_weak_explicit(&obj->freq, &f, f + 1,
+                                                memory_order_relaxed, memory_order_relaxed))
+    ;
+  count(&r->hits);
+  return obj;
+}
+
+/*
+ * q_push - FIFO 의 head 에 객체 넣기
+ */
+static void q_push(cache_queue_t *q, cache_obj_t *obj) {
+  obj->qprev = NULL;
+  obj->qnext = q->head;
+  if (q->head) {
+    q->head->qprev = obj;
+  } else {
+    q->tail = obj;
+  }
+  q->head = obj;
+  q->bytes += obj->size;
+}
+
+/*
+ * q_remove - FIFO 에서 객체 빼기
+ */
+static void q_remove(cache_queue_t *q, cache_obj_t *obj) {
+  if (obj->qprev) {
+    obj->qprev->qnext = obj->qnext;
+  } else {
+    q->head = obj->qnext;
+  }
+  if (obj->qnext) {
+    obj->qnext->qprev = obj->qprev;
+  } else {
+    q->tail = obj->qprev;
+  }
+  q->bytes -= obj->size;
+}
+
+/*
+ * ghost_home - 해시 값이 ghost 해시 셋에서 처음 보는 칸 (곱셈 해시로 위쪽 비트를 씀)
+ */
+static int ghost_home(unsigned int h) {
+  return (h * 2654435761u) >> (32 - CACHE_GHOSTBITS);
+}
+
+/*
+ * ghost_slot - ghost 해시 셋에서 해시 값의 칸 찾기 (0 은 빈 칸 표시라서 1 로 바꿔 씀)
+ * @return 칸 번호, 없으면 -1
+ */
+static int ghost_slot(unsigned int h) {
+  int i;
+
+  for (i = ghost_home(h); cache.ghostset[i].hash; i = (i + 1) & (GHOST_SLOTS - 1)) {
+    if (cache.ghostset[i].hash == h) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/*
+ * ghost_delete - ghost 해시 셋의 칸 비우기
+ *   linear probing 이므로 뒤에 이어진 항목 중 빈 칸을 건너서 찾아야 하는 것을 당겨 옴
+ */
+static void ghost_delete(int i) {
+  int j = i, mask = GHOST_SLOTS - 1;
+
+  cache.ghostset[i].hash = 0;
+  while (cache.ghostset[j = (j + 1) & mask].hash) {
+    // j 의 항목이 처음 보는 칸에서 i 가 j 보다 멀지 않으면 i 로 옮김
+    if (((j - ghost_home(cache.ghostset[j].hash)) & mask) >= ((j - i) & mask)) {
+      cache.ghostset[i] = cache.ghostset[j];
+      cache.ghostset[j].hash = 0;
+      i = j;
+    }
+  }
+}
+
+/*
+ * ghost_find - S 에서 쫓겨난 적 있는 키인지 확인하고, 있으면 목록에서 지움
+ */
+static int ghost_find(unsigned int h) {
+  int i;
+
+  if ((i = ghost_slot(h ? h : 1)) < 0) {
+    return 0;
+  }
+  ghost_delete(i);
+  return 1;
+}
+
+/*
+ * ghost_add - 쫓겨난 키를 ghost 목록에 기록 (가장 오래된 기록을 덮어씀)
+ *   셋에는 많아야 CACHE_GHOSTS 개만 들어 있으므로 빈 칸이 항상 있음
+ */
+static void ghost_add(unsigned int h) {
+  int i, pos = cache.ghost_next;
+
+  h = h ? h : 1;
+  // 덮어쓸 기록이 아직 셋에 있으면 지움 (그 뒤에 같은 해시가 다시 기록됐으면 둠)
+  if (cache.ghosts[pos] && (i = ghost_slot(cache.ghosts[pos])) >= 0 &&
+      cache.ghostset[i].pos == pos) {
+    ghost_delete(i);
+  }
+  cache.ghosts[pos] = h;
+  if ((i = ghost_slot(h)) < 0) {
+    for (i = ghost_home(h); cache.ghostset[i].hash; i = (i + 1) & (GHOST_SLOTS - 1))
+      ;
+    cache.ghostset[i].hash = h;
+  }
+  cache.ghostset[i].pos = pos;
+  cache.ghost_next = (pos + 1) % CACHE_GHOSTS;
+}
+
+/*
+ * drop - 객체를 FIFO 와 해시 테이블에서 빼고 retired 목록에 넣음
+ *   obj->hnext 는 그대로 두므로 지금 obj 를 보고 있는 조회도 체인을 계속 따라감
+ *   테이블의 참조는 reclaim 에서 놓음
+ */
+static void drop(cache_queue_t *q, cache_obj_t *obj) {
+  cache_shard_t *sp = shard_of(obj->hash);
+  _Atomic(cache_obj_t *) *pp;
+
+  q_remove(q, obj);
+  for (pp = bucket_of(sp, obj->hash); atomic_load(pp) != obj; pp = &atomic_load(pp)->hnext)
+    ;
+  atomic_store_explicit(pp, atomic_load(&obj->hnext), memory_order_release);
+
+  // 이 epoch 이하로 조회를 시작한 쓰레드는 obj 를 봤을 수 있음
+  obj->stamp = atomic_fetch_add(&cache.epoch, 1);
+  obj->rnext = NULL;
+  if (cache.retired_tail) {
+    cache.retired_tail->rnext = obj;
+  } else {
+    cache.retired = obj;
+  }
+  cache.retired_tail = obj;
+
+  atomic_fetch_sub(&cache.used, obj->size);
+  atomic_fetch_add(&cache.evictions, 1);
+}
+
+/*
+ * reclaim - retired 목록에서 빠질 때보다 나중에 시작한 조회만 남은 객체의 테이블 참조를 놓음
+ *   (qlock 을 잡고 호출) 목록은 stamp 순서이므로 앞에서부터 봄
+ */
+static void reclaim(void) {
+  unsigned long e, oldest = ULONG_MAX;
+  cache_reader_t *r;
+  cache_obj_t *obj;
+
+  if (!cache.retired) {
+    return;
+  }
+  // 테이블에서 뺀 것이 보이기 전에 조회를 시작한 쓰레드의 epoch 는 여기서 보임
+  atomic_thread_fence(memory_order_seq_cst);
+  pthread_mutex_lock(&cache.rlock);
+  for (r = cache.readers; r; r = r->next) {
+    if ((e = atomic_load_explicit(&r->epoch, memory_order_acquire)) != 0 && e < oldest) {
+      oldest = e;
+    }
+  }
+  pthread_mutex_unlock(&cache.rlock);
+
+  while ((obj = cache.retired) != NULL && obj->stamp < oldest) {
+    cache.retired = obj->rnext;
+    cache_release(obj);
+  }
+  if (!cache.retired) {
+    cache.retired_tail = NULL;
+  }
+}
+
+/*
+ * evict_main - M 의 tail 부터 CLOCK 처럼 훑으면서 freq 가 0 인 객체를 쫓아냄
+ *   freq 가 남아 있으면 하나 깎고 head 로 되돌림
+ */
+static void evict_main(void) {
+  cache_obj_t *t;
+  int f;
+
+  while ((t = cache.main.tail) != NULL) {
+    f = atomic_load(&t->freq);
+    if (f > 0) {
+      atomic_store(&t->freq, f - 1);
+      q_remove(&cache.main, t);
+      q_push(&cache.main, t);
+    } else {
+      drop(&cache.main, t);
+      return;
+    }
+  }
+}
+
+/*
+ * evict_small - S 의 tail 을 처리. 두 번 이상 참조됐으면 M 으로 올리고,
+ *   아니면 ghost 에 기록하고 쫓아냄
+ */
+static void evict_small(void) {
+  cache_obj_t *t;
+
+  while ((t = cache.small.tail) != NULL) {
+    if (atomic_load(&t->freq) > 1) {
+      q_remove(&cache.small, t);
+      atomic_store(&t->freq, 0);
+      t->queue = CACHE_QMAIN;
+      q_push(&cache.main, t);
+      atomic_fetch_add(&cache.promotions, 1);
+    } else {
+      ghost_add(t->hash);
+      drop(&cache.small, t);
+      return;
+    }
+  }
+}
+
+/*
+ * evict - 객체 하나를 쫓아냄. S 가 전체 예산의 10% 를 넘거나 M 이 비었으면
+ *   S 에서, 아니면 M 에서 고름
+ * @return 쫓아낼 객체가 없으면 0
+ */
+static int evict(void) {
+  if (!cache.small.tail && !cache.main.tail) {
+    return 0;
+  }
+  if (cache.small.tail && (cache.small.bytes >= cache.max_cache / 10 || !cache.main.tail)) {
+    evict_small();
+  } else {
+    evict_main();
+  }
+  return 1;
+}
+
+/*
+ * cache_put - 객체를 복사해서 캐시에 저장
+ * @return 저장했으면 0, 너무 크거나 이미 있으면 -1
+ */
+int cache_put(char *key, char *data, size_t size) {
+  unsigned int h = hash_key(key);
+  cache_shard_t *sp = shard_of(h);
+  _Atomic(cache_obj_t *) *bp = bucket_of(sp, h);
+  cache_obj_t *obj, *p;
+
+  if (size > cache.max_object || size > cache.max_cache) {
+    return -1;
+  }
+
+  obj = Malloc(sizeof(cache_obj_t));
+  obj->key = Malloc(strlen(key) + 1);
+  strcpy(obj->key, key);
+  obj->hash = h;
+  obj->data = Malloc(size);
+  memcpy(obj->data, data, size);
+  obj->size = size;
+  atomic_init(&obj->refcnt, 1);
+  atomic_init(&obj->freq, 0);
+
+  pthread_mutex_lock(&cache.qlock);
+  // 다른 쓰레드가 먼저 같은 객체를 넣었으면 우리 것은 버림
+  for (p = atomic_load(bp); p; p = atomic_load(&p->hnext)) {
+    if (p->hash == h && !strcmp(p->key, key)) {
+      break;
+    }
+  }
+  if (p) {
+    pthread_mutex_unlock(&cache.qlock);
+    obj_free(obj);
+    return -1;
+  }
+
+  // 자리가 날 때까지 쫓아냄
+  while (atomic_load(&cache.used) + size > cache.max_cache) {
+    evict();
+  }
+
+  // 다 채운 객체를 체인 맨 앞에 걸어서 조회에 보이게 함
+  atomic_init(&obj->hnext, atomic_load(bp));
+  atomic_store_explicit(bp, obj, memory_order_release);
+
+  // 최근에 S 에서 쫓겨났던 키면 바로 M 으로
+  if (ghost_find(h)) {
+    obj->queue = CACHE_QMAIN;
+    q_push(&cache.main, obj);
+  } else {
+    obj->queue = CACHE_QSMALL;
+    q_push(&cache.small, obj);
+  }
+  atomic_fetch_add(&cache.used, size);
+  reclaim();
+  pthread_mutex_unlock(&cache.qlock);
+
+  atomic_fetch_add(&cache.inserts, 1);
+  return 0;
+}
+
+/*
+ * cache_stats - hit/miss 카운터와 사용량 스냅샷
+ */
+void cache_stats(cache_stats_t *st) {
+  cache_reader_t *r;
+
+  st->hits = st->misses = 0;
+  pthread_mutex_lock(&cache.rlock);
+  for (r = cache.readers; r; r = r->next) {
+    st->hits += atomic_load_explicit(&r->hits, memory_order_relaxed);
+    st->misses += atomic_load_explicit(&r->misses, memory_order_relaxed);
+  }
+  pthread_mutex_unlock(&cache.rlock);
+  st->inserts = atomic_load(&cache.inserts);
+  st->evictions = atomic_load(&cache.evictions);
+  st->promotions = atomic_load(&cache.promotions);
+  st->coalesced = atomic_load(&cache.coalesced);
+  st->bytes = atomic_load(&cache.used);
+  st->max_bytes = cache.max_cache;
+}
+
+/*
+ * flight_unlink - 샤드의 flight 목록에서 빼기 (flock 을 잡고 호출)
+ */
+static void flight_unlink(cache_shard_t *sp, flight_t *fl) {
+  flight_t **pp;
+
+  if (!fl->linked) {
+    return;
+  }
+  for (pp = &sp->flights; *pp != fl; pp = &(*pp)->next)
+    ;
+  *pp = fl->next;
+  fl->linked = 0;
+}
+
+/*
+ * flight_get - flight_join / flight_lead 의 공통 부분
+ *   follow 가 0 이면 이미 있는 flight 에 붙지 않고 NULL 반환
+ */
+static flight_t *flight_get(char *key, int follow, int *leader) {
+  unsigned int h = hash_key(key);
+  cache_shard_t *sp = shard_of(h);
+  flight_t *fl;
+
+  pthread_mutex_lock(&sp->flock);
+  for (fl = sp->flights; fl; fl = fl->next) {
+    if (fl->hash == h && !strcmp(fl->key, key)) {
+      if (!follow) {
+        pthread_mutex_unlock(&sp->flock);
+        return NULL;
+      }
+      atomic_fetch_add(&fl->refcnt, 1);
+      pthread_mutex_unlock(&sp->flock);
+      atomic_fetch_add(&cache.coalesced, 1);
+      *leader = 0;
+      return fl;
+    }
+  }
+
+  fl = Calloc(1, sizeof(flight_t));
+  fl->key = Malloc(strlen(key) + 1);
+  strcpy(fl->key, key);
+  fl->hash = h;
+  pthread_mutex_init(&fl->lock, NULL);
+  pthread_cond_init(&fl->cond, NULL);
+  fl->state = FLIGHT_FILLING;
+  fl->cacheable = 1;
+  fl->linked = 1;
+  atomic_init(&fl->refcnt, 1);
+  fl->next = sp->flights;
+  sp->flights = fl;
+  pthread_mutex_unlock(&sp->flock);
+
+  *leader = 1;
+  return fl;
+}
+
+/*
+ * flight_join - 키에 대한 flight 에 붙거나, 없으면 새로 만들어 leader 가 됨
+ *   *leader 가 1 이면 호출한 쪽이 원격 서버에서 가져와야 함
+ *   다 쓰고 나면 반드시 flight_release 호출
+ */
+flight_t *flight_join(char *key, int *leader) {
+  return flight_get(key, 1, leader);
+}
+
+/*
+ * flight_lead - follower 로 기다릴 수 없는 쪽(epoll 엔진)용
+ *   flight 가 없을 때만 새로 만들어 leader 로 반환하고, 이미 있으면 NULL
+ */
+flight_t *flight_lead(char *key) {
+  int leader;
+
+  return flight_get(key, 0, &leader);
+}
+
+/*
+ * drop_head - flight 의 맨 앞 청크 버리기 (fl->lock 을 잡고 호출)
+ */
+static void drop_head(flight_t *fl) {
+  cache_chunk_t *c = fl->head;
+
+  fl->head = c->next;
+  if (!fl->head) {
+    fl->tail = NULL;
+  }
+  fl->base += c->len;
+  Free(c);
+}
+
+/*
+ * give_up - 캐시를 포기하고 새 follower 를 받지 않음 (fl->lock 을 잡고 호출)
+ */
+static void give_up(flight_t *fl) {
+  cache_shard_t *sp = shard_of(fl->hash);
+
+  fl->cacheable = 0;
+  if (fl->linked) {
+    pthread_mutex_lock(&sp->flock);
+    flight_unlink(sp, fl);
+    pthread_mutex_unlock(&sp->flock);
+  }
+}
+
+/*
+ * flight_oversize - 응답 헤더의 Content-length 만 보고도 max_object 를
+ *   넘는 게 확실할 때 호출. 바디가 오기 전에 미리 캐시를 포기함
+ */
+void flight_oversize(flight_t *fl) {
+  pthread_mutex_lock(&fl->lock);
+  give_up(fl);
+  pthread_mutex_unlock(&fl->lock);
+}
+
+/*
+ * flight_wants_data - flight 에 바이트를 계속 붙여야 하는지 (leader 만 호출)
+ *   캐시할 수도 없고 기다리는 follower 도 없으면 0
+ */
+int flight_wants_data(flight_t *fl) {
+  return fl->linked || atomic_load(&fl->refcnt) > 1;
+}
+
+/*
+ * flight_append - leader 가 받은 바이트를 flight 에 붙이고 follower 를 깨움
+ */
+void flight_append(flight_t *fl, char *data, size_t n) {
+  size_t m;
+
+  pthread_mutex_lock(&fl->lock);
+  // 객체가 너무 커지면 새 follower 를 받지 않음
+  if (fl->linked && fl->size + n > cache.max_object) {
+    give_up(fl);
+  }
+  // 캐시도 못 하고 기다리는 follower 도 없으면 복사할 필요가 없음.
+  // 이미 모아 둔 청크도 바로 놓아서 큰 응답을 중계하는 동안 메모리를 잡지 않음
+  if (!fl->linked && atomic_load(&fl->refcnt) == 1) {
+    while (fl->head) {
+      drop_head(fl);
+    }
+    fl->size += n;
+    fl->base = fl->size;
+    pthread_mutex_unlock(&fl->lock);
+    return;
+  }
+  while (n > 0) {
+    if (!fl->tail || fl->tail->len == CACHE_CHUNK) {
+      cache_chunk_t *c = Malloc(sizeof(cache_chunk_t));
+      c->next = NULL;
+      c->len = 0;
+      if (fl->tail) {
+        fl->tail->next = c;
+      } else {
+        fl->head = c;
+      }
+      fl->tail = c;
+    }
+    m = CACHE_CHUNK - fl->tail->len;
+    if (m > n) {
+      m = n;
+    }
+    memcpy(fl->tail->data + fl->tail->len, data, m);
+    fl->tail->len += m;
+    fl->size += m;
+    data += m;
+    n -= m;
+  }
+  // 목록에서 빠진 flight 는 최근 CACHE_WINDOW 바이트만 들고 있음
+  while (!fl->linked && fl->head != fl->tail && fl->size - fl->base > CACHE_WINDOW) {
+    drop_head(fl);
+  }
+  pthread_cond_broadcast(&fl->cond);
+  pthread_mutex_unlock(&fl->lock);
+}
+
+/*
+ * flight_nocache - 끝나도 캐시에 넣지 않도록 표시 (follower 에게는 계속 전달)
+ */
+void flight_nocache(flight_t *fl) {
+  pthread_mutex_lock(&fl->lock);
+  fl->cacheable = 0;
+  pthread_mutex_unlock(&fl->lock);
+}
+
+/*
+ * flight_finish - leader 가 응답을 다 받았거나(ok=1) 실패했을 때 호출
+ *   성공했고 캐시할 수 있으면 캐시에 넣은 뒤에 목록에서 뺌
+ */
+void flight_finish(flight_t *fl, int ok) {
+  cache_shard_t *sp = shard_of(fl->hash);
+  cache_chunk_t *c;
+  char *data, *p;
+
+  if (ok && fl->cacheable && fl->base == 0 && fl->size > 0) {
+    p = data = Malloc(fl->size);
+    for (c = fl->head; c; c = c->next) {
+      memcpy(p, c->data, c->len);
+      p += c->len;
+    }
+    cache_put(fl->key, data, fl->size);
+    Free(data);
+  }
+
+  pthread_mutex_lock(&sp->flock);
+  flight_unlink(sp, fl);
+  pthread_mutex_unlock(&sp->flock);
+
+  pthread_mutex_lock(&fl->lock);
+  fl->state = ok ? FLIGHT_DONE : FLIGHT_FAILED;
+  pthread_cond_broadcast(&fl->cond);
+  pthread_mutex_unlock(&fl->lock);
+}
+
+/*
+ * flight_read - follower 가 off 위치부터 최대 n 바이트를 읽음
+ *   바이트가 아직 없으면 leader 가 더 받을 때까지 기다림
+ * @return 읽은 바이트 수, 응답 끝이면 0,
+ *         leader 가 실패했거나 window 밖으로 밀려났으면 -1
+ */
+ssize_t flight_read(flight_t *fl, size_t off, char *buf, size_t n) {
+  cache_chunk_t *c;
+  size_t pos;
+
+  pthread_mutex_lock(&fl->lock);
+  while (off >= fl->size && fl->state == FLIGHT_FILLING) {
+    pthread_cond_wait(&fl->cond, &fl->lock);
+  }
+  if (off < fl->base || (off >= fl->size && fl->state == FLIGHT_FAILED)) {
+    pthread_mutex_unlock(&fl->lock);
+    return -1;
+  }
+  if (off >= fl->size) {
+    pthread_mutex_unlock(&fl->lock);
+    return 0;
+  }
+  for (c = fl->head, pos = fl->base; pos + c->len <= off; c = c->next) {
+    pos += c->len;
+  }
+  if (n > pos + c->len - off) {
+    n = pos + c->len - off;
+  }
+  memcpy(buf, c->data + (off - pos), n);
+  pthread_mutex_unlock(&fl->lock);
+  return n;
+}
+
+/*
+ * flight_release - flight 사용 종료, 마지막 참조면 메모리 해제
+ */
+void flight_release(flight_t *fl) {
+  if (atomic_fetch_sub(&fl->refcnt, 1) != 1) {
+    return;
+  }
+  while (fl->head) {
+    drop_head(fl);
+  }
+  pthread_mutex_destroy(&fl->lock);
+  pthread_cond_destroy(&fl->cond);
+  Free(fl->key);
+  Free(fl);
+}
@@ -0,0 +1,120 @@
+/*
+ * cache.h - 프록시용 샤딩된 인메모리 웹 객체 캐시
+ *
+ * 캐시 키는 parse_uri() 가 돌려준 hostname/port/pathname 으로 만든다.
+ * 조회용 해시 테이블은 CACHE_NSHARDS 개의 샤드로 나뉜다. 조회는 lock 을
+ * 잡지 않고, 쓰레드마다 따로 있는 epoch 기록 하나만 건드린다. 테이블에서
+ * 빠진 객체는 그 전에 읽기 시작한 조회가 모두 끝난 뒤에 놓아 준다. 그래서
+ * 워커 쓰레드들의 hit 는 공유하는 lock 이나 카운터의 캐시 라인을 두고 다투지
+ * 않는다. 저장된 객체 바이트의 합은 항상 max_cache 이하로 유지된다.
+ *
+ * 교체 정책은 S3-FIFO 이다. 새 객체는 작은 FIFO(S) 에 들어가고, 그
+ * 안에서 다시 참조된 객체만 메인 FIFO(M) 로 올라간다. 한 번 훑고 지나가는
+ * 크롤링 트래픽은 S 에서 바로 빠져나가므로 M 의 hot set 을 밀어내지 못한다.
+ * hit 는 객체의 freq 만 atomic 으로 올리고 배타적 lock 을 잡지 않는다.
+ *
+ * 같은 키에 대한 동시 miss 는 flight 하나로 합쳐진다. 처음 온 쓰레드(leader)
+ * 만 원격 서버에서 가져오고, 나머지(follower)는 leader 가 받은 바이트를
+ * 도착하는 대로 flight 에서 읽어 자기 클라이언트에게 보낸다. leader 는
+ * 자기 클라이언트에게 먼저 쓰고 나서 flight 에 붙이며, 객체가 max_object 를
+ * 넘는 순간(또는 Content-length 로 넘을 게 확실해진 순간)부터는 기다리는
+ * follower 가 없으면 더 이상 복사하지 않는다.
+ *
+ * 캐시하지 못하게 된 flight 는 최근 CACHE_WINDOW 바이트만 들고 있고, leader 는
+ * 느린 follower 를 기다리지 않는다. 창 밖으로 밀려난 follower 는 클라이언트에게
+ * 아직 아무것도 보내지 않았으면 원격 서버에서 직접 가져오고, 바디 중간이면
+ * 클라이언트 연결을 끊는다.
+ */
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#include <stdatomic.h>
+#include "csapp.h"
+#include "httpparse.h"
+
+#define CACHE_NSHARDS  16   /* 샤드 개수 */
+#define CACHE_NBUCKETS 64   /* 샤드 당 해시 버킷 개수 */
+#define CACHE_GHOSTS   1024 /* S 에서 쫓겨난 키를 기억하는 ghost 개수 */
+#define CACHE_GHOSTBITS 11  /* ghost 해시 셋 칸 수 (2^n, CACHE_GHOSTS 의 두 배) */
+#define CACHE_MAXFREQ  3    /* freq 상한 */
+#define CACHE_CHUNK    16384   /* flight 버퍼 청크 크기 */
+#define CACHE_WINDOW   1048576 /* 캐시 못 하는 flight 가 붙잡아 둘 최대 바이트 */
+
+/* 객체가 속한 FIFO */
+#define CACHE_QSMALL 0
+#define CACHE_QMAIN  1
+
+/* 캐시에 저장된 웹 객체 하나 (응답 헤더 + 바디) */
+typedef struct cache_obj {
+  char *key;                    /* "hostname:port/pathname" */
+  unsigned int hash;            /* key 의 해시 값 */
+  char *data;                   /* 응답 바이트 */
+  size_t size;                  /* data 의 길이 */
+  atomic_int refcnt;            /* 테이블 1 + 사용 중인 쓰레드 수 */
+  atomic_int freq;              /* 참조 비트 (0 ~ CACHE_MAXFREQ) */
+  int queue;                    /* CACHE_QSMALL 또는 CACHE_QMAIN */
+  _Atomic(struct cache_obj *) hnext;  /* 같은 버킷의 다음 객체 (조회는 lock 없이 읽음) */
+  struct cache_obj *qprev;      /* FIFO 에서 앞 (더 최근) 객체 */
+  struct cache_obj *qnext;      /* FIFO 에서 뒤 (더 오래된) 객체 */
+  unsigned long stamp;          /* 테이블에서 뺄 때의 epoch */
+  struct cache_obj *rnext;      /* 놓아 주기를 기다리는 목록의 다음 객체 */
+} cache_obj_t;
+
+/* flight 버퍼 청크 */
+typedef struct cache_chunk {
+  struct cache_chunk *next;
+  size_t len;
+  char data[CACHE_CHUNK];
+} cache_chunk_t;
+
+/* flight 상태 */
+#define FLIGHT_FILLING 0    /* leader 가 받는 중 */
+#define FLIGHT_DONE    1    /* 응답 끝까지 받음 */
+#define FLIGHT_FAILED  2    /* leader 가 중간에 실패 */
+
+/* 원격 서버에서 받아오는 중인 객체 하나 */
+typedef struct flight {
+  char *key;
+  unsigned int hash;
+  pthread_mutex_t lock;         /* 아래 필드들 보호 */
+  pthread_cond_t cond;          /* 새 바이트 도착 또는 상태 변화 */
+  cache_chunk_t *head, *tail;   /* 받은 바이트 */
+  size_t base;                  /* head 청크의 시작 오프셋 */
+  size_t size;                  /* 지금까지 받은 바이트 수 */
+  int state;                    /* FLIGHT_* */
+  int cacheable;                /* 끝나면 캐시에 넣을지 여부 */
+  int linked;                   /* 샤드의 flight 목록에 걸려 있는지 */
+  atomic_int refcnt;            /* leader 1 + follower 수 */
+  struct flight *next;          /* 같은 샤드의 다음 flight */
+} flight_t;
+
+/* 캐시 통계 */
+typedef struct {
+  unsigned long hits;           /* cache_get 성공 횟수 */
+  unsigned long misses;         /* cache_get 실패 횟수 */
+  unsigned long inserts;        /* 새로 저장된 객체 수 */
+  unsigned long evictions;      /* 쫓겨난 객체 수 */
+  unsigned long promotions;     /* S 에서 M 으로 올라간 객체 수 */
+  unsigned long coalesced;      /* flight 에 follower 로 붙은 요청 수 */
+  size_t bytes;                 /* 현재 저장된 바이트 수 */
+  size_t max_bytes;             /* 전체 바이트 예산 */
+} cache_stats_t;
+
+void cache_init(size_t max_cache, size_t max_object);
+void cache_makekey(char *key, view_t hostname, view_t port, view_t pathname);
+cache_obj_t *cache_get(char *key);
+void cache_release(cache_obj_t *obj);
+int cache_put(char *key, char *data, size_t size);
+void cache_stats(cache_stats_t *st);
+
+flight_t *flight_join(char *key, int *leader);
+flight_t *flight_lead(char *key);
+void flight_append(flight_t *fl, char *data, size_t n);
+int flight_wants_data(flight_t *fl);
+void flight_nocache(flight_t *fl);
+void flight_oversize(flight_t *fl);
+void flight_finish(flight_t *fl, int ok);
+ssize_t flight_read(flight_t *fl, size_t off, char *buf, size_t n);
+void flight_release(flight_t *fl);
+
+#endif /* __CACHE_H__ */
@@ -0,0 +1,314 @@
+/*
+ * deadline.c - 원격 서버 소켓 마감 시간 (계층형 timer wheel)
+ *
+ * - 타이머 목록은 이중 연결 리스트라서 걸기와 떼기가 O(1) 이다.
+ * - wheel 전체를 mutex 하나로 보호한다. lock 은 단계가 바뀔 때와 ticker 가
+ *   tick 을 처리할 때만 잡고, 바디를 옮기는 동안의 dl_touch 는 lock 없이
+ *   atomic 저장 한 번이다.
+ * - ticker 쓰레드는 DL_TICK_MS 마다 깨어나서 단조 시계로 밀린 tick 을 모두
+ *   처리하므로, 늦게 깨어나도 마감이 늦어질 뿐 사라지지 않는다.
+ */
+#include <limits.h>
+#include "csapp.h"
+#include "deadline.h"
+
+#define DL_ROOT_MASK (DL_ROOT_SIZE - 1)
+#define DL_LVL_MASK  (DL_LVL_SIZE - 1)
+#define DL_MAXTICKS  ((1UL << (DL_ROOT_BITS + DL_NLEVELS * DL_LVL_BITS)) - 1)
+#define DL_HELD      ULONG_MAX  /* touched 값: dl_hold 로 idle 마감을 멈춤 */
+
+static struct {
+  pthread_mutex_t lock;
+  atomic_ulong now;                           /* 다음에 처리할 tick */
+  struct timespec start;                      /* tick 0 의 시각 */
+  dl_timer_t *root[DL_ROOT_SIZE];
+  dl_timer_t *lvl[DL_NLEVELS][DL_LVL_SIZE];
+} wheel = { PTHREAD_MUTEX_INITIALIZER };
+
+/*
+ * ticks - ms 를 tick 수로 (올림, 최소 1)
+ */
+static unsigned long ticks(int ms) {
+  return ms <= 0 ? 1 : (ms + DL_TICK_MS - 1) / DL_TICK_MS;
+}
+
+/*
+ * elapsed - 시작 후 지난 tick 수
+ */
+static unsigned long elapsed(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((ts.tv_sec - wheel.start.tv_sec) * 1000 +
+          (ts.tv_nsec - wheel.start.tv_nsec) / 1000000) / DL_TICK_MS;
+}
+
+/*
+ * unlink_timer - wheel 에서 떼기 (lock 잡고 호출)
+ */
+static void unlink_timer(dl_timer_t *t) {
+  if (t->next) {
+    t->next->pprev = t->pprev;
+  }
+  *t->pprev = t->next;
+  t->next = NULL;
+  t->pprev = NULL;
+}
+
+/*
+ * add - t->expires 에 맞는 칸에 걸기 (lock 잡고 호출)
+ *   root 에 들어갈 만큼 가까우면 root, 아니면 남은 시간에 맞는 단계의 칸
+ */
+static void add(dl_timer_t *t) {
+  unsigned long now = atomic_load(&wheel.now), delta;
+  dl_timer_t **slot;
+  int i;
+
+  // 이미 지났으면 다음 tick 에 처리, wheel 이 담을 수 있는 것보다 멀면 끝 칸에
+  if (t->expires < now) {
+    t->expires = now;
+  }
+  delta = t->expires - now;
+  if (delta > DL_MAXTICKS) {
+    t->expires = now + DL_MAXTICKS;
+    delta = DL_MAXTICKS;
+  }
+  if (delta < DL_ROOT_SIZE) {
+    slot = &wheel.root[t->expires & DL_ROOT_MASK];
+  } else {
+    for (i = 0; i < DL_NLEVELS - 1; i++) {
+      if (delta < 1UL << (DL_ROOT_BITS + (i + 1) * DL_LVL_BITS)) {
+        break;
+      }
+    }
+    slot = &wheel.lvl[i][(t->expires >> (DL_ROOT_BITS + i * DL_LVL_BITS)) & DL_LVL_MASK];
+  }
+  t->next = *slot;
+  if (t->next) {
+    t->next->pprev = &t->next;
+  }
+  t->pprev = slot;
+  *slot = t;
+}
+
+/*
+ * cascade - 위 단계 칸 하나의 타이머를 모두 남은 시간에 맞는 칸으로 다시 걸기
+ */
+static void cascade(dl_timer_t **slot) {
+  dl_timer_t *t, *list = *slot;
+
+  *slot = NULL;
+  while ((t = list) != NULL) {
+    list = t->next;
+    add(t);
+  }
+}
+
+/*
+ * expire - 마감이 돌아온 타이머 처리 (lock 잡고 호출)
+ *   idle 마감이고 그 사이 진행이 있었으면 마지막 진행 시각 기준으로, 멈춰
+ *   있으면 (dl_hold) 지금부터 다시 걸고, 아니면 fd 를 shutdown 해서 막혀 있는
+ *   쪽을 깨움
+ */
+static void expire(dl_timer_t *t) {
+  unsigned long next, touched;
+
+  if (t->idle) {
+    touched = atomic_load_explicit(&t->touched, memory_order_relaxed);
+    next = (touched == DL_HELD ? atomic_load(&wheel.now) : touched) + t->idle;
+    if (next > t->end) {
+      next = t->end;
+    }
+    if (next > atomic_load(&wheel.now)) {
+      t->expires = next;
+      add(t);
+      return;
+    }
+  }
+  t->fired = 1;
+  if (t->fd >= 0) {
+    shutdown(t->fd, SHUT_RDWR);
+  }
+}
+
+/*
+ * run_tick - 현재 tick 의 타이머를 처리하고 tick 을 하나 넘김 (lock 잡고 호출)
+ */
+static void run_tick(void) {
+  unsigned long now = atomic_load(&wheel.now);
+  dl_timer_t *t, *list;
+  int i, idx;
+
+  // root 가 한 바퀴 돌았으면 위 단계에서 다음 구간의 타이머를 내려보냄
+  if ((now & DL_ROOT_MASK) == 0) {
+    for (i = 0; i < DL_NLEVELS; i++) {
+      idx = (now >> (DL_ROOT_BITS + i * DL_LVL_BITS)) & DL_LVL_MASK;
+      cascade(&wheel.lvl[i][idx]);
+      if (idx != 0) {
+        break;
+      }
+    }
+  }
+
+  list = wheel.root[now & DL_ROOT_MASK];
+  wheel.root[now & DL_ROOT_MASK] = NULL;
+  while ((t = list) != NULL) {
+    list = t->next;
+    t->next = NULL;
+    t->pprev = NULL;
+    expire(t);
+  }
+  atomic_store(&wheel.now, now + 1);
+}
+
+/*
+ * ticker - DL_TICK_MS 마다 밀린 tick 을 처리하는 쓰레드
+ */
+static void *ticker(void *vargp) {
+  struct timespec ts = { 0, DL_TICK_MS * 1000000L };
+  unsigned long target;
+
+  Pthread_detach(pthread_self());
+  while (1) {
+    nanosleep(&ts, NULL);
+    target = elapsed();
+    pthread_mutex_lock(&wheel.lock);
+    while (atomic_load(&wheel.now) < target) {
+      run_tick();
+    }
+    pthread_mutex_unlock(&wheel.lock);
+  }
+  return NULL;
+}
+
+/*
+ * dl_init - wheel 초기화, main 에서 한 번 호출
+ */
+void dl_init(void) {
+  pthread_t tid;
+
+  clock_gettime(CLOCK_MONOTONIC, &wheel.start);
+  Pthread_create(&tid, NULL, ticker, NULL);
+}
+
+/*
+ * dl_start - 요청 하나의 타이머 준비, 전체 마감을 지금부터 total_ms 뒤로
+ */
+void dl_start(dl_timer_t *t, int total_ms) {
+  unsigned long now = atomic_load(&wheel.now);
+
+  t->fd = -1;
+  t->fired = 0;
+  t->idle = 0;
+  t->expires = t->end = now + ticks(total_ms);
+  atomic_init(&t->touched, now);
+  t->next = NULL;
+  t->pprev = NULL;
+}
+
+/*
+ * expired - 이미 마감이 지난 타이머에 fd 를 붙이면 그 fd 도 바로 shutdown (lock 잡고 호출)
+ *   붙이기 전에 마감이 지났어도 그 fd 로 막히는 일이 없도록
+ */
+static void expired(dl_timer_t *t, int fd) {
+  t->fd = fd;
+  if (fd >= 0) {
+    shutdown(fd, SHUT_RDWR);
+  }
+}
+
+/*
+ * arm - 다음 단계 마감 걸기, idle 이 0 이 아니면 idle 마감
+ */
+static int arm(dl_timer_t *t, int fd, int ms, unsigned long idle) {
+  unsigned long now;
+
+  pthread_mutex_lock(&wheel.lock);
+  if (t->fired) {
+    expired(t, fd);
+    pthread_mutex_unlock(&wheel.lock);
+    return -1;
+  }
+  if (t->pprev) {
+    unlink_timer(t);
+  }
+  now = atomic_load(&wheel.now);
+  t->fd = fd;
+  t->idle = idle;
+  atomic_store_explicit(&t->touched, now, memory_order_relaxed);
+  t->expires = now + ticks(ms);
+  if (t->expires > t->end) {
+    t->expires = t->end;
+  }
+  add(t);
+  pthread_mutex_unlock(&wheel.lock);
+  return 0;
+}
+
+/*
+ * dl_arm - 지금부터 ms 안에 끝나야 하는 단계의 마감 (전체 마감을 넘지 않음)
+ *   fd 가 -1 이면 아직 소켓이 없는 단계, 소켓을 만들면 dl_bind 로 붙임
+ * @return 0, 이미 마감이 지났으면 (fd 는 바로 shutdown 하고) -1
+ */
+int dl_arm(dl_timer_t *t, int fd, int ms) {
+  return arm(t, fd, ms, 0);
+}
+
+/*
+ * dl_arm_idle - dl_touch 사이의 간격이 ms 를 넘으면 끝나는 마감
+ * @return 0, 이미 마감이 지났으면 (fd 는 바로 shutdown 하고) -1
+ */
+int dl_arm_idle(dl_timer_t *t, int fd, int ms) {
+  return arm(t, fd, ms, ticks(ms));
+}
+
+/*
+ * dl_bind - 걸려 있는 마감을 fd 에 붙이거나 (-1 이면) 뗌
+ * @return 0, 이미 마감이 지났으면 (fd 는 바로 shutdown 하고) -1
+ */
+int dl_bind(dl_timer_t *t, int fd) {
+  int rc = 0;
+
+  pthread_mutex_lock(&wheel.lock);
+  if (t->fired) {
+    expired(t, fd);
+    rc = -1;
+  } else {
+    t->fd = fd;
+  }
+  pthread_mutex_unlock(&wheel.lock);
+  return rc;
+}
+
+/*
+ * dl_touch - idle 마감에 진행이 있었음을 알림 (lock 없음)
+ */
+void dl_touch(dl_timer_t *t) {
+  atomic_store_explicit(&t->touched, atomic_load_explicit(&wheel.now, memory_order_relaxed),
+                        memory_order_relaxed);
+}
+
+/*
+ * dl_hold - 다음 dl_touch 까지 idle 마감을 멈춤 (lock 없음)
+ *   클라이언트에게 쓰는 동안은 원격 서버를 읽지 않으므로 원격 서버가 멈춘 것이 아님
+ */
+void dl_hold(dl_timer_t *t) {
+  atomic_store_explicit(&t->touched, DL_HELD, memory_order_relaxed);
+}
+
+/*
+ * dl_cancel - wheel 에서 떼고 fd 도 뗌. 이 뒤로는 fd 를 닫아도 됨
+ * @return 마감이 지나서 fd 를 shutdown 했었으면 1
+ */
+int dl_cancel(dl_timer_t *t) {
+  int fired;
+
+  pthread_mutex_lock(&wheel.lock);
+  if (t->pprev) {
+    unlink_timer(t);
+  }
+  t->fd = -1;
+  fired = t->fired;
+  pthread_mutex_unlock(&wheel.lock);
+  return fired;
+}
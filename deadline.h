@@ -0,0 +1,55 @@
+/*
+ * deadline.h - 원격 서버 소켓 마감 시간 (계층형 timer wheel)
+ *
+ * 원격 서버가 죽었거나 멈추면 connect, read 가 끝없이 막혀서 워커 쓰레드를
+ * 하나씩 잡아먹는다. 요청마다 dl_timer_t 하나를 두고 단계(connect, 첫 바이트,
+ * 바디 idle)마다 마감을 다시 걸면, ticker 쓰레드가 마감이 지난 소켓을
+ * shutdown() 해서 막혀 있던 connect/read 를 에러나 EOF 로 깨운다. 소켓마다
+ * SO_RCVTIMEO 를 거는 것과 달리 connect 도 끊을 수 있고, epoll 엔진에서는
+ * 같은 shutdown 이 EPOLLHUP 으로 나타난다.
+ *
+ * - wheel 은 DL_TICK_MS 단위로 돌고, 가까운 타이머는 DL_ROOT_SIZE 칸의
+ *   root 에, 먼 타이머는 위 단계 칸에 두었다가 root 가 한 바퀴 돌 때마다
+ *   한 칸씩 내려보낸다 (cascade). 걸기와 떼기는 O(1) 이다.
+ * - 모든 단계 마감은 dl_start 에서 정한 전체 마감을 넘지 않는다.
+ * - idle 마감은 dl_touch 가 시각만 기록하고, 마감이 돌아왔을 때 그 사이
+ *   진행이 있었으면 다시 건다. 바이트마다 lock 을 잡지 않는다.
+ * - 클라이언트에게 쓰느라 원격 서버를 읽지 않는 동안은 dl_hold 로 idle 마감을
+ *   멈추고 다음 dl_touch 부터 다시 센다. 느린 클라이언트 때문에 멀쩡한 원격
+ *   서버를 끊거나 breaker 에 실패로 세지 않도록. 전체 마감은 그대로 걸려 있다.
+ * - fd 를 닫기 전에 반드시 dl_cancel 이나 dl_bind(t, -1) 로 떼어야 한다.
+ *   그렇지 않으면 같은 번호로 다시 열린 남의 fd 를 shutdown 할 수 있다.
+ */
+#ifndef __DEADLINE_H__
+#define __DEADLINE_H__
+
+#include <stdatomic.h>
+
+#define DL_TICK_MS   10                         /* wheel 한 칸의 시간 */
+#define DL_ROOT_BITS 8
+#define DL_LVL_BITS  6
+#define DL_NLEVELS   2                          /* root 위의 단계 수 */
+#define DL_ROOT_SIZE (1 << DL_ROOT_BITS)
+#define DL_LVL_SIZE  (1 << DL_LVL_BITS)
+
+typedef struct dl_timer {
+  int fd;                     /* 마감이 지나면 shutdown 할 fd, 없으면 -1 */
+  int fired;                  /* 마감이 지나서 shutdown 했음 */
+  unsigned long expires;      /* 이 tick 에 마감 */
+  unsigned long end;          /* 전체 마감 tick */
+  unsigned long idle;         /* idle 마감 길이 (tick), 0 이면 idle 마감이 아님 */
+  atomic_ulong touched;       /* 마지막으로 진행이 있었던 tick */
+  struct dl_timer *next;
+  struct dl_timer **pprev;    /* wheel 에 걸려 있지 않으면 NULL */
+} dl_timer_t;
+
+void dl_init(void);
+void dl_start(dl_timer_t *t, int total_ms);
+int dl_arm(dl_timer_t *t, int fd, int ms);
+int dl_arm_idle(dl_timer_t *t, int fd, int ms);
+int dl_bind(dl_timer_t *t, int fd);
+void dl_touch(dl_timer_t *t);
+void dl_hold(dl_timer_t *t);
+int dl_cancel(dl_timer_t *t);
+
+#endif /* __DEADLINE_H__ */
@@ -0,0 +1,270 @@
+/*
+ * dnscache.c - 원격 서버 이름 해석 결과 캐시
+ *
+ * - 항목은 "host:port" 해시 테이블 하나에 있고, mutex 하나로 보호한다.
+ *   이름 해석(getaddrinfo)은 항상 lock 밖에서 한다.
+ * - 처음 보는 키는 DNS_RESOLVING 상태로 먼저 테이블에 넣고 해석한다. 같은
+ *   키로 들어온 다른 쓰레드는 cond 에서 기다렸다가 결과를 같이 쓴다.
+ * - refresh 쓰레드는 1 초마다 테이블을 훑어서, 최근 DNS_TTL 초 안에 쓰인
+ *   항목 중 만료가 DNS_REFRESH 초 안으로 다가온 것을 다시 해석하고,
+ *   DNS_IDLE 초 넘게 안 쓰인 항목은 버린다.
+ */
+#include "dnscache.h"
+
+/* 항목 상태 */
+#define DNS_RESOLVING 0     /* 처음 해석하는 중 */
+#define DNS_OK        1     /* 주소 있음 */
+#define DNS_FAILED    2     /* 해석 실패 (negative) */
+
+typedef struct dns_entry {
+  char *key;                    /* "host:port" */
+  char *hostname, *port;
+  unsigned int hash;
+  int state;                    /* DNS_* */
+  int refreshing;               /* refresh 쓰레드가 다시 해석하는 중 */
+  dns_addr_t addrs[DNS_MAXADDR];
+  int naddr;
+  time_t expires;               /* 이 시각이 지나면 다시 해석 */
+  time_t used;                  /* 마지막으로 조회된 시각 */
+  struct dns_entry *next;       /* 같은 버킷의 다음 항목 */
+  struct dns_entry *rnext;      /* refresh 할 항목 목록 */
+} dns_entry_t;
+
+static struct {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;          /* DNS_RESOLVING 항목의 해석이 끝남 */
+  dns_entry_t *buckets[DNS_NBUCKETS];
+} dns;
+
+static time_t now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec;
+}
+
+/*
+ * hash_key - FNV-1a 문자열 해시
+ */
+static unsigned int hash_key(const char *key) {
+  unsigned int h = 2166136261u;
+
+  while (*key) {
+    h ^= (unsigned char)*key++;
+    h *= 16777619u;
+  }
+  return h;
+}
+
+/*
+ * resolve - getaddrinfo 로 이름 해석 (lock 없이 호출)
+ * @return 주소 개수, 실패면 -1
+ */
+static int resolve(char *hostname, char *port, dns_addr_t *addrs) {
+  struct addrinfo hints, *listp, *p;
+  int n = 0;
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_NUMERICSERV | AI_ADDRCONFIG;
+  if (getaddrinfo(hostname, port, &hints, &listp) != 0) {
+    return -1;
+  }
+  for (p = listp; p && n < DNS_MAXADDR; p = p->ai_next) {
+    addrs[n].family = p->ai_family;
+    addrs[n].socktype = p->ai_socktype;
+    addrs[n].protocol = p->ai_protocol;
+    addrs[n].addrlen = p->ai_addrlen;
+    memcpy(&addrs[n].addr, p->ai_addr, p->ai_addrlen);
+    n++;
+  }
+  freeaddrinfo(listp);
+  return n > 0 ? n : -1;
+}
+
+/*
+ * store - 해석 결과를 항목에 반영 (lock 잡고 호출)
+ *   refresh 가 실패했으면 예전 주소를 그대로 두고 조금 뒤에 다시 시도
+ */
+static void store(dns_entry_t *e, dns_addr_t *addrs, int n) {
+  time_t t = now();
+
+  if (n > 0) {
+    memcpy(e->addrs, addrs, n * sizeof(dns_addr_t));
+    e->naddr = n;
+    e->state = DNS_OK;
+    e->expires = t + DNS_TTL;
+  } else if (e->state == DNS_OK && e->refreshing) {
+    e->expires = t + DNS_NEGTTL;
+  } else {
+    e->naddr = 0;
+    e->state = DNS_FAILED;
+    e->expires = t + DNS_NEGTTL;
+  }
+}
+
+static void entry_free(dns_entry_t *e) {
+  Free(e->key);
+  Free(e->hostname);
+  Free(e->port);
+  Free(e);
+}
+
+/*
+ * refresher - 곧 만료될 warm 항목을 미리 다시 해석하고 오래 안 쓴 항목을 버림
+ */
+static void *refresher(void *vargp) {
+  dns_entry_t *e, **pp, *todo;
+  dns_addr_t addrs[DNS_MAXADDR];
+  time_t t;
+  int i, n;
+
+  Pthread_detach(pthread_self());
+  while (1) {
+    sleep(1);
+    todo = NULL;
+    t = now();
+
+    pthread_mutex_lock(&dns.lock);
+    for (i = 0; i < DNS_NBUCKETS; i++) {
+      pp = &dns.buckets[i];
+      while ((e = *pp) != NULL) {
+        if (e->state == DNS_RESOLVING || e->refreshing) {
+          pp = &e->next;
+        } else if (t - e->used > DNS_IDLE) {
+          *pp = e->next;
+          entry_free(e);
+        } else {
+          if (e->state == DNS_OK && e->expires - t <= DNS_REFRESH &&
+              t - e->used < DNS_TTL) {
+            e->refreshing = 1;
+            e->rnext = todo;
+            todo = e;
+          }
+          pp = &e->next;
+        }
+      }
+    }
+    pthread_mutex_unlock(&dns.lock);
+
+    // refreshing 인 항목은 버려지지 않으므로 lock 없이 hostname/port 를 읽어도 됨
+    for (e = todo; e; e = e->rnext) {
+      n = resolve(e->hostname, e->port, addrs);
+      pthread_mutex_lock(&dns.lock);
+      store(e, addrs, n);
+      e->refreshing = 0;
+      pthread_mutex_unlock(&dns.lock);
+    }
+  }
+  return NULL;
+}
+
+/*
+ * dns_init - 캐시 초기화와 refresh 쓰레드 시작, main 에서 한 번 호출
+ */
+void dns_init(void) {
+  pthread_t tid;
+
+  memset(&dns, 0, sizeof(dns));
+  pthread_mutex_init(&dns.lock, NULL);
+  pthread_cond_init(&dns.cond, NULL);
+  Pthread_create(&tid, NULL, refresher, NULL);
+}
+
+/*
+ * dns_resolve - hostname:port 의 주소를 최대 max 개 addrs 에 복사
+ *   캐시에 유효한 결과가 있으면 lock 만 잡고 바로 돌아옴
+ * @return 주소 개수, 해석 실패면 -1
+ */
+int dns_resolve(char *hostname, char *port, dns_addr_t *addrs, int max) {
+  char key[MAXLINE];
+  dns_addr_t found[DNS_MAXADDR];
+  dns_entry_t *e;
+  unsigned int h;
+  int n;
+
+  snprintf(key, MAXLINE, "%s:%s", hostname, port);
+  h = hash_key(key);
+
+  pthread_mutex_lock(&dns.lock);
+  for (e = dns.buckets[h % DNS_NBUCKETS]; e; e = e->next) {
+    if (e->hash == h && !strcmp(e->key, key)) {
+      break;
+    }
+  }
+
+  if (!e) {
+    // 처음 보는 이름: 자리를 먼저 잡아 두고 lock 밖에서 해석
+    e = Calloc(1, sizeof(dns_entry_t));
+    e->key = Malloc(strlen(key) + 1);
+    strcpy(e->key, key);
+    e->hostname = Malloc(strlen(hostname) + 1);
+    strcpy(e->hostname, hostname);
+    e->port = Malloc(strlen(port) + 1);
+    strcpy(e->port, port);
+    e->hash = h;
+    e->state = DNS_RESOLVING;
+    e->next = dns.buckets[h % DNS_NBUCKETS];
+    dns.buckets[h % DNS_NBUCKETS] = e;
+  } else {
+    while (e->state == DNS_RESOLVING) {
+      pthread_cond_wait(&dns.cond, &dns.lock);
+    }
+    if (now() >= e->expires && !e->refreshing) {
+      // 오래 안 쓰여서 refresh 되지 않은 채 만료됨: 처음 보는 이름처럼 다시 해석
+      e->state = DNS_RESOLVING;
+    }
+  }
+
+  if (e->state == DNS_RESOLVING) {
+    pthread_mutex_unlock(&dns.lock);
+    n = resolve(hostname, port, found);
+    pthread_mutex_lock(&dns.lock);
+    store(e, found, n);
+    pthread_cond_broadcast(&dns.cond);
+  }
+
+  e->used = now();
+  n = e->state == DNS_OK ? e->naddr : -1;
+  if (n > max) {
+    n = max;
+  }
+  if (n > 0) {
+    memcpy(addrs, e->addrs, n * sizeof(dns_addr_t));
+  }
+  pthread_mutex_unlock(&dns.lock);
+  return n;
+}
+
+/*
+ * dns_open_clientfd - open_clientfd 와 같지만 이름 해석에 캐시를 씀
+ *   t 가 있으면 connect 하는 동안 소켓을 t 에 붙여서, 걸려 있는 마감이 지나면
+ *   막혀 있던 connect 가 실패하고 남은 주소도 시도하지 않음
+ * @return 연결된 fd, 이름 해석 실패면 -2, 그 밖의 에러면 -1
+ */
+int dns_open_clientfd(char *hostname, char *port, dl_timer_t *t) {
+  dns_addr_t addrs[DNS_MAXADDR];
+  int i, n, clientfd;
+
+  if ((n = dns_resolve(hostname, port, addrs, DNS_MAXADDR)) < 0) {
+    return -2;
+  }
+  for (i = 0; i < n; i++) {
+    if ((clientfd = socket(addrs[i].family, addrs[i].socktype, addrs[i].protocol)) < 0) {
+      continue;
+    }
+    if (t && dl_bind(t, clientfd) < 0) {
+      close(clientfd);
+      return -1;
+    }
+    if (connect(clientfd, (SA *)&addrs[i].addr, addrs[i].addrlen) == 0) {
+      return clientfd;
+    }
+    // 닫기 전에 떼어야 같은 번호로 열린 다른 fd 를 shutdown 하지 않음
+    if (t) {
+      dl_bind(t, -1);
+    }
+    close(clientfd);
+  }
+  return -1;
+}
@@ -0,0 +1,39 @@
+/*
+ * dnscache.h - 원격 서버 이름 해석 결과 캐시
+ *
+ * open_clientfd 는 요청마다 getaddrinfo 를 부르므로, 같은 몇 개의 호스트로
+ * 계속 나가는 프록시에서는 resolver 지연이 miss 지연의 큰 몫을 차지한다.
+ * 이 캐시는 "host:port" 마다 getaddrinfo 결과를 DNS_TTL 초 동안 기억하고,
+ * 실패한 이름도 DNS_NEGTTL 초 동안 기억해서 바로 실패시킨다.
+ *
+ * 백그라운드 refresh 쓰레드가 최근에 쓰인 항목을 만료 DNS_REFRESH 초 전에
+ * 미리 다시 해석해 두므로, 자주 쓰는(warm) 호스트는 요청 경로에서 이름
+ * 해석을 기다리는 일이 없다. 다시 해석하다 실패하면 예전 주소를 계속 쓴다.
+ * 처음 보는 호스트를 여러 쓰레드가 동시에 요청하면 한 쓰레드만 해석하고
+ * 나머지는 그 결과를 기다린다.
+ */
+#ifndef __DNSCACHE_H__
+#define __DNSCACHE_H__
+
+#include "csapp.h"
+#include "deadline.h"
+
+#define DNS_NBUCKETS 256    /* 해시 버킷 개수 */
+#define DNS_MAXADDR  8      /* 항목 하나에 기억할 최대 주소 수 */
+#define DNS_TTL      60     /* 성공한 결과를 기억하는 시간 (초) */
+#define DNS_NEGTTL   5      /* 실패한 결과를 기억하는 시간 (초) */
+#define DNS_REFRESH  10     /* 만료 몇 초 전부터 미리 다시 해석할지 */
+#define DNS_IDLE     300    /* 이 시간 동안 안 쓰인 항목은 버림 (초) */
+
+/* 해석된 주소 하나 (struct addrinfo 에서 connect 에 필요한 부분만) */
+typedef struct {
+  int family, socktype, protocol;
+  socklen_t addrlen;
+  struct sockaddr_storage addr;
+} dns_addr_t;
+
+void dns_init(void);
+int dns_resolve(char *hostname, char *port, dns_addr_t *addrs, int max);
+int dns_open_clientfd(char *hostname, char *port, dl_timer_t *t);
+
+#endif /* __DNSCACHE_H__ */
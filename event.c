@@ -0,0 +1,1041 @@
+/*
+ * event.c - epoll 기반 non-blocking 프록시 엔진 (-e epoll)
+ *
+ * doit / forward_request 가 하던 일을 연결 하나당 아래 상태 머신으로 나눈다.
+ *
+ *   C_READREQ -> (캐시 hit) C_SENDOBJ
+ *             -> (miss) C_CONNECTING -> C_SENDREQ -> C_RELAY
+ *             -> (에러, 통계 페이지) C_SENDERR
+ *
+ * 응답을 다 보낸 뒤 클라이언트가 keep-alive 를 원했고 응답 길이를 알 수 있었으면
+ * (send_head 와 같은 기준) 다시 C_READREQ 로 돌아간다. 요청 헤더 뒤에 같이 온
+ * 파이프라인 바이트는 따로 두었다가 그때 요청 버퍼로 옮기고, 새 이벤트를 기다리지
+ * 않고 reactor 가 이번 epoll_wait 묶음 끝에 이어서 처리한다. 한 연결의 요청은
+ * 하나씩 차례로 처리하므로 응답도 요청 순서대로 나간다.
+ *
+ * - reactor 쓰레드마다 epoll 인스턴스가 따로 있고, 리슨 소켓은 모든 epoll 에
+ *   EPOLLEXCLUSIVE 로 등록해서 새 연결이 오면 한 reactor 만 깨어난다.
+ *   연결은 accept 한 reactor 에서 끝날 때까지 처리된다.
+ * - reuseport 모드에서는 reactor 마다 SO_REUSEPORT 리슨 소켓을 따로 열고
+ *   reactor 쓰레드를 CPU 하나에 고정한다. 커널이 새 연결을 소켓들에 나눠
+ *   주므로 accept 부터 응답까지 한 코어 안에서 끝나고 공유하는 것이 없다.
+ * - 연결 하나가 붙잡는 메모리는 conn_t 와 최대 EV_BUFSIZE 버퍼 하나뿐이다.
+ *   원격 서버 응답은 reactor 의 scratch 버퍼로 읽어 곧바로 클라이언트에게
+ *   쓰고, 클라이언트가 다 받지 못했을 때만 남은 바이트를 연결 버퍼에 옮긴 뒤
+ *   원격 서버 읽기를 멈춘다.
+ * - epoll 엔진의 연결은 follower 로 기다릴 수 없으므로 flight_lead 로
+ *   leader 가 될 수 있을 때만 캐시를 채우고, 다른 쪽이 받아오는 중이면
+ *   캐시 없이 직접 가져온다.
+ * - 이름 해석은 dnscache 를 거친다. warm 호스트는 캐시에서 바로 나오고,
+ *   처음 보는 호스트만 reactor 쓰레드에서 blocking 으로 해석한다.
+ * - 원격 서버 마감(connect, 첫 바이트, idle, 전체)은 쓰레드 엔진과 같은
+ *   timer wheel 을 쓴다. 마감이 지나면 wheel 이 원격 서버 소켓을 shutdown
+ *   하고, 그것이 EPOLLHUP 이나 EOF 로 이 상태 머신에 들어온다. circuit
+ *   breaker 도 쓰레드 엔진과 같은 것을 쓴다.
+ * - 원격 서버 keep-alive 풀(upstream_get / upstream_put)은 쓰지 않는다. 요청마다
+ *   새로 연결하고, 응답을 Content-length 만큼 (없으면 EOF 까지) 받은 뒤 닫는다.
+ *   응답 헤더는 쓰레드 엔진처럼 copy_head 로 다시 조립해서 원격 서버 연결에만
+ *   해당하는 헤더를 빼고 클라이언트 연결의 Connection 헤더를 붙인다.
+ * - fd 가 모자라서 accept 가 실패하면 (EMFILE, ENFILE) 연결이 리슨 큐에 남아
+ *   epoll 이 쉬지 않고 깨우므로, reactor 마다 잡아 둔 spare fd 를 풀어서
+ *   쌓인 연결을 받자마자 닫는다.
+ * - 요청 헤더를 읽는 동안에는 (keep-alive 로 다음 요청을 기다리는 동안도)
+ *   같은 타이머로 클라이언트 쪽에 EV_REQ_MS 마감을 건다. 아무것도 보내지 않거나 조금씩 흘려 보내는 클라이언트는 마감이
+ *   지나면 클라이언트 소켓이 shutdown 되어 EOF 로 닫힌다.
+ */
+#define _GNU_SOURCE
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <netinet/tcp.h>
+#include "event.h"
+#include "proxy.h"
+#include "cache.h"
+#include "dnscache.h"
+#include "upstream.h"
+#include "deadline.h"
+#include "httpparse.h"
+#include "log.h"
+#include "stats.h"
+
+/* 연결 상태 */
+#define C_READREQ    0    /* 클라이언트 요청 헤더를 읽는 중 */
+#define C_CONNECTING 1    /* 원격 서버에 non-blocking connect 중 */
+#define C_SENDREQ    2    /* 원격 서버로 요청을 보내는 중 */
+#define C_RELAY      3    /* 원격 서버 응답을 클라이언트로 전달하는 중 */
+#define C_SENDOBJ    4    /* 캐시 객체를 클라이언트로 보내는 중 */
+#define C_SENDERR    5    /* 에러 응답이나 통계 페이지를 보내고 닫는 중 */
+#define C_CLOSED     6    /* 닫혔고, 이번 epoll_wait 묶음을 다 처리하면 해제 */
+
+struct conn;
+
+/* epoll 에 등록하는 fd 하나 */
+typedef struct {
+  int fd;
+  int events;             /* 등록된 관심 이벤트, 아직 등록 전이면 -1 */
+  struct conn *c;
+} evh_t;
+
+typedef struct reactor {
+  int epfd;
+  int listenfd;
+  int cpu;                    /* 고정할 CPU, 고정하지 않으면 -1 */
+  int spare;                  /* fd 가 모자랄 때 풀어 쓰려고 잡아 둔 fd, 없으면 -1 */
+  struct conn *dead;          /* 닫혀서 해제를 기다리는 연결 */
+  struct conn *ready;         /* 파이프라인으로 받아 둔 다음 요청이 있는 연결 */
+  char scratch[EV_BUFSIZE];   /* 원격 서버 응답을 잠깐 담는 버퍼 */
+} reactor_t;
+
+typedef struct conn {
+  evh_t client, server;
+  int state;
+  char *buf;              /* 아직 못 보낸 바이트, 없으면 NULL */
+  size_t len, off;        /* buf[off..len) 이 남은 바이트 */
+  char *rest;             /* 요청 헤더 뒤에 같이 온 파이프라인 바이트, 없으면 NULL */
+  size_t restlen;
+  int keepalive;          /* 이 응답 뒤에 연결을 유지할지 */
+  char *head;             /* C_RELAY: 다 모이지 않은 원격 서버 응답 헤더, 없으면 NULL */
+  size_t headlen;
+  int inbody;             /* C_RELAY: 응답 헤더를 넘겼고 바디를 옮기는 중 */
+  long left;              /* C_RELAY: 남은 바디 바이트, 길이를 모르면 -1 */
+  cache_obj_t *obj;       /* C_SENDOBJ 에서 보내는 캐시 객체 */
+  size_t sent;            /* obj 에서 보낸 바이트 수 (헤더는 buf 로 따로 보냄) */
+  flight_t *fl;           /* 캐시를 채우는 중이면 leader 로 잡은 flight */
+  size_t total;           /* 원격 서버에서 받은 바이트 수 */
+  up_host_t *host;        /* 원격 서버에 연결했으면 그 breaker 항목, 결과를 알렸으면 NULL */
+  dl_timer_t dl;          /* C_READREQ 에서는 요청 헤더 마감, 그 뒤로는 host 가 있을 때만 원격 서버 마감 */
+  char *line;             /* 접근 로그용 메소드 + uri 복사본, 로그가 꺼져 있으면 NULL */
+  int methodlen, urilen;
+  int status;             /* 접근 로그: 클라이언트에게 보낸 응답 상태 */
+  char *result;           /* 접근 로그: HIT, MISS, ERROR, 요청을 받기 전이면 NULL */
+  int kind;               /* 통계: SC_HITS, SC_MISSES, 그 밖에는 -1 */
+  stats_times_t t;        /* 통계: 단계별 시점, ready 는 accept 한 시각 */
+  reactor_t *r;
+  struct conn *next;      /* reactor 의 dead 리스트 */
+  int queued;             /* reactor 의 ready 리스트에 들어 있음 */
+  struct conn *rnext;     /* reactor 의 ready 리스트 */
+} conn_t;
+
+static void client_write(conn_t *c);
+static void client_parse(conn_t *c);
+static void server_write(conn_t *c);
+
+/*
+ * watch - fd 의 관심 이벤트 바꾸기 (0 이면 아무 이벤트도 받지 않음)
+ */
+static void watch(conn_t *c, evh_t *h, int events) {
+  struct epoll_event ev;
+
+  if (h->events == events) {
+    return;
+  }
+  ev.events = events;
+  ev.data.ptr = h;
+  epoll_ctl(c->r->epfd, h->events < 0 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, h->fd, &ev);
+  h->events = events;
+}
+
+/*
+ * conn_new - accept 한 클라이언트 연결 하나 만들기
+ */
+static conn_t *conn_new(reactor_t *r, int fd) {
+  conn_t *c = Calloc(1, sizeof(conn_t));
+
+  c->client.fd = fd;
+  c->client.events = -1;
+  c->client.c = c;
+  c->server.fd = -1;
+  c->server.events = -1;
+  c->server.c = c;
+  c->state = C_READREQ;
+  c->kind = -1;
+  c->t.ready = stats_now();
+  c->r = r;
+  dl_start(&c->dl, EV_REQ_MS);
+  dl_arm(&c->dl, fd, EV_REQ_MS);
+  return c;
+}
+
+/*
+ * server_done - 원격 서버 마감을 떼고 결과를 breaker 에 알림, 원격 서버 fd 를 닫기 전에 호출
+ *   ok 여도 마감이 지났으면 실패로 알림
+ * @return 마감이 지나서 끊긴 것이면 1
+ */
+static int server_done(conn_t *c, int ok) {
+  int timedout;
+
+  if (!c->host) {
+    return 0;
+  }
+  if ((timedout = dl_cancel(&c->dl)) != 0) {
+    stats_count(SC_UPTIMEOUT, 1);
+  }
+  upstream_report(c->host, ok && !timedout);
+  c->host = NULL;
+  return timedout;
+}
+
+/*
+ * conn_log - 끝난 요청 하나를 접근 로그와 통계에 남기고 요청별 기록을 비움
+ */
+static void conn_log(conn_t *c) {
+  long long bytes;
+
+  if (c->result) {
+    bytes = c->obj ? c->sent : c->state == C_SENDERR ? c->off : c->total;
+    stats_finish(&c->t, c->kind, c->status, bytes);
+    log_access(c->line ? c->line : "-", c->line ? c->methodlen : 1,
+               c->line ? c->line + c->methodlen : "-", c->line ? c->urilen : 1, c->status,
+               bytes, c->t.head ? (c->t.done - c->t.head) / 1000 : 0, c->result);
+  }
+  if (c->line) {
+    Free(c->line);
+  }
+  c->line = NULL;
+  c->result = NULL;
+  c->status = 0;
+  c->kind = -1;
+}
+
+/*
+ * conn_close - 연결을 닫고 붙잡고 있던 것을 모두 놓음
+ *
+ * 같은 epoll_wait 묶음에 이 연결의 다른 fd 이벤트가 남아 있을 수 있으므로
+ * conn_t 자체는 dead 리스트에 넣어 두고 묶음 처리가 끝난 뒤 해제한다.
+ */
+static void conn_close(conn_t *c) {
+  conn_log(c);
+  // 요청을 다 받기 전에 닫으면 요청 헤더 마감이 아직 걸려 있음
+  if (c->state == C_READREQ) {
+    dl_cancel(&c->dl);
+  }
+  close(c->client.fd);
+  // 응답을 받기 시작하기 전에 끝났으면 원격 서버 쪽 실패로 봄
+  server_done(c, c->total > 0);
+  if (c->server.fd >= 0) {
+    close(c->server.fd);
+  }
+  if (c->obj) {
+    cache_release(c->obj);
+  }
+  if (c->fl) {
+    flight_finish(c->fl, 0);
+    flight_release(c->fl);
+  }
+  if (c->buf) {
+    Free(c->buf);
+  }
+  if (c->rest) {
+    Free(c->rest);
+  }
+  if (c->head) {
+    Free(c->head);
+  }
+  c->state = C_CLOSED;
+  c->next = c->r->dead;
+  c->r->dead = c;
+}
+
+/*
+ * next_request - 응답을 다 보낸 keep-alive 연결을 다음 요청을 읽는 상태로 되돌림
+ *   파이프라인으로 같이 온 바이트가 있으면 요청 버퍼로 옮기고 ready 리스트에 넣음
+ *   (그 바이트로는 새 이벤트가 오지 않으므로)
+ */
+static void next_request(conn_t *c) {
+  conn_log(c);
+  if (c->obj) {
+    cache_release(c->obj);
+    c->obj = NULL;
+  }
+  if (c->buf) {
+    Free(c->buf);
+  }
+  c->buf = c->rest;
+  c->len = c->restlen;
+  c->rest = NULL;
+  c->restlen = 0;
+  c->off = c->sent = c->total = 0;
+  c->inbody = 0;
+  c->keepalive = 0;
+  memset(&c->t, 0, sizeof(c->t));
+  c->state = C_READREQ;
+  dl_start(&c->dl, EV_REQ_MS);
+  dl_arm(&c->dl, c->client.fd, EV_REQ_MS);
+  watch(c, &c->client, EPOLLIN);
+  if (c->buf) {
+    c->t.ready = stats_now();
+    if (!c->queued) {
+      c->queued = 1;
+      c->rnext = c->r->ready;
+      c->r->ready = c;
+    }
+  }
+}
+
+/*
+ * response_done - 응답을 끝까지 보냈음, 연결을 유지하면 다음 요청으로 아니면 닫음
+ */
+static void response_done(conn_t *c) {
+  if (c->keepalive) {
+    next_request(c);
+  } else {
+    conn_close(c);
+  }
+}
+
+/*
+ * put_head - 응답 헤더 블록(hdr, 빈 줄까지)을 dst(n + 32 이상)로 옮기면서 빈 줄 앞에
+ *   Connection 헤더를 붙임, dst 와 hdr 이 같아도 됨
+ *   클라이언트가 keep-alive 를 원하고 응답 길이를 알 수 있을 때만 연결을 유지
+ * @return dst 에 쓴 길이
+ */
+static size_t put_head(conn_t *c, char *dst, char *hdr, size_t n) {
+  c->keepalive = c->keepalive && response_framed(hdr, n);
+  memmove(dst, hdr, n - 2);
+  return n - 2 + sprintf(dst + n - 2, "Connection: %s\r\n\r\n",
+                         c->keepalive ? "keep-alive" : "close");
+}
+
+/*
+ * send_error - 에러 응답을 만들어 보내고 연결을 닫음
+ */
+static void send_error(conn_t *c, char *errnum, char *shortmsg, char *longmsg) {
+  char body[MAXLINE];
+  int n;
+
+  n = snprintf(body, MAXLINE, "<html><title>Tiny Error</title><body bgcolor=ffffff>\r\n"
+               "%s: %s\r\n<p>%s\r\n<hr><em>The Tiny Web server</em>\r\n",
+               errnum, shortmsg, longmsg);
+  if (!c->buf) {
+    c->buf = Malloc(EV_BUFSIZE);
+  }
+  c->len = snprintf(c->buf, EV_BUFSIZE, "HTTP/1.0 %s %s\r\nContent-type: text/html\r\n"
+                    "Content-length: %d\r\n\r\n%s", errnum, shortmsg, n, body);
+  c->off = 0;
+  c->state = C_SENDERR;
+  c->keepalive = 0;
+  c->status = atoi(errnum);
+  c->result = "ERROR";
+  server_done(c, 0);
+  if (c->server.fd >= 0) {
+    close(c->server.fd);
+    c->server.fd = -1;
+  }
+  watch(c, &c->client, 0);
+  client_write(c);
+}
+
+/*
+ * send_stats - 통계 페이지를 보냄
+ */
+static void send_stats(conn_t *c, int json) {
+  char *page = c->r->scratch, *p;
+  size_t n, hlen;
+
+  n = stats_response(page, EV_BUFSIZE, json);
+  hlen = (p = memmem(page, n, "\r\n\r\n", 4)) != NULL ? p + 4 - page : 0;
+  if (c->buf) {
+    Free(c->buf);
+  }
+  c->buf = Malloc(n + 32);
+  if (hlen) {
+    c->len = put_head(c, c->buf, page, hlen);
+  } else {
+    c->keepalive = 0;
+    c->len = 0;
+  }
+  memcpy(c->buf + c->len, page + hlen, n - hlen);
+  c->len += n - hlen;
+  c->off = 0;
+  c->state = C_SENDERR;
+  c->status = 200;
+  c->result = "STATS";
+  client_write(c);
+}
+
+/*
+ * begin_fetch - 원격 서버로 non-blocking connect 시작
+ */
+static void begin_fetch(conn_t *c, request_t *req) {
+  char hostname[NI_MAXHOST], port[NI_MAXSERV], *buf;
+  dns_addr_t addrs[DNS_MAXADDR];
+  int i, n, fd = -1;
+
+  // getaddrinfo 가 NUL 로 끝나는 문자열을 받으므로 호스트명과 포트만 복사
+  view_cstr(hostname, sizeof(hostname), req->hostname);
+  view_cstr(port, sizeof(port), req->port);
+  if ((n = dns_resolve(hostname, port, addrs, DNS_MAXADDR)) < 0) {
+    send_error(c, "502", "Bad Gateway", "Failed to resolve server");
+    return;
+  }
+  if (!upstream_allow(hostname, port)) {
+    stats_count(SC_UPREJECTED, 1);
+    send_error(c, "503", "Service Unavailable", "Server keeps failing, try again later");
+    return;
+  }
+  // 이름을 해석했으니 breaker 항목을 잡음, server_done 에서 결과를 알리며 놓음
+  c->host = upstream_host(hostname, port, 1);
+  dl_start(&c->dl, UP_TOTAL_MS);
+  for (i = 0; i < n; i++) {
+    if ((fd = socket(addrs[i].family, addrs[i].socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                     addrs[i].protocol)) < 0) {
+      continue;
+    }
+    if (connect(fd, (SA *)&addrs[i].addr, addrs[i].addrlen) == 0 || errno == EINPROGRESS) {
+      break;
+    }
+    close(fd);
+    fd = -1;
+  }
+  if (fd < 0) {
+    send_error(c, "502", "Bad Gateway", "Failed to connect to server");
+    return;
+  }
+
+  // 보낼 요청을 미리 만들어 둠. req 는 c->buf 를 가리키므로 다 만든 뒤에 바꿈
+  buf = Malloc(REQUEST_BUFSIZE(req));
+  c->len = build_request(buf, req, 0);
+  Free(c->buf);
+  c->buf = buf;
+  c->off = 0;
+
+  c->server.fd = fd;
+  c->state = C_CONNECTING;
+  dl_arm(&c->dl, fd, UP_CONNECT_MS);
+  watch(c, &c->server, EPOLLOUT);
+}
+
+/*
+ * handle_request - 요청 헤더를 다 받았으면 캐시를 보거나 원격 서버로 연결
+ */
+static void handle_request(conn_t *c, request_t *req) {
+  char key[MAXLINE], *p;
+  cache_obj_t *obj;
+  size_t hlen;
+  int json;
+
+  // 요청을 다 받았으니 클라이언트 쪽은 더 읽지 않음
+  watch(c, &c->client, 0);
+
+  // 접근 로그는 연결을 닫을 때 남기므로 요청 버퍼가 바뀌기 전에 메소드와 uri 만 복사
+  c->t.head = stats_now();
+  if (LOG_INFO <= log_level) {
+    c->methodlen = req->head.method.len;
+    c->urilen = req->head.uri.len < LOG_TEXTLEN ? req->head.uri.len : LOG_TEXTLEN;
+    c->line = Malloc(c->methodlen + c->urilen);
+    memcpy(c->line, HTTP_PTR(&req->head, req->head.method), c->methodlen);
+    memcpy(c->line + c->methodlen, HTTP_PTR(&req->head, req->head.uri), c->urilen);
+  }
+
+  if (parse_request(req) < 0) {
+    send_error(c, "400", "Bad Request", "Failed to parse URI");
+    return;
+  }
+  if (!view_is(req->method, "GET")) {
+    send_error(c, "501", "Not Implemented", "Tiny does not implement this method");
+    return;
+  }
+  c->keepalive = request_keepalive(&req->head);
+
+  // 통계 페이지는 캐시나 원격 서버를 거치지 않고 여기서 답함
+  if ((json = stats_match(req->hostname, req->pathname)) >= 0) {
+    send_stats(c, json);
+    return;
+  }
+
+  // 캐시에 있으면 원격 서버에 가지 않고 바로 응답
+  cache_makekey(key, req->hostname, req->port, req->pathname);
+  // 헤더 블록만 Connection 헤더를 붙여 buf 로 옮기고, 바디는 객체에서 바로 보냄
+  if ((obj = cache_get(key)) != NULL) {
+    Free(c->buf);
+    c->buf = NULL;
+    c->off = c->len = 0;
+    hlen = (p = memmem(obj->data, obj->size, "\r\n\r\n", 4)) != NULL ? p + 4 - obj->data : 0;
+    if (hlen) {
+      c->buf = Malloc(hlen + 32);
+      c->len = put_head(c, c->buf, obj->data, hlen);
+    } else {
+      c->keepalive = 0;   // 헤더 끝이 없는 응답은 그대로 보내고 닫음
+    }
+    c->obj = obj;
+    c->status = 200;    // 200 응답만 캐시됨
+    c->result = "HIT";
+    c->kind = SC_HITS;
+    c->sent = hlen;
+    c->state = C_SENDOBJ;
+    client_write(c);
+    return;
+  }
+
+  // 다른 연결이 이미 받아오는 중이면 캐시는 그쪽에 맡기고 직접 가져옴
+  c->fl = flight_lead(key);
+  c->result = "MISS";
+  c->kind = SC_MISSES;
+  begin_fetch(c, req);
+}
+
+/*
+ * client_read - C_READREQ: 빈 줄이 나올 때까지 요청 헤더를 모음
+ */
+static void client_read(conn_t *c) {
+  ssize_t n;
+
+  if (!c->buf) {
+    c->buf = Malloc(EV_BUFSIZE);
+    c->len = 0;
+  }
+  n = read(c->client.fd, c->buf + c->len, EV_BUFSIZE - 1 - c->len);
+  if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+    return;
+  }
+  if (n <= 0) {
+    conn_close(c);
+    return;
+  }
+  // 요청의 시작 시각은 그 요청이 보인 때 (keep-alive 로 쉬던 시간은 빼고)
+  if (c->t.ready == 0) {
+    c->t.ready = stats_now();
+  }
+  c->len += n;
+  c->buf[c->len] = '\0';
+  client_parse(c);
+}
+
+/*
+ * client_parse - 요청 버퍼에 요청 헤더가 다 모였으면 처리
+ */
+static void client_parse(conn_t *c) {
+  request_t req;
+  int rc;
+
+  if ((rc = http_parse_request(c->buf, c->len, &req.head)) == 0 && c->len < EV_BUFSIZE - 1) {
+    return;
+  }
+  // 요청 헤더를 다 받았거나 더 받을 수 없음. 이제부터 c->dl 은 원격 서버 마감
+  dl_cancel(&c->dl);
+  if (rc > 0) {
+    // 뒤에 같이 온 파이프라인 바이트는 이 응답을 다 보낼 때까지 따로 둠
+    // (요청 버퍼는 원격 서버로 보낼 요청이나 응답으로 바뀜)
+    if (c->len > (size_t)rc) {
+      c->restlen = c->len - rc;
+      c->rest = Malloc(EV_BUFSIZE);
+      memcpy(c->rest, c->buf + rc, c->restlen);
+      c->rest[c->restlen] = '\0';
+    }
+    handle_request(c, &req);
+  } else if (rc < 0) {
+    send_error(c, "400", "Bad Request", "Failed to parse request header");
+  } else {
+    send_error(c, "431", "Request Header Fields Too Large", "Request header is too large");
+  }
+}
+
+/*
+ * client_write - 남은 바이트(buf, 그 다음 캐시 객체)를 클라이언트에게 씀
+ */
+static void client_write(conn_t *c) {
+  int relaying = c->state == C_RELAY && c->server.fd >= 0;
+  char *p;
+  size_t left;
+  ssize_t n;
+
+  while (1) {
+    if (c->buf && c->off < c->len) {
+      p = c->buf + c->off;
+      left = c->len - c->off;
+    } else if (c->state == C_SENDOBJ && c->sent < c->obj->size) {
+      p = c->obj->data + c->sent;
+      left = c->obj->size - c->sent;
+    } else {
+      break;
+    }
+    if ((n = write(c->client.fd, p, left)) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN) {
+        // 클라이언트가 받을 수 있을 때까지 원격 서버 읽기도 멈춤
+        watch(c, &c->client, EPOLLOUT);
+        if (relaying) {
+          watch(c, &c->server, 0);
+          dl_hold(&c->dl);
+        }
+        return;
+      }
+      conn_close(c);
+      return;
+    }
+    if (c->buf && p == c->buf + c->off) {
+      c->off += n;
+    } else {
+      c->sent += n;
+    }
+    // 클라이언트가 받아 가는 동안은 원격 서버가 멈춘 것이 아님
+    if (relaying) {
+      dl_touch(&c->dl);
+    }
+  }
+
+  // 다 보냈음. 원격 서버 응답이 아직 남았으면 다시 읽음
+  if (!relaying) {
+    response_done(c);
+    return;
+  }
+  Free(c->buf);
+  c->buf = NULL;
+  watch(c, &c->client, 0);
+  watch(c, &c->server, EPOLLIN);
+}
+
+/*
+ * server_end - 원격 서버 응답이 끝났음. 결과를 알리고 원격 서버 연결을 닫음
+ *   complete 면 응답을 끝까지 받은 것이므로 캐시를 채우고, 아니면 클라이언트
+ *   연결도 유지하지 않음
+ */
+static void server_end(conn_t *c, int ok, int complete) {
+  if (server_done(c, ok)) {
+    complete = 0;
+  }
+  if (c->fl) {
+    flight_finish(c->fl, complete);
+    flight_release(c->fl);
+    c->fl = NULL;
+  }
+  close(c->server.fd);
+  c->server.fd = -1;
+  c->server.events = -1;
+  if (!complete) {
+    c->keepalive = 0;
+  }
+}
+
+/*
+ * relay_out - 클라이언트에게 씀, 못 받은 나머지는 연결 버퍼 뒤에 붙이고 원격 서버 읽기를 멈춤
+ * @return 1: 다 썼음, 0: 버퍼에 남음, -1: 클라이언트가 끊겨서 연결을 닫았음
+ */
+static int relay_out(conn_t *c, char *data, size_t n) {
+  size_t w = 0;
+  ssize_t m;
+
+  // 이미 남은 바이트가 있으면 순서를 지키려고 뒤에 붙이기만 함
+  if (!c->buf) {
+    while (w < n) {
+      if ((m = write(c->client.fd, data + w, n - w)) < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        if (errno == EAGAIN) {
+          break;
+        }
+        conn_close(c);
+        return -1;
+      }
+      w += m;
+    }
+    if (w == n) {
+      return 1;
+    }
+    c->off = c->len = 0;
+  }
+  c->buf = Realloc(c->buf, c->len + n - w);
+  memcpy(c->buf + c->len, data + w, n - w);
+  c->len += n - w;
+  watch(c, &c->client, EPOLLOUT);
+  // 원격 서버를 읽지 않는 동안은 idle 마감을 멈춤
+  if (c->server.fd >= 0) {
+    watch(c, &c->server, 0);
+    dl_hold(&c->dl);
+  }
+  return 0;
+}
+
+/*
+ * relay_body - 바디 바이트를 캐시와 클라이언트로 넘김, 길이만큼 다 받았으면 원격 서버를 닫음
+ */
+static void relay_body(conn_t *c, char *data, size_t n) {
+  // 길이를 넘는 바이트는 이 응답이 아님
+  if (c->left >= 0 && (long)n > c->left) {
+    n = c->left;
+  }
+  if (c->fl && flight_wants_data(c->fl)) {
+    flight_append(c->fl, data, n);
+  }
+  if (c->left > 0) {
+    c->left -= n;
+  }
+  if (c->left == 0) {
+    server_end(c, 1, 1);
+  }
+  if (relay_out(c, data, n) > 0 && c->server.fd < 0) {
+    response_done(c);
+  }
+}
+
+/*
+ * relay_head - 원격 서버 응답 헤더 블록을 모아서, 다 모였으면 다시 조립해서 넘김
+ *   원격 서버 연결에만 해당하는 헤더는 빼고 클라이언트 연결의 Connection 헤더를 붙임
+ *   헤더 블록이 틀렸거나 너무 크면 받은 그대로 넘기고 EOF 까지 중계한 뒤 닫음
+ */
+static void relay_head(conn_t *c, char *data, size_t n) {
+  http_msg_t resp;
+  char *head, *out, *p;
+  size_t hlen;
+  long clen;
+  int rc = -1, reuse;
+
+  if (c->headlen + n <= EV_BUFSIZE) {
+    if (!c->head) {
+      c->head = Malloc(EV_BUFSIZE);
+    }
+    memcpy(c->head + c->headlen, data, n);
+    c->headlen += n;
+    n = 0;
+    if ((rc = http_parse_response(c->head, c->headlen, &resp)) == 0 && c->headlen < EV_BUFSIZE) {
+      return;
+    }
+  }
+  head = c->head;
+  hlen = c->headlen;
+  c->head = NULL;
+  c->headlen = 0;
+  c->inbody = 1;
+
+  if (rc <= 0) {
+    c->left = -1;
+    c->keepalive = 0;
+    if (c->fl) {
+      flight_nocache(c->fl);
+    }
+    if (head) {
+      relay_body(c, head, hlen);
+      Free(head);
+    }
+    // 버퍼에 들어가지 않은 나머지 (relay_body 가 연결을 닫았으면 버림)
+    if (n > 0 && c->state == C_RELAY) {
+      relay_body(c, data, n);
+    }
+    return;
+  }
+
+  // 캐시에는 Connection 헤더 없이 넣고 (send_object 가 보낼 때 붙임)
+  // 클라이언트에게는 붙여서 보냄
+  c->status = resp.status;
+  out = Malloc(HEAD_BUFSIZE(&resp) + 32);
+  p = copy_head(out, &resp, &clen, &reuse);
+  if (c->fl) {
+    // 200 응답만 캐시, 바디 크기가 MAX_OBJECT_SIZE 를 넘으면 모으지 않고 흘려보냄
+    if (resp.status != 200) {
+      flight_nocache(c->fl);
+    } else if (clen > MAX_OBJECT_SIZE) {
+      flight_oversize(c->fl);
+    }
+    if (flight_wants_data(c->fl)) {
+      flight_append(c->fl, out, p - out);
+    }
+  }
+  c->left = resp.status == 204 || resp.status == 304 ? 0 : clen;
+  // 길이를 모르면 EOF 가 응답의 끝이므로 클라이언트 연결도 유지할 수 없음
+  if (c->left < 0 || !response_framed(out, p - out)) {
+    c->left = -1;
+    c->keepalive = 0;
+  }
+  if (relay_out(c, out, put_head(c, out, out, p - out)) >= 0) {
+    relay_body(c, head + rc, hlen - rc);
+  }
+  Free(out);
+  Free(head);
+}
+
+/*
+ * server_read - C_RELAY: 원격 서버 응답을 읽어서 바로 클라이언트에게 씀
+ */
+static void server_read(conn_t *c) {
+  char *data = c->r->scratch;
+  ssize_t n;
+
+  n = read(c->server.fd, data, EV_BUFSIZE);
+  if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+    return;
+  }
+  if (n <= 0) {
+    // 응답을 한 바이트도 받지 못했으면 실패 (마감이 지났으면 504, 아니면 502)
+    if (c->total == 0) {
+      if (server_done(c, 0)) {
+        send_error(c, "504", "Gateway Timeout", "No response from server");
+      } else {
+        send_error(c, "502", "Bad Gateway", "No response from server");
+      }
+      return;
+    }
+    // 길이를 모르는 응답은 EOF 가 끝, 길이만큼 받기 전이면 바디가 잘린 것
+    server_end(c, n == 0, n == 0 && c->inbody && c->left < 0);
+    // 헤더 끝을 못 찾은 응답은 받은 그대로
+    if (!c->inbody) {
+      c->inbody = 1;
+      c->left = -1;
+      relay_body(c, c->head, c->headlen);
+      return;
+    }
+    if (!c->buf) {
+      response_done(c);
+    }
+    return;
+  }
+  if (c->total == 0) {
+    dl_arm_idle(&c->dl, c->server.fd, UP_IDLE_MS);
+    c->t.first = stats_now();
+  }
+  c->total += n;
+  dl_touch(&c->dl);
+  if (!c->inbody) {
+    relay_head(c, data, n);
+  } else {
+    relay_body(c, data, n);
+  }
+}
+
+/*
+ * server_write - C_CONNECTING / C_SENDREQ: 연결이 끝났으면 요청을 보냄
+ */
+static void server_write(conn_t *c) {
+  int err = 0;
+  socklen_t len = sizeof(err);
+  ssize_t n;
+
+  if (c->state == C_CONNECTING) {
+    getsockopt(c->server.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+    if (err) {
+      if (server_done(c, 0)) {
+        send_error(c, "504", "Gateway Timeout", "Failed to connect to server");
+      } else {
+        send_error(c, "502", "Bad Gateway", "Failed to connect to server");
+      }
+      return;
+    }
+    c->t.connect = stats_now();
+    stats_count(SC_UPNEW, 1);
+    dl_arm(&c->dl, c->server.fd, UP_TTFB_MS);
+    c->state = C_SENDREQ;
+  }
+
+  while (c->off < c->len) {
+    if ((n = write(c->server.fd, c->buf + c->off, c->len - c->off)) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN) {
+        return;
+      }
+      if (server_done(c, 0)) {
+        send_error(c, "504", "Gateway Timeout", "Failed to send request");
+      } else {
+        send_error(c, "502", "Bad Gateway", "Failed to send request");
+      }
+      return;
+    }
+    c->off += n;
+  }
+
+  Free(c->buf);
+  c->buf = NULL;
+  c->state = C_RELAY;
+  watch(c, &c->server, EPOLLIN);
+}
+
+/*
+ * drop_one - fd 가 모자라서 받지 못한 연결 하나를 받자마자 닫음
+ *   받지 못한 연결은 리슨 큐에 남아서 epoll 이 계속 깨우므로 (busy loop),
+ *   잡아 둔 spare fd 를 잠깐 풀어서 그 자리로 받고 닫은 뒤 다시 잡아 둠
+ * @return 1: 하나 버렸음, 0: 버릴 연결이 없거나 spare 도 없음
+ */
+static int drop_one(reactor_t *r) {
+  int fd;
+
+  if (r->spare < 0 && (r->spare = open("/dev/null", O_RDONLY | O_CLOEXEC)) < 0) {
+    return 0;
+  }
+  close(r->spare);
+  if ((fd = accept4(r->listenfd, NULL, NULL, SOCK_CLOEXEC)) >= 0) {
+    close(fd);
+  }
+  r->spare = open("/dev/null", O_RDONLY | O_CLOEXEC);
+  return fd >= 0;
+}
+
+/*
+ * accept_all - 리슨 소켓에 쌓인 연결을 모두 받아서 이 reactor 에 등록
+ *   fd 가 모자라면 (EMFILE, ENFILE) 쌓인 연결을 받는 대로 닫아서 리슨 큐를 비움
+ */
+static void accept_all(reactor_t *r) {
+  conn_t *c;
+  int fd, dropped = 0, one = 1;
+
+  while (1) {
+    if ((fd = accept4(r->listenfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if ((errno == EMFILE || errno == ENFILE) && drop_one(r)) {
+        dropped++;
+        continue;
+      }
+      break;
+    }
+    // 응답 헤더와 바디를 따로 쓰므로, keep-alive 연결에서 Nagle 이 응답 끝을 붙잡지 않도록
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    c = conn_new(r, fd);
+    stats_count(SC_CONNS, 1);
+    watch(c, &c->client, EPOLLIN);
+  }
+  if (dropped) {
+    LOG(LOG_ERROR, "Out of file descriptors, dropped %d connections", dropped);
+  }
+}
+
+/*
+ * dispatch - 이벤트가 난 fd 와 연결 상태에 따라 처리 함수 호출
+ */
+static void dispatch(evh_t *h, int events) {
+  conn_t *c = h->c;
+
+  if (c->state == C_CLOSED) {
+    return;
+  }
+  if (h == &c->client) {
+    if (c->state == C_READREQ) {
+      client_read(c);
+    } else if (events & (EPOLLERR | EPOLLHUP)) {
+      conn_close(c);
+    } else {
+      client_write(c);
+    }
+  } else if (c->state == C_RELAY) {
+    // 클라이언트에게 못 보낸 바이트가 남아 있는 동안은 원격 서버를 읽지 않음.
+    // 그 사이 원격 서버가 끊기면(RST) 더 기다릴 이유가 없음
+    if (!c->buf) {
+      server_read(c);
+    } else if (events & (EPOLLERR | EPOLLHUP)) {
+      conn_close(c);
+    }
+  } else {
+    server_write(c);
+  }
+}
+
+/*
+ * reactor - reactor 쓰레드 루프
+ */
+static void *reactor(void *vargp) {
+  reactor_t *r = vargp;
+  struct epoll_event evs[EV_MAXEVENTS];
+  conn_t *c;
+  cpu_set_t set;
+  int i, n;
+
+  if (r->cpu >= 0) {
+    CPU_ZERO(&set);
+    CPU_SET(r->cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  }
+
+  while (1) {
+    if ((n = epoll_wait(r->epfd, evs, EV_MAXEVENTS, -1)) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      unix_error("epoll_wait error");
+    }
+    for (i = 0; i < n; i++) {
+      if (evs[i].data.ptr == NULL) {
+        accept_all(r);
+      } else {
+        dispatch(evs[i].data.ptr, evs[i].events);
+      }
+    }
+    // 파이프라인으로 받아 둔 다음 요청은 이벤트가 오지 않으므로 여기서 처리
+    // (처리하다 다시 들어올 수 있으므로 빌 때까지)
+    while ((c = r->ready) != NULL) {
+      r->ready = c->rnext;
+      c->queued = 0;
+      if (c->state == C_READREQ && c->buf) {
+        client_parse(c);
+      }
+    }
+    while ((c = r->dead) != NULL) {
+      r->dead = c->next;
+      Free(c);
+    }
+  }
+  return NULL;
+}
+
+/*
+ * nth_cpu - 이 프로세스가 쓸 수 있는 CPU 중 i 번째 (개수보다 크면 한 바퀴 돎)
+ */
+static int nth_cpu(cpu_set_t *set, int i) {
+  int cpu, n = CPU_COUNT(set);
+
+  if (n == 0) {
+    return -1;
+  }
+  i %= n;
+  for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    if (CPU_ISSET(cpu, set) && i-- == 0) {
+      return cpu;
+    }
+  }
+  return -1;
+}
+
+/*
+ * event_run - reactor 쓰레드 nreactors 개로 port 에서 프록시 실행 (돌아오지 않음)
+ *   reuseport 이면 reactor 마다 리슨 소켓을 따로 열고 CPU 에 고정,
+ *   아니면 리슨 소켓 하나를 모든 reactor 가 같이 씀
+ */
+void event_run(char *port, int nreactors, int reuseport) {
+  struct rlimit rl;
+  struct epoll_event ev;
+  cpu_set_t cpus;
+  reactor_t *r;
+  pthread_t tid;
+  int i, listenfd = -1;
+
+  // 연결 수만큼 fd 가 필요하므로 열 수 있는 fd 한도를 최대로
+  if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+  }
+  if (sched_getaffinity(0, sizeof(cpus), &cpus) < 0) {
+    CPU_ZERO(&cpus);
+  }
+  if (!reuseport) {
+    listenfd = Open_listenfd(port);
+  }
+
+  for (i = 0; i < nreactors; i++) {
+    r = Calloc(1, sizeof(reactor_t));
+    r->spare = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    if ((r->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+      unix_error("epoll_create1 error");
+    }
+    if (reuseport) {
+      r->listenfd = Open_listenfd_reuseport(port);
+      r->cpu = nth_cpu(&cpus, i);
+      ev.events = EPOLLIN;
+    } else {
+      r->listenfd = listenfd;
+      r->cpu = -1;
+      ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+    }
+    fcntl(r->listenfd, F_SETFL, fcntl(r->listenfd, F_GETFL) | O_NONBLOCK);
+    ev.data.ptr = NULL;
+    if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, r->listenfd, &ev) < 0) {
+      unix_error("epoll_ctl error");
+    }
+    if (i < nreactors - 1) {
+      Pthread_create(&tid, NULL, reactor, r);
+    }
+  }
+  // 마지막 reactor 는 main 쓰레드가 직접 돌림
+  reactor(r);
+}
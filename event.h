@@ -0,0 +1,19 @@
+/*
+ * event.h - epoll 기반 non-blocking 프록시 엔진
+ *
+ * 연결마다 쓰레드를 붙잡아 두는 대신, 소수의 reactor 쓰레드가 각자의
+ * epoll 인스턴스로 많은 연결을 상태 머신으로 돌린다. 느린 클라이언트나
+ * 멈춘 원격 서버는 쓰레드가 아니라 연결 구조체 하나만 차지한다.
+ */
+#ifndef __EVENT_H__
+#define __EVENT_H__
+
+#include "csapp.h"
+
+#define EV_BUFSIZE   8192   /* 연결 하나가 한 번에 붙잡을 수 있는 최대 버퍼 */
+#define EV_MAXEVENTS 256    /* epoll_wait 한 번에 받을 이벤트 수 */
+#define EV_REQ_MS    10000  /* accept 부터 요청 헤더를 다 받을 때까지 */
+
+void event_run(char *port, int nreactors, int reuseport);
+
+#endif /* __EVENT_H__ */
@@ -0,0 +1,317 @@
+/*
+ * httpparse.c - HTTP 요청/응답 헤더 블록 파서
+ *
+ * - 블록을 앞에서부터 한 번만 훑는다. 첫 줄은 ' ' 또는 LF 를, 헤더 줄은
+ *   ':' 또는 LF 를, 값은 LF 를 찾아 가며 조각을 자른다.
+ * - "두 문자 중 처음 나오는 것 찾기"(find2) 하나만 SIMD 로 구현한다.
+ *   16/32 바이트를 한 번에 두 문자와 비교하고, movemask 결과의 가장 낮은
+ *   비트가 처음 나온 위치다. 남은 꼬리 바이트는 scalar 로 본다.
+ * - 블록이 아직 다 오지 않았으면 0 을 돌려주고, 호출한 쪽이 더 읽은 뒤
+ *   처음부터 다시 파싱한다.
+ */
+#include <stddef.h>
+#include "httpparse.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HTTP_X86
+#endif
+
+typedef const char *(*find2_fn)(const char *p, const char *end, char a, char b);
+
+static find2_fn find2;
+static int isa = -1;
+static pthread_once_t isa_once = PTHREAD_ONCE_INIT;
+
+/*
+ * find2_scalar - [p, end) 에서 a 또는 b 가 처음 나오는 위치, 없으면 NULL
+ */
+static const char *find2_scalar(const char *p, const char *end, char a, char b) {
+  for (; p < end; p++) {
+    if (*p == a || *p == b) {
+      return p;
+    }
+  }
+  return NULL;
+}
+
+#ifdef HTTP_X86
+__attribute__((target("sse2")))
+static const char *find2_sse2(const char *p, const char *end, char a, char b) {
+  __m128i va = _mm_set1_epi8(a), vb = _mm_set1_epi8(b), v;
+  int mask;
+
+  while (end - p >= 16) {
+    v = _mm_loadu_si128((const __m128i *)p);
+    mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb)));
+    if (mask) {
+      return p + __builtin_ctz(mask);
+    }
+    p += 16;
+  }
+  return find2_scalar(p, end, a, b);
+}
+
+__attribute__((target("avx2")))
+static const char *find2_avx2(const char *p, const char *end, char a, char b) {
+  __m256i va = _mm256_set1_epi8(a), vb = _mm256_set1_epi8(b), v;
+  __m128i xa = _mm_set1_epi8(a), xb = _mm_set1_epi8(b), x;
+  unsigned int mask;
+
+  while (end - p >= 32) {
+    v = _mm256_loadu_si256((const __m256i *)p);
+    mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, va),
+                                                _mm256_cmpeq_epi8(v, vb)));
+    if (mask) {
+      return p + __builtin_ctz(mask);
+    }
+    p += 32;
+  }
+  // find2_sse2 를 부르면 AVX 와 SSE 명령이 섞여 전환 비용이 들므로
+  // 남은 16 바이트도 여기서 (VEX 인코딩으로) 비교
+  if (end - p >= 16) {
+    x = _mm_loadu_si128((const __m128i *)p);
+    mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(x, xa), _mm_cmpeq_epi8(x, xb)));
+    if (mask) {
+      return p + __builtin_ctz(mask);
+    }
+    p += 16;
+  }
+  return find2_scalar(p, end, a, b);
+}
+#endif
+
+/*
+ * http_set_isa - find2 구현 고르기. CPU 가 지원하지 않으면 지원하는 것 중 가장 좋은 것
+ * @return 실제로 고른 HTTP_ISA_*
+ */
+int http_set_isa(int want) {
+  isa = HTTP_ISA_SCALAR;
+  find2 = find2_scalar;
+#ifdef HTTP_X86
+  __builtin_cpu_init();
+  if (want >= HTTP_ISA_AVX2 && __builtin_cpu_supports("avx2")) {
+    isa = HTTP_ISA_AVX2;
+    find2 = find2_avx2;
+  } else if (want >= HTTP_ISA_SSE2 && __builtin_cpu_supports("sse2")) {
+    isa = HTTP_ISA_SSE2;
+    find2 = find2_sse2;
+  }
+#endif
+  return isa;
+}
+
+/*
+ * isa_init - 기본 구현 고르기
+ *   찾는 문자가 대개 몇십 바이트 안에 있어 32 바이트씩 비교해도 얻는 것이 없고,
+ *   parsebench 에서 AVX2 가 SSE2 보다 빠르지 않으므로 SSE2 를 기본으로 함
+ *   (AVX2 는 http_set_isa 로 직접 고를 때만 씀)
+ */
+static void isa_init(void) {
+  if (isa < 0) {
+    http_set_isa(HTTP_ISA_SSE2);
+  }
+}
+
+static http_slice_t slice(const char *base, const char *p, const char *q) {
+  http_slice_t s;
+
+  s.off = p - base;
+  s.len = q - p;
+  return s;
+}
+
+/*
+ * parse_head - 첫 줄과 헤더들을 파싱
+ * @return 블록 길이, 아직 다 오지 않았으면 0, 형식이 틀렸으면 -1
+ */
+static int parse_head(const char *buf, size_t n, http_msg_t *m, int response) {
+  const char *p = buf, *end = buf + n, *lf, *eol, *sp, *sp2, *q, *v, *ve;
+  http_header_t *h;
+
+  pthread_once(&isa_once, isa_init);
+  memset(m, 0, offsetof(http_msg_t, headers));
+  m->base = buf;
+
+  // 요청 앞의 빈 줄은 무시 (keep-alive 클라이언트가 요청 사이에 CRLF 를 더 보내기도 함)
+  if (!response) {
+    while (p < end && (*p == '\r' || *p == '\n')) {
+      p++;
+    }
+  }
+
+  // 첫 줄: "METHOD URI VERSION" 또는 "VERSION STATUS REASON"
+  if ((lf = find2(p, end, '\n', '\n')) == NULL) {
+    return 0;
+  }
+  eol = (lf > p && lf[-1] == '\r') ? lf - 1 : lf;
+  m->line = slice(buf, p, eol);
+  if ((sp = find2(p, eol, ' ', ' ')) == NULL || sp == p) {
+    return -1;
+  }
+  if (response) {
+    m->version = slice(buf, p, sp);
+    for (q = sp + 1; q < eol && *q >= '0' && *q <= '9'; q++) {
+      m->status = m->status * 10 + (*q - '0');
+    }
+    if (q - sp != 4) {
+      return -1;
+    }
+    m->reason = slice(buf, q < eol ? q + 1 : q, eol);
+  } else {
+    m->method = slice(buf, p, sp);
+    if ((sp2 = find2(sp + 1, eol, ' ', ' ')) == NULL || sp2 == sp + 1) {
+      return -1;
+    }
+    m->uri = slice(buf, sp + 1, sp2);
+    m->version = slice(buf, sp2 + 1, eol);
+  }
+  if (m->version.len < 8 || strncmp(HTTP_PTR(m, m->version), "HTTP/", 5)) {
+    return -1;
+  }
+  p = lf + 1;
+
+  // 헤더: 빈 줄이 나올 때까지 "name: value"
+  while (1) {
+    if (p >= end) {
+      return 0;
+    }
+    if (*p == '\n') {
+      p++;
+      break;
+    }
+    if (*p == '\r') {
+      if (p + 1 >= end) {
+        return 0;
+      }
+      if (p[1] != '\n') {
+        return -1;
+      }
+      p += 2;
+      break;
+    }
+    // 이름 끝 ':' 을 찾다가 줄 끝이 먼저 나오면 틀린 줄
+    if ((q = find2(p, end, ':', '\n')) == NULL) {
+      return 0;
+    }
+    if (*q == '\n' || q == p || q[-1] == ' ' || *p == ' ' || *p == '\t') {
+      return -1;
+    }
+    if ((lf = find2(q + 1, end, '\n', '\n')) == NULL) {
+      return 0;
+    }
+    if (m->nheaders == HTTP_MAXHDRS) {
+      return -1;
+    }
+    eol = lf[-1] == '\r' ? lf - 1 : lf;
+    for (v = q + 1; v < eol && (*v == ' ' || *v == '\t'); v++)
+      ;
+    for (ve = eol; ve > v && (ve[-1] == ' ' || ve[-1] == '\t'); ve--)
+      ;
+    h = &m->headers[m->nheaders++];
+    h->name = slice(buf, p, q);
+    h->value = slice(buf, v, ve);
+    p = lf + 1;
+  }
+
+  m->len = p - buf;
+  return m->len;
+}
+
+/*
+ * http_parse_request - buf 의 요청 헤더 블록 파싱
+ * @return 블록 길이, 아직 다 오지 않았으면 0, 형식이 틀렸으면 -1
+ */
+int http_parse_request(const char *buf, size_t n, http_msg_t *m) {
+  return parse_head(buf, n, m, 0);
+}
+
+/*
+ * http_parse_response - buf 의 응답 헤더 블록 파싱
+ * @return 블록 길이, 아직 다 오지 않았으면 0, 형식이 틀렸으면 -1
+ */
+int http_parse_response(const char *buf, size_t n, http_msg_t *m) {
+  return parse_head(buf, n, m, 1);
+}
+
+/*
+ * http_read_head - rio 버퍼에 헤더 블록이 다 들어올 때까지 읽고 파싱
+ *   파싱한 블록만큼 rio 를 앞으로 옮김
+ * @return 블록 길이, 한 바이트도 오기 전에 EOF 면 0,
+ *         에러/중간에 EOF/형식 오류/블록이 RIO_BUFSIZE 보다 크면 -1
+ */
+ssize_t http_read_head(rio_t *rp, http_msg_t *m, int response) {
+  ssize_t n;
+  int rc;
+
+  while (1) {
+    if (rp->rio_cnt > 0) {
+      rc = parse_head(rp->rio_bufptr, rp->rio_cnt, m, response);
+      if (rc < 0) {
+        return -1;
+      }
+      if (rc > 0) {
+        rp->rio_bufptr += rc;
+        rp->rio_cnt -= rc;
+        return rc;
+      }
+    }
+
+    // 아직 덜 왔음: 남은 바이트를 버퍼 앞으로 옮기고 그 뒤에 이어서 읽음
+    if (rp->rio_bufptr != rp->rio_buf) {
+      memmove(rp->rio_buf, rp->rio_bufptr, rp->rio_cnt);
+      rp->rio_bufptr = rp->rio_buf;
+    }
+    if (rp->rio_cnt == RIO_BUFSIZE) {
+      return -1;
+    }
+    n = read(rp->rio_fd, rp->rio_buf + rp->rio_cnt, RIO_BUFSIZE - rp->rio_cnt);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return (n == 0 && rp->rio_cnt == 0) ? 0 : -1;
+    }
+    rp->rio_cnt += n;
+  }
+}
+
+/*
+ * http_find_header - 이름이 name 인 첫 헤더 (대소문자 무시), 없으면 NULL
+ */
+http_header_t *http_find_header(http_msg_t *m, const char *name) {
+  int i;
+
+  for (i = 0; i < m->nheaders; i++) {
+    if (http_slice_is(m, m->headers[i].name, name)) {
+      return &m->headers[i];
+    }
+  }
+  return NULL;
+}
+
+/*
+ * http_has_token - "a, b, c" 꼴의 헤더 값에 token 이 있는지 (대소문자 무시)
+ */
+int http_has_token(http_msg_t *m, http_slice_t value, const char *token) {
+  const char *p = HTTP_PTR(m, value), *end = p + value.len, *q;
+  size_t n = strlen(token);
+
+  while (p < end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == ',')) {
+      p++;
+    }
+    for (q = p; q < end && *q != ','; q++)
+      ;
+    while (q > p && (q[-1] == ' ' || q[-1] == '\t')) {
+      q--;
+    }
+    if ((size_t)(q - p) == n && !strncasecmp(p, token, n)) {
+      return 1;
+    }
+    while (p < end && *p != ',') {
+      p++;
+    }
+  }
+  return 0;
+}
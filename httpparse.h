@@ -0,0 +1,100 @@
+/*
+ * httpparse.h - HTTP 요청/응답 헤더 블록 파서
+ *
+ * 요청 줄(또는 상태 줄)과 헤더들을 한 번에 파싱해서, 각 부분을 원래 버퍼
+ * 안의 (offset, length) 조각으로 돌려준다. 문자열을 복사하지 않는다.
+ *
+ * 줄 끝(LF), ':' , 공백을 찾는 일은 CPU 가 지원하면 AVX2(32 바이트) 또는
+ * SSE2(16 바이트) 비교로 한꺼번에 하고, x86 이 아니면 바이트 단위로 한다.
+ * 어떤 구현을 쓸지는 처음 파싱할 때 한 번 정한다.
+ *
+ * http_read_head 는 rio 버퍼에 헤더 블록이 다 들어올 때까지 read 해서
+ * 파싱한다. 헤더 블록은 RIO_BUFSIZE 안에 들어와야 한다. 파싱이 끝나면 rio
+ * 는 바디(또는 파이프라인으로 온 다음 요청) 첫 바이트를 가리키고, 조각들은
+ * 같은 rio 로 다음 read 를 하기 전까지 유효하다.
+ */
+#ifndef __HTTPPARSE_H__
+#define __HTTPPARSE_H__
+
+#include "csapp.h"
+
+#define HTTP_MAXHDRS 64     /* 파싱할 수 있는 최대 헤더 수 */
+
+/* 명령어 집합 */
+#define HTTP_ISA_SCALAR 0
+#define HTTP_ISA_SSE2   1
+#define HTTP_ISA_AVX2   2
+
+/* base 로부터의 위치와 길이 */
+typedef struct {
+  unsigned int off, len;
+} http_slice_t;
+
+typedef struct {
+  http_slice_t name, value;     /* value 는 앞뒤 공백을 뺀 것 */
+} http_header_t;
+
+/* 파싱한 헤더 블록 하나 */
+typedef struct {
+  const char *base;             /* 조각들의 기준 위치 (블록 첫 바이트) */
+  size_t len;                   /* 마지막 빈 줄까지 포함한 블록 길이 */
+  http_slice_t line;            /* 첫 줄 전체 (줄 끝 제외) */
+  http_slice_t method, uri;     /* 요청 */
+  int status;                   /* 응답 상태 코드 */
+  http_slice_t reason;          /* 응답 */
+  http_slice_t version;         /* "HTTP/1.x" */
+  int nheaders;
+  http_header_t headers[HTTP_MAXHDRS];
+} http_msg_t;
+
+/* 조각의 시작 주소 */
+#define HTTP_PTR(m, s) ((m)->base + (s).off)
+
+/* 버퍼 안의 문자열 (NUL 로 끝나지 않음). 출력은 "%.*s", v.len, v.p */
+typedef struct {
+  const char *p;
+  int len;
+} view_t;
+
+static inline view_t http_view(const http_msg_t *m, http_slice_t s) {
+  view_t v;
+
+  v.p = HTTP_PTR(m, s);
+  v.len = s.len;
+  return v;
+}
+
+/*
+ * view_is - v 가 문자열 s 와 같은지 (대소문자 무시)
+ */
+static inline int view_is(view_t v, const char *s) {
+  return strlen(s) == (size_t)v.len && !strncasecmp(v.p, s, v.len);
+}
+
+/*
+ * view_cstr - NUL 로 끝나는 문자열이 꼭 필요한 곳(getaddrinfo 등)을 위해 dst 에 복사
+ *   size 보다 길면 잘림
+ */
+static inline char *view_cstr(char *dst, size_t size, view_t v) {
+  size_t n = (size_t)v.len < size - 1 ? (size_t)v.len : size - 1;
+
+  memcpy(dst, v.p, n);
+  dst[n] = '\0';
+  return dst;
+}
+
+/*
+ * http_slice_is - 조각이 문자열 s 와 같은지 (대소문자 무시)
+ */
+static inline int http_slice_is(const http_msg_t *m, http_slice_t sl, const char *s) {
+  return strlen(s) == sl.len && !strncasecmp(HTTP_PTR(m, sl), s, sl.len);
+}
+
+int http_parse_request(const char *buf, size_t n, http_msg_t *m);
+int http_parse_response(const char *buf, size_t n, http_msg_t *m);
+ssize_t http_read_head(rio_t *rp, http_msg_t *m, int response);
+http_header_t *http_find_header(http_msg_t *m, const char *name);
+int http_has_token(http_msg_t *m, http_slice_t value, const char *token);
+int http_set_isa(int isa);
+
+#endif /* __HTTPPARSE_H__ */
@@ -0,0 +1,168 @@
+/*
+ * idle.c - keep-alive 로 쉬는 클라이언트 연결을 모아서 기다리는 쓰레드
+ *
+ * - 연결마다 EPOLLONESHOT 으로 등록하므로 이벤트는 한 번만 오고, 그 뒤로는
+ *   워커가 연결을 가져갈 때까지 이 쓰레드가 다시 건드리지 않는다.
+ * - 모두 같은 시간을 기다리므로 맡은 순서대로 이중 연결 리스트에 두면 앞쪽이
+ *   항상 먼저 만료된다. 만료 처리는 앞에서부터 보면 된다.
+ * - 목록은 mutex 하나로 보호한다. 워커는 맡길 때만, 이 쓰레드는 목록에서
+ *   뺄 때만 잡는다.
+ */
+#include <sys/epoll.h>
+#include "idle.h"
+#include "stats.h"
+
+/* 쉬는 연결 하나 */
+typedef struct idle_conn {
+  int fd;
+  long long since;              /* 맡은 시각 (ms) */
+  struct idle_conn *prev, *next;
+} idle_conn_t;
+
+static struct {
+  int epfd;
+  sbuf_t *sp;                   /* 다음 요청이 온 연결을 넣을 큐 */
+  pthread_mutex_t lock;         /* 아래 목록 보호 */
+  idle_conn_t *head, *tail;     /* 맡은 순서 (앞이 가장 오래됨) */
+} idle = {-1, NULL, PTHREAD_MUTEX_INITIALIZER, NULL, NULL};
+
+static long long now_ms(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+/*
+ * unlink_conn - 목록에서 빼기 (lock 잡고 호출)
+ */
+static void unlink_conn(idle_conn_t *ic) {
+  if (ic->prev) {
+    ic->prev->next = ic->next;
+  } else {
+    idle.head = ic->next;
+  }
+  if (ic->next) {
+    ic->next->prev = ic->prev;
+  } else {
+    idle.tail = ic->prev;
+  }
+}
+
+/*
+ * drop - 등록을 풀고 연결을 닫음
+ */
+static void drop(idle_conn_t *ic) {
+  epoll_ctl(idle.epfd, EPOLL_CTL_DEL, ic->fd, NULL);
+  close(ic->fd);
+  Free(ic);
+}
+
+/*
+ * waiter - 다음 요청이 온 연결은 큐로 돌려보내고, 오래 쉰 연결은 닫는 쓰레드
+ */
+static void *waiter(void *vargp) {
+  struct epoll_event evs[IDLE_EVENTS];
+  idle_conn_t *ic, *expired;
+  sbuf_item_t item;
+  long long t;
+  int i, n, timeout;
+
+  Pthread_detach(pthread_self());
+  while (1) {
+    // 가장 오래된 연결이 만료될 때까지, 쉬는 연결이 없으면 새로 맡는 연결이
+    // 늦어도 IDLE_TIMEOUT 의 한 번 안에 검사되도록 1 초씩
+    pthread_mutex_lock(&idle.lock);
+    timeout = idle.head ? (int)(idle.head->since + IDLE_TIMEOUT - now_ms()) : 1000;
+    pthread_mutex_unlock(&idle.lock);
+    if (timeout < 0) {
+      timeout = 0;
+    }
+    if ((n = epoll_wait(idle.epfd, evs, IDLE_EVENTS, timeout)) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      unix_error("epoll_wait error");
+    }
+
+    for (i = 0; i < n; i++) {
+      ic = evs[i].data.ptr;
+      pthread_mutex_lock(&idle.lock);
+      unlink_conn(ic);
+      pthread_mutex_unlock(&idle.lock);
+      // 읽을 것이 없이 끊기기만 했으면 닫고, 아니면 워커가 읽게 함 (EOF 도 워커가 봄)
+      if (!(evs[i].events & EPOLLIN)) {
+        drop(ic);
+        continue;
+      }
+      epoll_ctl(idle.epfd, EPOLL_CTL_DEL, ic->fd, NULL);
+      item.fd = ic->fd;
+      item.accepted = stats_now();
+      Free(ic);
+      // 이미 받아 준 연결이므로 큐에 자리가 날 때까지 기다림
+      sbuf_insert(idle.sp, item);
+    }
+
+    // 앞에서부터 만료된 연결을 떼어 내고 lock 밖에서 닫음
+    expired = NULL;
+    t = now_ms();
+    pthread_mutex_lock(&idle.lock);
+    while ((ic = idle.head) != NULL && t - ic->since >= IDLE_TIMEOUT) {
+      unlink_conn(ic);
+      ic->next = expired;
+      expired = ic;
+    }
+    pthread_mutex_unlock(&idle.lock);
+    while ((ic = expired) != NULL) {
+      expired = ic->next;
+      drop(ic);
+    }
+  }
+  return NULL;
+}
+
+/*
+ * idle_init - 쉬는 연결을 지켜볼 쓰레드 시작, 다음 요청이 온 연결은 sp 에 넣음
+ */
+void idle_init(sbuf_t *sp) {
+  pthread_t tid;
+
+  if ((idle.epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+    unix_error("epoll_create1 error");
+  }
+  idle.sp = sp;
+  Pthread_create(&tid, NULL, waiter, NULL);
+}
+
+/*
+ * idle_park - 응답을 다 보낸 keep-alive 연결 fd 를 다음 요청이 올 때까지 맡김
+ *   이 뒤로 fd 는 쓰지 않음 (큐에서 다시 꺼낸 워커가 이어서 처리)
+ */
+void idle_park(int fd) {
+  idle_conn_t *ic = Malloc(sizeof(idle_conn_t));
+  struct epoll_event ev;
+
+  ic->fd = fd;
+  ic->since = now_ms();
+  ic->next = NULL;
+  // 이벤트가 목록에 넣기 전에 오지 않도록 먼저 넣고 등록
+  pthread_mutex_lock(&idle.lock);
+  ic->prev = idle.tail;
+  if (idle.tail) {
+    idle.tail->next = ic;
+  } else {
+    idle.head = ic;
+  }
+  idle.tail = ic;
+  pthread_mutex_unlock(&idle.lock);
+
+  ev.events = EPOLLIN | EPOLLONESHOT;
+  ev.data.ptr = ic;
+  if (epoll_ctl(idle.epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+    pthread_mutex_lock(&idle.lock);
+    unlink_conn(ic);
+    pthread_mutex_unlock(&idle.lock);
+    close(fd);
+    Free(ic);
+  }
+}
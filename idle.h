@@ -0,0 +1,22 @@
+/*
+ * idle.h - keep-alive 로 쉬는 클라이언트 연결을 모아서 기다리는 쓰레드
+ *
+ * 쓰레드 엔진의 워커는 응답을 보낸 뒤 다음 요청이 아직 오지 않은 keep-alive
+ * 연결을 idle_park 로 넘기고 바로 큐의 다음 연결을 처리한다. 쓰레드 하나가
+ * epoll 로 이 연결들을 지켜보다가 다음 요청이 도착하면 연결을 다시 sbuf 큐에
+ * 넣고, IDLE_TIMEOUT 동안 아무것도 오지 않았거나 클라이언트가 끊었으면 닫는다.
+ * 쉬는 클라이언트는 워커 쓰레드가 아니라 작은 항목 하나만 차지한다.
+ */
+#ifndef __IDLE_H__
+#define __IDLE_H__
+
+#include "csapp.h"
+#include "sbuf.h"
+
+#define IDLE_TIMEOUT 5000   /* keep-alive 클라이언트의 다음 요청을 기다리는 시간 (ms) */
+#define IDLE_EVENTS  256    /* epoll_wait 한 번에 받을 이벤트 수 */
+
+void idle_init(sbuf_t *sp);
+void idle_park(int fd);
+
+#endif /* __IDLE_H__ */
@@ -0,0 +1,312 @@
+/*
+ * log.c - 비동기 접근 로그
+ *
+ * - 링의 head 는 주인 쓰레드만, tail 은 로그 쓰레드만 쓴다. 주인 쓰레드는
+ *   레코드를 다 채운 뒤 head 를 release 로 올리고, 로그 쓰레드는 head 를
+ *   acquire 로 읽은 다음 그 앞까지의 레코드만 읽는다. lock 이 없다.
+ * - 링은 쓰레드가 처음 로그를 남길 때 만들어서 전역 목록에 붙인다. 목록을
+ *   건드릴 때만 mutex 를 잡는다 (쓰레드마다 한 번).
+ * - 로그 쓰레드는 모든 링을 비우면서 LOG_OUTBUF 크기 버퍼에 글자로 모으고,
+ *   버퍼가 차거나 다 비웠을 때 write 한다.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include "log.h"
+
+#define LOG_OUTBUF 65536    /* 로그 쓰레드가 한 번에 write 하는 최대 바이트 */
+
+/* 레코드 종류 */
+#define REC_TEXT   0        /* log_msg */
+#define REC_ACCESS 1        /* log_access */
+
+/* 링에 들어가는 고정 크기 레코드 */
+typedef struct {
+  long long ns;                 /* 기록한 시각 (CLOCK_REALTIME) */
+  long long bytes;              /* 접근 로그: 클라이언트에게 보낸 바이트 */
+  long usec;                    /* 접근 로그: 처리 시간 */
+  short kind, level;
+  int status;                   /* 접근 로그: 응답 상태 코드 */
+  char method[8];
+  char result[8];               /* 접근 로그: HIT, MISS 등 */
+  int len;                      /* text 길이 */
+  char text[LOG_TEXTLEN];       /* 메시지 또는 uri */
+} log_rec_t;
+
+typedef struct log_ring {
+  _Alignas(64) atomic_uint head;    /* 다음에 쓸 자리 (주인 쓰레드) */
+  _Alignas(64) atomic_uint tail;    /* 다음에 읽을 자리 (로그 쓰레드) */
+  atomic_ulong dropped;         /* 링이 꽉 차서 버린 레코드 수 */
+  unsigned long reported;       /* 로그 쓰레드가 마지막으로 알린 dropped */
+  unsigned int pos, end;        /* log_flush 가 이번에 읽을 [pos, end) */
+  int id;
+  struct log_ring *next;
+  log_rec_t recs[LOG_RING];
+} log_ring_t;
+
+int log_level = LOG_INFO;
+
+static struct {
+  int fd;
+  pthread_mutex_t lock;         /* rings 목록 */
+  pthread_mutex_t drain;        /* 링을 비우는 쪽은 한 번에 하나 */
+  log_ring_t *rings;
+  int nrings;
+  char out[LOG_OUTBUF];
+  size_t outlen;
+  time_t sec;                   /* stamp 를 만든 초 */
+  char stamp[32];               /* "YYYY-mm-dd HH:MM:SS" */
+} lg = {1, PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER};
+
+static __thread log_ring_t *my_ring;
+
+static const char *level_name[] = {"ERROR", "INFO", "DEBUG"};
+
+/*
+ * ring - 이 쓰레드의 링, 처음이면 만들어서 목록에 붙임
+ */
+static log_ring_t *ring(void) {
+  log_ring_t *r = my_ring;
+
+  if (r) {
+    return r;
+  }
+  if ((r = calloc(1, sizeof(log_ring_t))) == NULL) {
+    return NULL;
+  }
+  pthread_mutex_lock(&lg.lock);
+  r->id = lg.nrings++;
+  r->next = lg.rings;
+  lg.rings = r;
+  pthread_mutex_unlock(&lg.lock);
+  return my_ring = r;
+}
+
+/*
+ * reserve - 링에서 채울 레코드 자리 하나, 꽉 찼으면 버린 개수를 세고 NULL
+ *   채운 뒤 commit 을 불러야 로그 쓰레드가 읽음
+ */
+static log_rec_t *reserve(log_ring_t *r) {
+  unsigned int h = atomic_load_explicit(&r->head, memory_order_relaxed);
+  unsigned int t = atomic_load_explicit(&r->tail, memory_order_acquire);
+  struct timespec ts;
+  log_rec_t *rec;
+
+  if (h - t == LOG_RING) {
+    atomic_fetch_add_explicit(&r->dropped, 1, memory_order_relaxed);
+    return NULL;
+  }
+  rec = &r->recs[h & (LOG_RING - 1)];
+  clock_gettime(CLOCK_REALTIME, &ts);
+  rec->ns = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+  return rec;
+}
+
+static void commit(log_ring_t *r) {
+  unsigned int h = atomic_load_explicit(&r->head, memory_order_relaxed);
+
+  atomic_store_explicit(&r->head, h + 1, memory_order_release);
+}
+
+/*
+ * log_msg - 메시지 하나 기록 (보통 LOG 매크로로 부름)
+ */
+void log_msg(int level, const char *fmt, ...) {
+  log_ring_t *r;
+  log_rec_t *rec;
+  va_list ap;
+  int n;
+
+  if (level > log_level || (r = ring()) == NULL || (rec = reserve(r)) == NULL) {
+    return;
+  }
+  rec->kind = REC_TEXT;
+  rec->level = level;
+  va_start(ap, fmt);
+  n = vsnprintf(rec->text, LOG_TEXTLEN, fmt, ap);
+  va_end(ap);
+  rec->len = n < 0 ? 0 : n < LOG_TEXTLEN ? n : LOG_TEXTLEN - 1;
+  commit(r);
+}
+
+/*
+ * log_access - 요청 하나의 접근 로그 기록. 필드만 복사하고 글자로 바꾸지 않음
+ */
+void log_access(const char *method, int methodlen, const char *uri, int urilen,
+                int status, long long bytes, long usec, const char *result) {
+  log_ring_t *r;
+  log_rec_t *rec;
+
+  if (LOG_INFO > log_level || (r = ring()) == NULL || (rec = reserve(r)) == NULL) {
+    return;
+  }
+  rec->kind = REC_ACCESS;
+  rec->level = LOG_INFO;
+  rec->status = status;
+  rec->bytes = bytes;
+  rec->usec = usec;
+  if (methodlen >= (int)sizeof(rec->method)) {
+    methodlen = sizeof(rec->method) - 1;
+  }
+  memcpy(rec->method, method, methodlen);
+  rec->method[methodlen] = '\0';
+  strncpy(rec->result, result, sizeof(rec->result) - 1);
+  rec->result[sizeof(rec->result) - 1] = '\0';
+  rec->len = urilen < LOG_TEXTLEN ? urilen : LOG_TEXTLEN;
+  memcpy(rec->text, uri, rec->len);
+  commit(r);
+}
+
+/*
+ * out_write - 모아 둔 출력을 fd 에 씀 (drain 잡고 호출)
+ */
+static void out_write(void) {
+  char *p = lg.out;
+  ssize_t n;
+
+  while (lg.outlen > 0) {
+    if ((n = write(lg.fd, p, lg.outlen)) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;    /* 로그를 못 쓰는 것 때문에 서버를 멈추지는 않음 */
+    }
+    p += n;
+    lg.outlen -= n;
+  }
+  lg.outlen = 0;
+}
+
+/*
+ * format - 레코드 하나를 출력 버퍼에 한 줄로 붙임 (drain 잡고 호출)
+ */
+static void format(log_ring_t *r, log_rec_t *rec) {
+  time_t sec = rec->ns / 1000000000LL;
+  struct tm tm;
+  char *p;
+  int n;
+
+  if (LOG_OUTBUF - lg.outlen < LOG_TEXTLEN + 128) {
+    out_write();
+  }
+  if (sec != lg.sec) {
+    localtime_r(&sec, &tm);
+    strftime(lg.stamp, sizeof(lg.stamp), "%Y-%m-%d %H:%M:%S", &tm);
+    lg.sec = sec;
+  }
+  p = lg.out + lg.outlen;
+  if (rec->kind == REC_ACCESS) {
+    n = sprintf(p, "%s.%03lld [t%d] %s %.*s %d %lld %ldus %s\n", lg.stamp,
+                rec->ns / 1000000 % 1000, r->id, rec->method, rec->len, rec->text,
+                rec->status, rec->bytes, rec->usec, rec->result);
+  } else {
+    n = sprintf(p, "%s.%03lld [t%d] %s %.*s\n", lg.stamp, rec->ns / 1000000 % 1000, r->id,
+                level_name[rec->level], rec->len, rec->text);
+  }
+  lg.outlen += n;
+}
+
+/*
+ * report_dropped - 링이 꽉 차서 버린 레코드가 새로 생겼으면 알림 (drain 잡고 호출)
+ */
+static void report_dropped(log_ring_t *r) {
+  unsigned long dropped = atomic_load_explicit(&r->dropped, memory_order_relaxed);
+
+  if (dropped == r->reported) {
+    return;
+  }
+  if (LOG_OUTBUF - lg.outlen < 128) {
+    out_write();
+  }
+  lg.outlen += sprintf(lg.out + lg.outlen, "log: [t%d] ring full, dropped %lu records\n",
+                       r->id, dropped - r->reported);
+  r->reported = dropped;
+}
+
+/*
+ * log_flush - 모든 링을 비워서 지금까지 기록된 것을 시각 순서대로 출력
+ *   링마다 이미 시각 순이므로 각 링의 맨 앞 레코드 중 가장 이른 것을 골라 나감
+ */
+void log_flush(void) {
+  log_ring_t *first, *r, *best;
+  unsigned int t;
+
+  pthread_mutex_lock(&lg.drain);
+  pthread_mutex_lock(&lg.lock);
+  first = lg.rings;
+  pthread_mutex_unlock(&lg.lock);
+
+  // 목록은 앞에만 붙으므로 잡아 둔 머리부터는 lock 없이 따라가도 됨
+  for (r = first; r; r = r->next) {
+    r->end = atomic_load_explicit(&r->head, memory_order_acquire);
+    r->pos = atomic_load_explicit(&r->tail, memory_order_relaxed);
+  }
+  best = first;
+
+  while (best) {
+    best = NULL;
+    for (r = first; r; r = r->next) {
+      if (r->pos != r->end &&
+          (!best || r->recs[r->pos & (LOG_RING - 1)].ns <
+                    best->recs[best->pos & (LOG_RING - 1)].ns)) {
+        best = r;
+      }
+    }
+    if (best) {
+      t = best->pos++;
+      format(best, &best->recs[t & (LOG_RING - 1)]);
+    }
+  }
+
+  for (r = first; r; r = r->next) {
+    atomic_store_explicit(&r->tail, r->pos, memory_order_release);
+    report_dropped(r);
+  }
+  out_write();
+  pthread_mutex_unlock(&lg.drain);
+}
+
+static void *logger(void *vargp) {
+  struct timespec ts = {0, LOG_FLUSH_MS * 1000000L};
+
+  pthread_detach(pthread_self());
+  while (1) {
+    nanosleep(&ts, NULL);
+    log_flush();
+  }
+  return NULL;
+}
+
+/*
+ * log_init - 레벨을 정하고 fd 로 출력하는 로그 쓰레드 시작, main 에서 한 번 호출
+ */
+void log_init(int level, int fd) {
+  pthread_t tid;
+
+  log_level = level;
+  lg.fd = fd;
+  if (pthread_create(&tid, NULL, logger, NULL) != 0) {
+    fprintf(stderr, "log: pthread_create failed\n");
+    exit(1);
+  }
+}
+
+/*
+ * log_parse_level - "error", "info", "debug" 를 LOG_* 로, 모르는 이름이면 -1
+ */
+int log_parse_level(const char *name) {
+  int i;
+
+  for (i = LOG_ERROR; i <= LOG_DEBUG; i++) {
+    if (!strcasecmp(name, level_name[i])) {
+      return i;
+    }
+  }
+  return -1;
+}
@@ -0,0 +1,50 @@
+/*
+ * log.h - 비동기 접근 로그
+ *
+ * 워커 쓰레드는 stdio 를 직접 부르지 않는다. 쓰레드마다 고정 크기 레코드
+ * LOG_RING 개짜리 SPSC 링을 하나씩 갖고, 레코드를 채워 넣기만 한다. 링을
+ * 비우고 글자로 바꿔서 출력하는 일은 로그 쓰레드 하나가 LOG_FLUSH_MS 마다
+ * 모아서 한 번의 write 로 한다.
+ *
+ * - 링이 꽉 차 있으면 기다리지 않고 레코드를 버린 뒤 개수만 센다. 버린
+ *   개수는 로그 쓰레드가 다음 출력 때 함께 알린다.
+ * - 레벨은 시작할 때 정한다. LOG() 는 레벨을 먼저 보고 꺼져 있으면 인자도
+ *   계산하지 않으므로, 헤더 덤프 같은 debug 로그는 production 에서 비용이 없다.
+ * - 접근 로그(log_access)는 요청마다 필드를 그대로 복사해 두고 글자로
+ *   바꾸는 일은 로그 쓰레드가 한다. 그 밖의 메시지(LOG)는 부른 쓰레드에서
+ *   vsnprintf 로 만든다.
+ *
+ * csapp.h 없이 쓸 수 있어서 proxy 와 tiny 가 같이 쓴다.
+ */
+#ifndef __LOG_H__
+#define __LOG_H__
+
+#include <stdarg.h>
+
+/* 로그 레벨 */
+#define LOG_ERROR 0     /* 에러만 */
+#define LOG_INFO  1     /* + 요청마다 접근 로그 한 줄 */
+#define LOG_DEBUG 2     /* + 연결, 요청 줄, 헤더, uri 파싱 결과 */
+
+#define LOG_RING     1024   /* 쓰레드 하나의 링 크기 (레코드 수, 2 의 거듭제곱) */
+#define LOG_TEXTLEN  192    /* 레코드 하나에 담는 메시지/uri 최대 길이, 넘으면 잘림 */
+#define LOG_FLUSH_MS 50     /* 로그 쓰레드가 링을 비우는 주기 */
+
+extern int log_level;
+
+/* level 이 켜져 있을 때만 인자를 계산해서 기록 */
+#define LOG(level, ...)                 \
+  do {                                  \
+    if ((level) <= log_level) {         \
+      log_msg((level), __VA_ARGS__);    \
+    }                                   \
+  } while (0)
+
+void log_init(int level, int fd);
+int log_parse_level(const char *name);
+void log_msg(int level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+void log_access(const char *method, int methodlen, const char *uri, int urilen,
+                int status, long long bytes, long usec, const char *result);
+void log_flush(void);
+
+#endif /* __LOG_H__ */
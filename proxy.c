@@ -1,208 +1,890 @@
+#define _GNU_SOURCE
 #include <stdio.h>
+#include <poll.h>
+#include <sys/uio.h>
+#include <netinet/tcp.h>
 #include "csapp.h"
-
-/* Recommended max cache and object sizes */
-#define MAX_CACHE_SIZE 1049000
-#define MAX_OBJECT_SIZE 102400
+#include "cache.h"
+#include "relay.h"
+#include "sbuf.h"
+#include "proxy.h"
+#include "event.h"
+#include "dnscache.h"
+#include "upstream.h"
+#include "deadline.h"
+#include "httpparse.h"
+#include "log.h"
+#include "idle.h"
 
 /* You won't lose style points for including this long line in your code */
 static const char *user_agent_hdr =
     "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:10.0.3) Gecko/20120305 "
     "Firefox/10.0.3\r\n";
 
+/* 워커 쓰레드 풀 기본값 */
+#define NTHREADS 16     /* 워커 쓰레드 수 */
+#define SBUFSIZE 256    /* 연결 대기 큐 크기 */
+
+#define CLIENT_HEAD_MS 10000  /* 요청을 읽기 시작해서 헤더를 다 받을 때까지 (ms) */
+
+/* 동시성 엔진 */
+#define ENGINE_THREAD 0     /* 워커 쓰레드 풀 + blocking I/O */
+#define ENGINE_EPOLL  1     /* reactor 쓰레드 + epoll 상태 머신 (event.c) */
+
+/* 대기 큐가 꽉 찼을 때의 동작 */
+#define OVERLOAD_BLOCK  0   /* 자리가 날 때까지 accept 를 멈춤 */
+#define OVERLOAD_REJECT 1   /* 503 으로 바로 거절 */
+
 /* prototypes */
-void doit(int fd);
+int doit(int fd, rio_t *rp, long long ready);
 void *thread(void *vargp);
-void read_requesthdrs(rio_t *rp);
-int parse_uri(char *uri, char *hostname, char *pathname, char *port);
-
-void clienterror(int fd, char *cause, char *errnum, char *shortmsg, char *longmsg);
+int wait_request(int fd, rio_t *rp);
+int forward_request(int clientfd, request_t *req, flight_t *fl, int keepalive);
+int serve_flight(int clientfd, flight_t *fl, int keepalive, request_t *req);
+int serve_stats(int fd, int json, int keepalive, request_t *req);
+int send_head(int fd, char *hdr, size_t n, char *body, size_t bodylen, int keepalive);
+int send_object(int fd, char *data, size_t size, int keepalive);
+
+sbuf_t sbuf;  /* accept 한 연결 fd 를 워커에게 넘기는 큐 */
+
+void usage(char *prog) {
+  fprintf(stderr, "usage: %s [-e thread|epoll] [-t threads] [-q queue] [-o block|reject] "
+          "[-k on|off] [-r reactors] [-R] [-l error|info|debug] <port>\n", prog);
+  exit(1);
+}
 
 int main(int argc, char **argv) {
-  int listenfd, *connfd;
+  int listenfd, connfd, c, i;
+  sbuf_item_t item;
+  int engine = ENGINE_THREAD, nreactors = sysconf(_SC_NPROCESSORS_ONLN), reuseport = 0;
+  int nthreads = NTHREADS, qsize = SBUFSIZE, overload = OVERLOAD_BLOCK, keepalive = 1;
+  int level = LOG_INFO;
   char hostname[MAXLINE], port[MAXLINE];
   socklen_t clientlen;
   struct sockaddr_storage clientaddr;
   pthread_t tid;
 
+  // 옵션 파싱: 엔진, 워커 수, 대기 큐 크기, 과부하 동작, 원격 서버 keep-alive,
+  // reactor 수, reactor 마다 SO_REUSEPORT 리슨 소켓 + CPU 고정, 로그 레벨
+  while ((c = getopt(argc, argv, "e:t:q:o:k:r:Rl:")) != -1) {
+    switch (c) {
+    case 'e':
+      if (!strcmp(optarg, "thread")) {
+        engine = ENGINE_THREAD;
+      } else if (!strcmp(optarg, "epoll")) {
+        engine = ENGINE_EPOLL;
+      } else {
+        usage(argv[0]);
+      }
+      break;
+    case 'r':
+      nreactors = atoi(optarg);
+      break;
+    case 'R':
+      reuseport = 1;
+      break;
+    case 'l':
+      if ((level = log_parse_level(optarg)) < 0) {
+        usage(argv[0]);
+      }
+      break;
+    case 't':
+      nthreads = atoi(optarg);
+      break;
+    case 'q':
+      qsize = atoi(optarg);
+      break;
+    case 'o':
+      if (!strcmp(optarg, "block")) {
+        overload = OVERLOAD_BLOCK;
+      } else if (!strcmp(optarg, "reject")) {
+        overload = OVERLOAD_REJECT;
+      } else {
+        usage(argv[0]);
+      }
+      break;
+    case 'k':
+      if (!strcmp(optarg, "on")) {
+        keepalive = 1;
+      } else if (!strcmp(optarg, "off")) {
+        keepalive = 0;
+      } else {
+        usage(argv[0]);
+      }
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+
   // 실행 시 인수로 포트번호가 들어오지 않았을 경우 exit
-  if (argc != 2) {
-    fprintf(stderr, "usage: %s <port>\n", argv[0]);
-    exit(1);
+  if (optind != argc - 1 || nthreads <= 0 || qsize <= 0 || nreactors <= 0 ||
+      (reuseport && engine != ENGINE_EPOLL)) {
+    usage(argv[0]);
+  }
+
+  // 클라이언트가 먼저 끊어도 죽지 않도록
+  signal(SIGPIPE, SIG_IGN);
+
+  // 워커들은 stdout 대신 로그 링에 쓰고, 로그 쓰레드가 모아서 출력
+  log_init(level, STDOUT_FILENO);
+  stats_init();
+
+  // 캐시 초기화
+  cache_init(MAX_CACHE_SIZE, MAX_OBJECT_SIZE);
+
+  // 원격 서버 이름 해석 캐시와 keep-alive 연결 풀
+  dns_init();
+  dl_init();
+  upstream_init(engine == ENGINE_THREAD && keepalive);
+
+  // epoll 엔진은 reactor 쓰레드들이 리슨 소켓을 열고 accept 부터 직접 처리
+  if (engine == ENGINE_EPOLL) {
+    event_run(argv[optind], nreactors, reuseport);
   }
 
   // 서버 소켓 열기
-  listenfd = Open_listenfd(argv[1]);
+  listenfd = Open_listenfd(argv[optind]);
+
+  // 워커 쓰레드를 미리 만들어 둠
+  sbuf_init(&sbuf, qsize);
+  idle_init(&sbuf);
+  for (i = 0; i < nthreads; i++) {
+    Pthread_create(&tid, NULL, thread, NULL);
+  }
 
   while (1) {
     clientlen = sizeof(clientaddr);
-    // connfd = Accept(listenfd, (SA *)&clientaddr, &clientlen);
-    connfd = Malloc(sizeof(int));
-    *connfd = Accept(listenfd, (SA *)&clientaddr, &clientlen);
-    Getnameinfo((SA *)&clientaddr, clientlen, hostname, MAXLINE, port, MAXLINE, 0);
-    printf("Accepted connection from (%s, %s)\n", hostname, port);
-    // 쓰레드에서 요청 읽기 및 처리
-    Pthread_create(&tid, NULL, thread, connfd);
+    connfd = Accept(listenfd, (SA *)&clientaddr, &clientlen);
+    stats_count(SC_CONNS, 1);
+    // 역방향 DNS 조회로 accept 루프가 막히지 않도록 숫자 그대로 출력
+    if (LOG_DEBUG <= log_level) {
+      Getnameinfo((SA *)&clientaddr, clientlen, hostname, MAXLINE, port, MAXLINE,
+                  NI_NUMERICHOST | NI_NUMERICSERV);
+      log_msg(LOG_DEBUG, "Accepted connection from (%s, %s)", hostname, port);
+    }
+    // 큐에 넣으면 쉬고 있는 워커가 꺼내서 처리
+    item.fd = connfd;
+    item.accepted = stats_now();
+    if (overload == OVERLOAD_BLOCK) {
+      sbuf_insert(&sbuf, item);
+    } else if (sbuf_tryinsert(&sbuf, item) < 0) {
+      clienterror(connfd, "", "503", "Service Unavailable", "Proxy is overloaded");
+      Close(connfd);
+    }
   }
 }
 
 /*
- * thread - 쓰레드를 분리해서 클라이언트의 요청을 처리하고, 완료 후 연결을 닫음
+ * thread - 워커 쓰레드. 큐에서 연결을 하나씩 꺼내 요청을 처리하고, 완료 후 연결을 닫음
+ *   keep-alive 연결이면 이미 와 있는 다음 요청(파이프라인 포함)을 이어서 처리하고,
+ *   아직 오지 않았으면 연결을 idle 쓰레드에 맡기고 큐의 다음 연결로 넘어감
  */
 void *thread(void *vargp) {
-  int connfd = *((int *)vargp);
+  int connfd, keep, one = 1;
+  long long ready;
+  sbuf_item_t item;
+  rio_t rio;
   // 쓰레드 분리
   Pthread_detach((pthread_self()));
-  // 동적할당 해제
-  Free(vargp);
-  // 클라이언트 요청 처리
-  doit(connfd);
-  // 연결 닫기
-  Close(connfd);
+  while (1) {
+    item = sbuf_remove(&sbuf);
+    connfd = item.fd;
+    ready = stats_now();
+    stats_record(ST_QUEUE, ready - item.accepted);
+    // 응답 헤더와 바디를 따로 쓰므로, keep-alive 연결에서 Nagle 이 응답 끝을 붙잡지 않도록
+    setsockopt(connfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    // 클라이언트 요청 처리
+    Rio_readinitb(&rio, connfd);
+    // 다음 요청의 시작 시각은 그 요청이 보인 때 (keep-alive 로 쉬던 시간은 빼고)
+    while ((keep = doit(connfd, &rio, ready)) && wait_request(connfd, &rio)) {
+      ready = stats_now();
+    }
+    // 쉬는 keep-alive 연결은 맡기고, 끝난 연결은 닫기
+    if (keep) {
+      idle_park(connfd);
+    } else {
+      Close(connfd);
+    }
+  }
   return NULL;
 }
 
+/*
+ * wait_request - keep-alive 연결에 다음 요청이 벌써 와 있는지 기다리지 않고 확인
+ * @return 1: 읽을 것이 있음, 0: 아직 없음
+ */
+int wait_request(int fd, rio_t *rp) {
+  struct pollfd pfd;
+
+  // 파이프라인으로 이미 읽어 둔 요청이 있음
+  if (rp->rio_cnt > 0) {
+    return 1;
+  }
+  pfd.fd = fd;
+  pfd.events = POLLIN;
+  return poll(&pfd, 1, 0) > 0;
+}
+
 /*
  * doit - 한 개의 HTTP transaction 을 처리
+ *   ready 는 이 요청을 읽기 시작할 수 있게 된 시각 (통계용)
+ * @return 같은 연결에서 다음 요청을 받아도 되면 1, 닫아야 하면 0
  */
-void doit(int fd) {
-  signal(SIGPIPE, SIG_IGN);
-  int is_static;
-  struct stat sbuf;
-  char buf[MAXLINE], method[MAXLINE], uri[MAXLINE], version[MAXLINE];
-  char filename[MAXLINE], cgiargs[MAXLINE];
-  // uri parsing 을 위한 변수 선언
-  char hostname[MAXLINE], pathname[MAXLINE], port[MAXLINE];
-  rio_t rio;
+int doit(int fd, rio_t *rp, long long ready) {
+  char key[MAXLINE], *result;
+  cache_obj_t *obj;
+  flight_t *fl;
+  int leader, keepalive, kind, json;
+  ssize_t n;
+  request_t req;
+  dl_timer_t dl;
+
+  memset(&req.t, 0, sizeof(req.t));
+  req.t.ready = ready;
 
   /* request, header 값 읽기 */
-  Rio_readinitb(&rio, fd);
-  Rio_readlineb(&rio, buf, MAXLINE);
-  // 여기서 요청을 읽고 HTTP 메소드, URI, HTTP 버전을 파싱
-  sscanf(buf, "%s %s %s", method, uri, version);
-  printf(":: %s %s %s ::\n", method, uri, version);
+  // 요청 줄과 헤더를 rio 버퍼 안에서 한 번에 파싱. 문자열은 복사하지 않고
+  // rio 버퍼를 가리키는 view 로만 들고 다님 (다음 요청을 읽기 전까지 유효)
+  // keep-alive 연결을 클라이언트가 닫았으면 끝
+  // 헤더를 조금씩 흘리거나 아무것도 보내지 않는 클라이언트가 워커를 붙잡지
+  // 못하도록 마감을 걸고, 지나면 wheel 이 fd 를 shutdown 해서 read 를 깨움
+  dl_start(&dl, CLIENT_HEAD_MS);
+  dl_arm(&dl, fd, CLIENT_HEAD_MS);
+  n = http_read_head(rp, &req.head, 0);
+  if (dl_cancel(&dl)) {
+    LOG(LOG_DEBUG, "request header not received within %d ms", CLIENT_HEAD_MS);
+    return 0;
+  }
+  if (n <= 0) {
+    if (n < 0) {
+      clienterror(fd, "", "400", "Bad Request", "Failed to parse request header");
+      log_access("-", 1, "-", 1, 400, 0, 0, "ERROR");
+      stats_finish(&req.t, -1, 400, 0);
+    }
+    return 0;
+  }
+  // 요청 줄과 헤더를 한 번에 파싱하므로 두 시점이 같음
+  req.t.head = stats_now();
+  req.status = 0;
+  req.bytes = 0;
+  kind = -1;
+  keepalive = 0;
+  result = "ERROR";
 
   // 입력된 uri 파싱
-  if (parse_uri(uri, hostname, pathname, port) < 0) {
-    clienterror(fd, uri, "400", "Bad Request", "Failed to parse URI");
-    return;
+  if (parse_request(&req) < 0) {
+    clienterror(fd, "", "400", "Bad Request", "Failed to parse URI");
+    req.status = 400;
+    goto done;
   }
 
   // GET 메소드 이외의 메소드가 들어왔을 경우 error
-  if (strcasecmp(method, "GET")) {
-    clienterror(fd, method, "501", "Not Implemented", "Tiny does not implement this method");
-    return;
+  if (!view_is(req.method, "GET")) {
+    clienterror(fd, "", "501", "Not Implemented", "Tiny does not implement this method");
+    req.status = 501;
+    goto done;
+  }
+
+  keepalive = request_keepalive(&req.head);
+
+  // 통계 페이지는 캐시나 원격 서버를 거치지 않고 여기서 답함
+  if ((json = stats_match(req.hostname, req.pathname)) >= 0) {
+    keepalive = serve_stats(fd, json, keepalive, &req);
+    result = "STATS";
+    goto done;
+  }
+
+  // 캐시에 있으면 원격 서버에 가지 않고 바로 응답
+  cache_makekey(key, req.hostname, req.port, req.pathname);
+  if ((obj = cache_get(key)) != NULL) {
+    LOG(LOG_DEBUG, "cache hit :: %s", key);
+    keepalive = send_object(fd, obj->data, obj->size, keepalive);
+    req.status = 200;   // 200 응답만 캐시됨
+    req.bytes = obj->size;
+    cache_release(obj);
+    result = "HIT";
+    kind = SC_HITS;
+    keepalive = keepalive > 0;
+    goto done;
+  }
+
+  // 같은 객체를 이미 다른 쓰레드가 받아오는 중이면 그 바이트를 같이 받음
+  fl = flight_join(key, &leader);
+  if (!leader) {
+    LOG(LOG_DEBUG, "cache wait :: %s", key);
+    if ((leader = serve_flight(fd, fl, keepalive, &req)) >= 0) {
+      flight_release(fl);
+      result = "WAIT";
+      kind = SC_COALESCED;
+      keepalive = leader;
+      goto done;
+    }
+    // leader 가 아무것도 못 받고 실패했으면 직접 가져옴
+    flight_release(fl);
+    fl = NULL;
+  }
+  keepalive = forward_request(fd, &req, fl, keepalive);
+  if (fl) {
+    flight_release(fl);
+  }
+  result = "MISS";
+  kind = SC_MISSES;
+
+done:
+  stats_finish(&req.t, kind, req.status, req.bytes);
+  log_access(req.method.p, req.method.len, req.uri.p, req.uri.len, req.status, req.bytes,
+             (req.t.done - req.t.head) / 1000, result);
+  return keepalive;
+}
+
+/*
+ * response_framed - 응답 헤더 블록(hdr, 빈 줄까지)만 보고 바디 끝을 알 수 있는지
+ *   Content-length 가 있거나 바디가 없는 204, 304 이면 1. 청크 경계는 따라가지
+ *   않으므로 Transfer-Encoding 이 있으면 0
+ */
+int response_framed(char *hdr, size_t n) {
+  char *p = hdr, *end = hdr + n - 2, *eol;
+  int status = 0, framed;
+
+  sscanf(hdr, "HTTP/%*d.%*d %d", &status);
+  framed = status == 204 || status == 304;
+  while (p < end && (eol = memchr(p, '\n', end - p)) != NULL) {
+    if (!strncasecmp(p, "Content-length:", 15)) {
+      framed = 1;
+    } else if (!strncasecmp(p, "Transfer-Encoding:", 18)) {
+      return 0;
+    }
+    p = eol + 1;
   }
+  return framed;
+}
 
-  read_requesthdrs(&rio);
-  forward_request(fd, hostname, pathname, port);
+/*
+ * send_head - 응답 헤더 블록(hdr, 빈 줄까지)을 보내면서 빈 줄 앞에 Connection 헤더를 붙임
+ *   body 가 있으면 같은 writev 로 이어서 보냄
+ *   클라이언트가 keep-alive 를 원하고 응답 길이를 알 수 있을 때만 연결을 유지
+ * @return 연결 유지 여부, 쓰기 실패면 -1
+ */
+int send_head(int fd, char *hdr, size_t n, char *body, size_t bodylen, int keepalive) {
+  struct iovec iov[3], *v = iov;
+  int cnt = 3;
+  ssize_t w;
+
+  keepalive = keepalive && response_framed(hdr, n);
+
+  iov[0].iov_base = hdr;
+  iov[0].iov_len = n - 2;
+  iov[1].iov_base = keepalive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n";
+  iov[1].iov_len = strlen(iov[1].iov_base);
+  iov[2].iov_base = body;
+  iov[2].iov_len = bodylen;
+
+  // 일부만 써졌으면 남은 부분부터 다시
+  while (cnt > 0) {
+    if ((w = writev(fd, v, cnt)) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    while (cnt > 0 && (size_t)w >= v->iov_len) {
+      w -= v->iov_len;
+      v++;
+      cnt--;
+    }
+    if (cnt > 0) {
+      v->iov_base = (char *)v->iov_base + w;
+      v->iov_len -= w;
+    }
+  }
+  return keepalive;
+}
+
+/*
+ * send_object - 캐시 객체(응답 헤더 + 바디)를 클라이언트에 전달
+ * @return 연결 유지 여부, 쓰기 실패면 -1
+ */
+int send_object(int fd, char *data, size_t size, int keepalive) {
+  char *p = memmem(data, size, "\r\n\r\n", 4);
+
+  // 헤더 끝이 없는 응답은 그대로 보내고 닫음
+  if (!p) {
+    return rio_writen(fd, data, size) < 0 ? -1 : 0;
+  }
+  p += 4;
+  return send_head(fd, data, p - data, p, data + size - p, keepalive);
+}
+
+/*
+ * abort_conn - 닫을 때 FIN 대신 RST 를 보내도록 함
+ *   바디가 잘린 응답을 클라이언트가 EOF 로 끝난 완전한 응답으로 여기지 않게
+ */
+static void abort_conn(int fd) {
+  struct linger lg = {1, 0};
+
+  setsockopt(fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+}
+
+/*
+ * serve_flight - 다른 쓰레드가 받아오는 중인 응답을 도착하는 대로 클라이언트에 전달
+ *   헤더 블록이 다 모일 때까지 기다렸다가 Connection 헤더를 붙여 보냄
+ * @return 1: 끝까지 보냈고 연결 유지, 0: 보냈지만(또는 보내다가 끊겨서) 닫아야 함,
+ *        -1: 클라이언트에게 아무것도 보내기 전에 leader 가 실패했거나 창 밖으로
+ *            밀려남 (호출한 쪽이 직접 가져옴)
+ *   req 에 응답 상태와 바이트 수를 채움
+ */
+int serve_flight(int clientfd, flight_t *fl, int keepalive, request_t *req) {
+  char buf[MAXBUF], *hdr = NULL, *p;
+  size_t off = 0, hlen = 0;
+  ssize_t n;
+  int head = 1, ok = 1;
+
+  while (ok && (n = flight_read(fl, off, buf, MAXBUF)) > 0) {
+    off += n;
+    if (!head) {
+      ok = rio_writen(clientfd, buf, n) >= 0;
+      continue;
+    }
+    hdr = Realloc(hdr, hlen + n);
+    memcpy(hdr + hlen, buf, n);
+    hlen += n;
+    if ((p = memmem(hdr, hlen, "\r\n\r\n", 4)) != NULL) {
+      head = 0;
+      p += 4;
+      sscanf(hdr, "HTTP/%*d.%*d %d", &req->status);
+      keepalive = send_head(clientfd, hdr, p - hdr, p, hdr + hlen - p, keepalive);
+      ok = keepalive >= 0;
+    }
+  }
+  // 창 밖으로 밀려났거나 leader 가 실패했는데 클라이언트에게 아직 아무것도
+  // 보내지 않았으면 직접 가져오고, 바디 중간이면 잘린 응답이 끝까지 받은
+  // 것으로 보이지 않게 연결을 끊음
+  if (n < 0 && head) {
+    if (hdr) {
+      Free(hdr);
+    }
+    return -1;
+  }
+  if (n < 0) {
+    abort_conn(clientfd);
+  }
+  // 헤더 끝을 못 찾은 응답은 받은 그대로
+  if (head && hdr && ok) {
+    rio_writen(clientfd, hdr, hlen);
+  }
+  if (hdr) {
+    Free(hdr);
+  }
+  req->bytes = off;
+  return ok && !head && n == 0 && keepalive > 0;
+}
+
+/*
+ * serve_stats - 통계 페이지를 클라이언트에 전달
+ * @return 연결 유지 여부
+ */
+int serve_stats(int fd, int json, int keepalive, request_t *req) {
+  char buf[STATS_BODYSIZE + MAXLINE];
+  int n;
+
+  n = stats_response(buf, sizeof(buf), json);
+  req->status = 200;
+  req->bytes = n;
+  return send_object(fd, buf, n, keepalive) > 0;
+}
+
+/*
+ * parse_request - 요청 줄을 view 로 나누고 uri 파싱
+ */
+int parse_request(request_t *req) {
+  http_msg_t *m = &req->head;
+
+  req->method = http_view(m, m->method);
+  req->uri = http_view(m, m->uri);
+  req->version = http_view(m, m->version);
+  LOG(LOG_DEBUG, ":: %.*s %.*s %.*s ::", req->method.len, req->method.p, req->uri.len,
+      req->uri.p, req->version.len, req->version.p);
+  return parse_uri(req->uri, &req->hostname, &req->pathname, &req->port);
 }
 
 /*
  * parse_uri - URI 파싱
+ *   복사하지 않고 uri 안의 호스트명, 경로, 포트 위치만 잡음
  */
-int parse_uri(char *uri, char *hostname, char *pathname, char *port) {
-  char *hostbegin, *hostend, *pathbegin;
-  int len;
+int parse_uri(view_t uri, view_t *hostname, view_t *pathname, view_t *port) {
+  const char *p = uri.p, *end = uri.p + uri.len, *q;
 
   // URI가 http:// 로 시작하지 않으면 오류 반환
-  if (strncasecmp(uri, "http://", 7) != 0) {
+  if (uri.len < 7 || strncasecmp(p, "http://", 7) != 0) {
     return -1;
   }
 
   // 호스트명 추출
-  hostbegin = uri + 7;  // "http://" 이후부터 호스트명 시작
-  hostend = strpbrk(hostbegin, " :/\r\n\0");  // 호스트명 끝 탐색
-  len = hostend - hostbegin;
-  strncpy(hostname, hostbegin, len);
-  hostname[len] = '\0';
+  p += 7;  // "http://" 이후부터 호스트명 시작
+  for (q = p; q < end && *q != ':' && *q != '/'; q++)
+    ;
+  hostname->p = p;
+  hostname->len = q - p;
 
   // 포트 번호 추출
-  strcpy(port, "80");  // 기본 포트는 80
+  port->p = "80";  // 기본 포트는 80
+  port->len = 2;
 
   // 포트 번호가 있으면 추출
-  if (*hostend == ':') {
-    char *portbegin = hostend + 1;
-    char *portend = strpbrk(portbegin, "/\r\n\0");  // '/' 또는 줄바꿈이 나오기 전까지가 포트 번호
-    len = portend - portbegin;
-    strncpy(port, portbegin, len);  // 포트 번호를 복사
-    port[len] = '\0';
+  if (q < end && *q == ':') {
+    p = q + 1;
+    for (q = p; q < end && *q != '/'; q++)  // '/' 가 나오기 전까지가 포트 번호
+      ;
+    port->p = p;
+    port->len = q - p;
   }
 
   // 경로 추출
-  pathbegin = strchr(hostbegin, '/');
-  if (pathbegin == NULL) {
-    strcpy(pathname, "/");  // 경로가 없으면 기본 경로로 "/"
+  if (q == end) {
+    pathname->p = "/";  // 경로가 없으면 기본 경로로 "/"
+    pathname->len = 1;
   } else {
-    strcpy(pathname, pathbegin);  // 경로가 있으면 그대로 복사
+    pathname->p = q;  // 경로가 있으면 그 위치부터 끝까지
+    pathname->len = end - q;
+  }
+
+  // 이름 해석 때 NUL 로 끝나는 문자열로 옮길 수 있는 길이여야 함
+  if (hostname->len == 0 || hostname->len >= NI_MAXHOST ||
+      port->len == 0 || port->len >= NI_MAXSERV) {
+    return -1;
   }
 
-  printf("parse arguments :: uri: %s, hostname: %s, pathname: %s, port: %s\n", uri, hostname, pathname, port);
+  LOG(LOG_DEBUG, "parse arguments :: hostname: %.*s, pathname: %.*s, port: %.*s",
+      hostname->len, hostname->p, pathname->len, pathname->p, port->len, port->p);
   return 0;
 }
 
 /*
- * read_requesthdrs - HTTP request headers 를 읽고 파싱
+ * request_keepalive - 요청 헤더를 보고 클라이언트 연결을 유지할지 결정
+ *   HTTP/1.1 은 기본이 keep-alive, HTTP/1.0 은 헤더로 요청해야 함
  */
-void read_requesthdrs(rio_t *rp) {
-  char buf[MAXLINE];
-
-  Rio_readlineb(rp, buf, MAXLINE);
-  while (strcmp(buf, "\r\n")) {
-    Rio_readlineb(rp, buf, MAXLINE);
-    printf("%s", buf);
+int request_keepalive(http_msg_t *req) {
+  http_header_t *h;
+  int i, keepalive = http_slice_is(req, req->version, "HTTP/1.1");
+
+  for (i = 0; i < req->nheaders; i++) {
+    h = &req->headers[i];
+    LOG(LOG_DEBUG, "%.*s: %.*s", (int)h->name.len, HTTP_PTR(req, h->name),
+        (int)h->value.len, HTTP_PTR(req, h->value));
+    if (http_slice_is(req, h->name, "Connection") ||
+        http_slice_is(req, h->name, "Proxy-Connection")) {
+      if (http_has_token(req, h->value, "close")) {
+        keepalive = 0;
+      } else if (http_has_token(req, h->value, "keep-alive")) {
+        keepalive = 1;
+      }
+    } else if (http_slice_is(req, h->name, "Content-length") &&
+               strtol(HTTP_PTR(req, h->value), NULL, 10) > 0) {
+      // 요청 바디는 읽지 않으므로 다음 요청이 어디서 시작하는지 알 수 없음
+      keepalive = 0;
+    } else if (http_slice_is(req, h->name, "Transfer-Encoding")) {
+      keepalive = 0;
+    }
   }
-  return;
+  return keepalive;
 }
 
 /*
- * forward_request - 웹서버로 요청 보내기
+ * build_request - 원격 서버로 보낼 요청을 buf(REQUEST_BUFSIZE 이상)에 작성하고 길이를 반환
+ *   keepalive 면 응답 후에도 연결을 끊지 말라고 요청 (upstream 풀에서 다시 씀)
  */
-void forward_request(int clientfd, char *hostname, char *pathname, char *port) {
-  int serverfd;
-  char buf[MAXLINE], response[MAXBUF];
-  rio_t rio;
+int build_request(char *buf, request_t *req, int keepalive) {
+  char *p = buf;
 
-  // 원격 서버에 연결 - 클라이언트 소켓 열기
-  serverfd = Open_clientfd(hostname, port);
-  if (serverfd < 0) {
-    printf("Failed to connect to server.\n");
-    return;
-  }
-
-  // 요청 헤더 작성 및 전달
-  sprintf(buf, "GET %s HTTP/1.0\r\n", pathname);
-  Rio_writen(serverfd, buf, strlen(buf));
+  p += sprintf(p, "GET %.*s HTTP/1.0\r\n", req->pathname.len, req->pathname.p);
 
   // 필수 헤더 추가
   // Host
-  sprintf(buf, "Host: %s:%s\r\n", hostname, port);
-  Rio_writen(serverfd, buf, strlen(buf));
+  p += sprintf(p, "Host: %.*s:%.*s\r\n", req->hostname.len, req->hostname.p,
+               req->port.len, req->port.p);
 
   // User-Agent
-  sprintf(buf, user_agent_hdr);
-  Rio_writen(serverfd, buf, strlen(buf));
+  p += sprintf(p, "%s", user_agent_hdr);
 
   // connection
-  sprintf(buf, "Connection: close\r\n");
-  Rio_writen(serverfd, buf, strlen(buf));
+  p += sprintf(p, "Connection: %s\r\n", keepalive ? "keep-alive" : "close");
 
   // Proxy-Connection
-  sprintf(buf, "Proxy-Connection: close\r\n");
-  Rio_writen(serverfd, buf, strlen(buf));
+  p += sprintf(p, "Proxy-Connection: %s\r\n", keepalive ? "keep-alive" : "close");
 
-  sprintf(buf, "\r\n");  // 마지막 헤더를 추가한 후 공백 줄을 넣어 요청 종료를 표시
-  Rio_writen(serverfd, buf, strlen(buf));
+  p += sprintf(p, "\r\n");  // 마지막 헤더를 추가한 후 공백 줄을 넣어 요청 종료를 표시
+  return p - buf;
+}
 
-  // 원격 서버 응답을 클라이언트로 전달
-  Rio_readinitb(&rio, serverfd);
-  size_t n;
-  while ((n = Rio_readlineb(&rio, response, MAXBUF)) != 0) {
-    Rio_writen(clientfd, response, n);
+/*
+ * send_request - 요청을 보내고 응답 헤더 블록을 읽어서 파싱
+ * @return 헤더 블록 길이, 연결이 끊겼거나 응답이 틀렸으면 0 이하
+ */
+static ssize_t send_request(int serverfd, char *req, int len, rio_t *rp, http_msg_t *resp) {
+  if (rio_writen(serverfd, req, len) < 0) {
+    return -1;
   }
-  Close(serverfd);
+  Rio_readinitb(rp, serverfd);
+  return http_read_head(rp, resp, 1);
 }
 
+/*
+ * copy_slice - p 에 조각을 이어 붙이고 끝 위치를 반환
+ */
+static char *copy_slice(char *p, http_msg_t *m, http_slice_t s) {
+  memcpy(p, HTTP_PTR(m, s), s.len);
+  return p + s.len;
+}
+
+/*
+ * copy_head - 응답 헤더 블록을 dst(HEAD_BUFSIZE 이상)에 빈 줄까지 다시 조립하고 끝 위치를 반환
+ *   원격 서버와의 연결에만 해당하는 Connection, Keep-Alive, Proxy-Connection 은
+ *   클라이언트로 넘기지 않음. clen 에 Content-length (없으면 -1), reuse 에
+ *   원격 서버 연결을 다시 써도 되는지를 채움
+ */
+char *copy_head(char *dst, http_msg_t *resp, long *clen, int *reuse) {
+  char *p = dst;
+  http_header_t *h;
+  int i;
+
+  // 상태 줄: HTTP/1.1 은 기본이 keep-alive, HTTP/1.0 은 명시해야 함
+  *clen = -1;
+  *reuse = http_slice_is(resp, resp->version, "HTTP/1.1");
+  p = copy_slice(p, resp, resp->line);
+  p = stpcpy(p, "\r\n");
+  for (i = 0; i < resp->nheaders; i++) {
+    h = &resp->headers[i];
+    if (http_slice_is(resp, h->name, "Connection") ||
+        http_slice_is(resp, h->name, "Keep-Alive") ||
+        http_slice_is(resp, h->name, "Proxy-Connection")) {
+      if (http_has_token(resp, h->value, "close")) {
+        *reuse = 0;
+      } else if (http_has_token(resp, h->value, "keep-alive")) {
+        *reuse = 1;
+      }
+      continue;
+    } else if (http_slice_is(resp, h->name, "Transfer-Encoding")) {
+      *reuse = 0;    // 청크 경계는 따라가지 않으므로 EOF 까지 읽음
+    } else if (http_slice_is(resp, h->name, "Content-length")) {
+      *clen = strtol(HTTP_PTR(resp, h->value), NULL, 10);
+    }
+    p = copy_slice(p, resp, h->name);
+    p = stpcpy(p, ": ");
+    p = copy_slice(p, resp, h->value);
+    p = stpcpy(p, "\r\n");
+  }
+  return stpcpy(p, "\r\n");
+}
+
+/*
+ * gateway_error - 원격 서버에서 응답을 받기 전에 실패한 요청에 에러로 답함
+ */
+static void gateway_error(int clientfd, request_t *req, flight_t *fl, char *hostname,
+                          char *errnum, char *shortmsg, char *longmsg) {
+  clienterror(clientfd, hostname, errnum, shortmsg, longmsg);
+  req->status = atoi(errnum);
+  if (fl) {
+    flight_finish(fl, 0);
+  }
+}
+
+/*
+ * gateway_failed - 연결이나 응답 헤더를 못 받았을 때, 마감이 지나서 끊겼으면 504 아니면 502
+ */
+static void gateway_failed(int clientfd, request_t *req, flight_t *fl, char *hostname,
+                           int timedout, char *longmsg) {
+  if (timedout) {
+    stats_count(SC_UPTIMEOUT, 1);
+    gateway_error(clientfd, req, fl, hostname, "504", "Gateway Timeout", longmsg);
+  } else {
+    gateway_error(clientfd, req, fl, hostname, "502", "Bad Gateway", longmsg);
+  }
+}
+
+/*
+ * forward_request - 웹서버로 요청 보내기
+ *   fl 이 있으면 받은 응답을 flight 에도 붙여서 기다리는 쓰레드들과 나누고,
+ *   다 받으면 캐시에 저장
+ *   연결은 upstream 풀에서 꺼내고, 응답 길이를 알고 끝까지 읽었으면 풀에 돌려줌
+ *   connect, 응답 헤더, 바디 idle, 전체 단계마다 마감을 걸고 결과를 breaker 에 알림
+ * @return 클라이언트 연결을 유지해도 되면 1
+ */
+int forward_request(int clientfd, request_t *req, flight_t *fl, int keepalive) {
+  int serverfd, reused, len, status, reuse, client_ok = 1, timedout;
+  char hostname[NI_MAXHOST], port[NI_MAXSERV], *buf, *hdr, *p, *body = NULL;
+  long clen;
+  size_t total = 0, bodyn = 0, want;
+  ssize_t n, m, left;
+  rio_t rio;
+  http_msg_t resp;
+  up_host_t *host;
+  dl_timer_t dl;
+
+  // 원격 서버에 연결 - 풀에 idle 연결이 없으면 새로 연결 (이름 해석은 캐시를 거침)
+  // getaddrinfo 가 NUL 로 끝나는 문자열을 받으므로 호스트명과 포트만 복사
+  view_cstr(hostname, sizeof(hostname), req->hostname);
+  view_cstr(port, sizeof(port), req->port);
+  if (!upstream_allow(hostname, port)) {
+    req->t.connect = stats_now();
+    stats_count(SC_UPREJECTED, 1);
+    gateway_error(clientfd, req, fl, hostname, "503", "Service Unavailable",
+                  "Server keeps failing, try again later");
+    return 0;
+  }
+
+  // 단계마다 마감을 다시 걸고, 마감이 지나면 wheel 이 serverfd 를 shutdown 함
+  dl_start(&dl, UP_TOTAL_MS);
+  dl_arm(&dl, -1, UP_CONNECT_MS);
+  serverfd = upstream_get(hostname, port, &reused, &dl);
+  req->t.connect = stats_now();
+  // 이름 해석 실패는 dnscache 가 따로 기억하므로 breaker 항목을 새로 만들지 않음
+  // (이미 있으면 시험 요청이었을 수 있으므로 결과를 알림)
+  host = upstream_host(hostname, port, serverfd != -2);
+  if (serverfd < 0) {
+    timedout = dl_cancel(&dl);
+    LOG(LOG_ERROR, "Failed to connect to server %s:%s%s", hostname, port,
+        timedout ? " (timed out)" : "");
+    upstream_report(host, 0);
+    gateway_failed(clientfd, req, fl, hostname, timedout, "Failed to connect to server");
+    return 0;
+  }
+  stats_count(reused ? SC_UPREUSED : SC_UPNEW, 1);
+
+  // 요청 헤더 작성 및 전달
+  buf = Malloc(REQUEST_BUFSIZE(req));
+  len = build_request(buf, req, upstream_enabled());
+  dl_arm(&dl, serverfd, UP_TTFB_MS);
+  n = send_request(serverfd, buf, len, &rio, &resp);
+
+  // 풀에서 꺼낸 연결을 원격 서버가 그 사이 닫았으면 새 연결로 한 번만 다시 보냄
+  // (마감이 지나서 끊긴 것이면 다시 보내지 않음)
+  if (n <= 0 && reused && dl_bind(&dl, -1) == 0) {
+    Close(serverfd);
+    dl_arm(&dl, -1, UP_CONNECT_MS);
+    if ((serverfd = dns_open_clientfd(hostname, port, &dl)) < 0) {
+      Free(buf);
+      timedout = dl_cancel(&dl);
+      upstream_report(host, 0);
+      gateway_failed(clientfd, req, fl, hostname, timedout, "Failed to connect to server");
+      return 0;
+    }
+    req->t.connect = stats_now();
+    stats_count(SC_UPNEW, 1);
+    dl_arm(&dl, serverfd, UP_TTFB_MS);
+    n = send_request(serverfd, buf, len, &rio, &resp);
+  }
+  Free(buf);
+  if (n <= 0) {
+    timedout = dl_cancel(&dl);
+    Close(serverfd);
+    upstream_report(host, 0);
+    gateway_failed(clientfd, req, fl, hostname, timedout, "No response from server");
+    return 0;
+  }
+  dl_arm_idle(&dl, serverfd, UP_IDLE_MS);
+
+  // 응답 헤더 블록을 다 읽은 시각을 첫 바이트로 봄 (보통 첫 read 에 다 들어옴)
+  req->t.first = stats_now();
+
+  // 원격 서버 응답 헤더 블록을 다시 조립해서 한 번에 전달
+  // 클라이언트에게 먼저 쓰고 나서 캐시용으로 복사 -> 첫 바이트 지연은 캐시가 없을 때와 같음
+  // 우리 클라이언트가 끊겨도 기다리는 쓰레드들을 위해 끝까지 받음
+  status = resp.status;
+  hdr = Malloc(HEAD_BUFSIZE(&resp));
+  p = copy_head(hdr, &resp, &clen, &reuse);
+  total = n;
+  req->status = status;
+  req->bytes = p - hdr;
+
+  dl_hold(&dl);
+  if ((keepalive = send_head(clientfd, hdr, p - hdr, NULL, 0, keepalive)) < 0) {
+    client_ok = 0;
+  }
+  dl_touch(&dl);
+  if (fl) {
+    // 200 응답만 캐시
+    if (status != 200) {
+      flight_nocache(fl);
+    }
+    // 바디 크기가 헤더에 나와 있으면 MAX_OBJECT_SIZE 를 넘는지 미리 판단해서
+    // 바디를 버퍼에 모으지 않고 바로 흘려보냄
+    if (clen > MAX_OBJECT_SIZE) {
+      flight_oversize(fl);
+    }
+    flight_append(fl, hdr, p - hdr);
+  }
+  Free(hdr);
+  if (status == 204 || status == 304) {
+    clen = 0;
+  }
+
+  // 바디는 줄 단위가 아니라 블록 단위로 전달.
+  // 길이를 알면 그만큼만 읽고 연결을 재사용, 모르면 EOF 까지
+  // 캐시에 넣을 것도, 기다리는 follower 도 없으면 user space 를 거치지 않고 splice
+  left = (reuse && clen >= 0) ? clen : -1;
+  while (n > 0 && left != 0 && (client_ok || fl)) {
+    if (!fl || !flight_wants_data(fl)) {
+      m = client_ok ? relay_splice(&rio, clientfd, left, &dl) : -1;
+      if (m >= 0) {
+        bodyn += m;
+        if (left > 0) {
+          left -= m;
+        }
+      }
+      n = (m < 0 || left > 0) ? -1 : 0;
+      break;
+    }
+    if (!body) {
+      body = Malloc(RELAY_BLOCK);
+    }
+    want = RELAY_BLOCK;
+    if (left > 0 && want > left) {
+      want = left;
+    }
+    if ((n = relay_read(&rio, body, want)) <= 0) {
+      break;
+    }
+    // 클라이언트가 받아 가는 동안은 원격 서버 idle 마감을 멈춤
+    dl_hold(&dl);
+    if (client_ok && rio_writen(clientfd, body, n) < 0) {
+      client_ok = 0;
+    }
+    dl_touch(&dl);
+    flight_append(fl, body, n);
+    total += n;
+    bodyn += n;
+    if (left > 0) {
+      left -= n;
+    }
+  }
+  if (body) {
+    Free(body);
+  }
+
+  // 바디를 정확히 다 읽었고 더 온 바이트가 없으면 풀에 돌려줌
+  // 마감이 지났으면 shutdown 된 연결이고, EOF 처럼 보여도 바디가 잘린 것
+  if ((timedout = dl_cancel(&dl)) != 0) {
+    LOG(LOG_ERROR, "Server %s:%s stalled, response cut after %zu bytes", hostname, port, bodyn);
+    stats_count(SC_UPTIMEOUT, 1);
+  }
+  if (!timedout && left == 0 && rio.rio_cnt == 0) {
+    upstream_put(hostname, port, serverfd);
+  } else {
+    Close(serverfd);
+  }
+  upstream_report(host, !timedout);
+
+  if (fl) {
+    flight_finish(fl, !timedout && (left == 0 || n == 0) && total > 0);
+  }
+
+  req->bytes += bodyn;
+  req->t.done = stats_now();
+
+  // 클라이언트가 Content-length 만큼 정확히 받았을 때만 연결 유지
+  return keepalive > 0 && client_ok && clen >= 0 && bodyn == (size_t)clen;
+}
 
 /*
  * clienterror - returns an error message to the client
@@ -218,11 +900,10 @@ void clienterror(int fd, char *cause, char *errnum, char *shortmsg, char *longms
   sprintf(body, "%s<hr><em>The Tiny Web server</em>\r\n", body);
 
   /* Print the HTTP response */
-  sprintf(buf, "HTTP/1.0 %s %s\r\n", errnum, shortmsg);
-  Rio_writen(fd, buf, strlen(buf));
-  sprintf(buf, "Content-type: text/html\r\n");
-  Rio_writen(fd, buf, strlen(buf));
-  sprintf(buf, "Content-length: %d\r\n\r\n", (int)strlen(body));
-  Rio_writen(fd, buf, strlen(buf));
-  Rio_writen(fd, body, strlen(body));
+  // 클라이언트가 먼저 끊었어도 프록시가 죽지 않도록 쓰기 에러는 무시
+  sprintf(buf, "HTTP/1.0 %s %s\r\nContent-type: text/html\r\nContent-length: %d\r\n\r\n",
+          errnum, shortmsg, (int)strlen(body));
+  if (rio_writen(fd, buf, strlen(buf)) >= 0) {
+    rio_writen(fd, body, strlen(body));
+  }
 }
\ No newline at end of file
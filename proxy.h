@@ -0,0 +1,43 @@
+/*
+ * proxy.h - 쓰레드 엔진(proxy.c)과 epoll 엔진(event.c)이 같이 쓰는 선언
+ */
+#ifndef __PROXY_H__
+#define __PROXY_H__
+
+#include "csapp.h"
+#include "httpparse.h"
+#include "stats.h"
+
+/* Recommended max cache and object sizes */
+#define MAX_CACHE_SIZE 1049000
+#define MAX_OBJECT_SIZE 102400
+
+/*
+ * 파싱한 요청 하나. 문자열은 모두 요청을 읽은 버퍼 안을 가리키므로
+ * 그 버퍼에 다음 요청을 읽기 전까지만 유효하다.
+ */
+typedef struct {
+  http_msg_t head;              /* 요청 줄과 헤더 */
+  view_t method, uri, version;
+  view_t hostname, port, pathname;  /* uri 에서 자른 것, port 가 없으면 "80" */
+  int status;                   /* 접근 로그: 클라이언트에게 보낸 응답 상태 */
+  long long bytes;              /* 접근 로그: 클라이언트에게 보낸 응답 바이트 */
+  stats_times_t t;              /* 통계: 단계별 시점 */
+} request_t;
+
+/* build_request 에 넘길 버퍼 크기 */
+#define REQUEST_BUFSIZE(req) \
+  ((req)->hostname.len + (req)->port.len + (req)->pathname.len + MAXBUF)
+
+/* copy_head 에 넘길 버퍼 크기, 헤더 줄마다 ": " 와 CRLF 로 늘어날 수 있는 만큼 여유를 둠 */
+#define HEAD_BUFSIZE(resp) ((resp)->len + 2 * (resp)->nheaders + 4)
+
+int parse_request(request_t *req);
+int parse_uri(view_t uri, view_t *hostname, view_t *pathname, view_t *port);
+int build_request(char *buf, request_t *req, int keepalive);
+int request_keepalive(http_msg_t *req);
+int response_framed(char *hdr, size_t n);
+char *copy_head(char *dst, http_msg_t *resp, long *clen, int *reuse);
+void clienterror(int fd, char *cause, char *errnum, char *shortmsg, char *longmsg);
+
+#endif /* __PROXY_H__ */
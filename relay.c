@@ -0,0 +1,200 @@
+/*
+ * relay.c - 원격 서버 응답 바디를 클라이언트로 대량 전달
+ *
+ * - relay_read: rio 버퍼에 남은 바이트가 있으면 그것부터, 없으면 read()
+ *   한 번으로 읽을 수 있는 만큼 바로 읽음. 캐시에 넣을 바이트처럼 user
+ *   space 에서 봐야 하는 경우에 씀
+ * - relay_copy: relay_read 와 rio_writen 을 RELAY_BLOCK 단위로 반복
+ * - relay_splice: 쓰레드마다 하나씩 둔 pipe 를 거쳐 splice() 로 옮겨서
+ *   user space 복사를 없앰. splice 를 쓸 수 없는 fd 면 relay_copy 로 대신함
+ *
+ * limit 이 0 이상이면 정확히 그만큼만 옮기고, 음수면 EOF 까지 옮긴다.
+ * t 가 있으면 목적지에 쓰는 동안은 dl_hold 로 idle 마감을 멈추고, 블록을
+ * 옮길 때마다 dl_touch 로 다시 센다.
+ */
+#define _GNU_SOURCE
+#include "relay.h"
+
+static pthread_key_t pipe_key;
+static pthread_once_t pipe_once = PTHREAD_ONCE_INIT;
+
+/*
+ * pipe_destroy - 쓰레드가 끝날 때 그 쓰레드의 pipe 닫기
+ */
+static void pipe_destroy(void *vargp) {
+  int *p = vargp;
+
+  close(p[0]);
+  close(p[1]);
+  Free(p);
+}
+
+static void pipe_key_init(void) {
+  pthread_key_create(&pipe_key, pipe_destroy);
+}
+
+/*
+ * thread_pipe - 현재 쓰레드의 splice 용 pipe, 없으면 새로 만듦
+ */
+static int *thread_pipe(void) {
+  int *p;
+
+  pthread_once(&pipe_once, pipe_key_init);
+  if ((p = pthread_getspecific(pipe_key)) != NULL) {
+    return p;
+  }
+  p = Malloc(2 * sizeof(int));
+  if (pipe2(p, O_CLOEXEC) < 0) {
+    Free(p);
+    return NULL;
+  }
+  fcntl(p[1], F_SETPIPE_SZ, RELAY_PIPESIZE);
+  pthread_setspecific(pipe_key, p);
+  return p;
+}
+
+/*
+ * pipe_reset - 중간에 실패해서 pipe 에 찌꺼기가 남았을 수 있으면 버림
+ */
+static void pipe_reset(void) {
+  int *p = pthread_getspecific(pipe_key);
+
+  if (p) {
+    pthread_setspecific(pipe_key, NULL);
+    pipe_destroy(p);
+  }
+}
+
+/*
+ * relay_read - 최대 n 바이트를 읽음. 있는 만큼만 읽고 바로 돌아옴
+ * @return 읽은 바이트 수, EOF 면 0, 에러면 -1
+ */
+ssize_t relay_read(rio_t *rp, char *buf, size_t n) {
+  ssize_t rc;
+
+  // rio 가 미리 읽어 둔 바이트부터
+  if (rp->rio_cnt > 0) {
+    if (n > rp->rio_cnt) {
+      n = rp->rio_cnt;
+    }
+    memcpy(buf, rp->rio_bufptr, n);
+    rp->rio_bufptr += n;
+    rp->rio_cnt -= n;
+    return n;
+  }
+  while ((rc = read(rp->rio_fd, buf, n)) < 0 && errno == EINTR)
+    ;
+  return rc;
+}
+
+/*
+ * relay_copy - 블록 단위 read/write 로 옮기기
+ * @return 옮긴 바이트 수, 에러면 -1
+ */
+ssize_t relay_copy(rio_t *rp, int dstfd, ssize_t limit, dl_timer_t *t) {
+  char *buf = Malloc(RELAY_BLOCK);
+  size_t want;
+  ssize_t n = 0, total = 0;
+
+  while (limit < 0 || total < limit) {
+    want = RELAY_BLOCK;
+    if (limit >= 0 && want > limit - total) {
+      want = limit - total;
+    }
+    if ((n = relay_read(rp, buf, want)) <= 0) {
+      break;
+    }
+    if (t) {
+      dl_hold(t);
+    }
+    if (rio_writen(dstfd, buf, n) < 0) {
+      n = -1;
+      break;
+    }
+    total += n;
+    if (t) {
+      dl_touch(t);
+    }
+  }
+  Free(buf);
+  return n < 0 ? -1 : total;
+}
+
+/*
+ * relay_splice - pipe 를 거쳐 splice() 로 옮기기
+ * @return 옮긴 바이트 수, 에러면 -1
+ */
+ssize_t relay_splice(rio_t *rp, int dstfd, ssize_t limit, dl_timer_t *t) {
+  int *p, more;
+  size_t want;
+  ssize_t n, m, total = 0;
+
+  // rio 가 헤더를 읽으면서 미리 읽어 둔 바디 앞부분은 직접 보냄
+  if (rp->rio_cnt > 0) {
+    n = rp->rio_cnt;
+    if (limit >= 0 && n > limit) {
+      n = limit;
+    }
+    if (t) {
+      dl_hold(t);
+    }
+    if (rio_writen(dstfd, rp->rio_bufptr, n) < 0) {
+      return -1;
+    }
+    rp->rio_bufptr += n;
+    rp->rio_cnt -= n;
+    total = n;
+    if (t) {
+      dl_touch(t);
+    }
+  }
+
+  if ((p = thread_pipe()) == NULL) {
+    n = relay_copy(rp, dstfd, limit < 0 ? -1 : limit - total, t);
+    return n < 0 ? -1 : total + n;
+  }
+
+  while (limit < 0 || total < limit) {
+    want = RELAY_PIPESIZE;
+    if (limit >= 0 && want > limit - total) {
+      want = limit - total;
+    }
+    n = splice(rp->rio_fd, NULL, p[1], NULL, want, SPLICE_F_MOVE | SPLICE_F_MORE);
+    if (n == 0) {
+      break;
+    }
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      // 소켓/파일이 아니라서 splice 를 못 쓰면 블록 복사로
+      if (errno == EINVAL) {
+        n = relay_copy(rp, dstfd, limit < 0 ? -1 : limit - total, t);
+        return n < 0 ? -1 : total + n;
+      }
+      return -1;
+    }
+    // pipe 에 들어간 만큼 목적지로 모두 뺌. 바디가 더 남았을 때만 SPLICE_F_MORE 를
+    // 붙여서, keep-alive 연결에서 마지막 조각이 소켓에 붙잡혀 있지 않게 함
+    more = limit < 0 || limit - total > n ? SPLICE_F_MORE : 0;
+    if (t) {
+      dl_hold(t);
+    }
+    while (n > 0) {
+      m = splice(p[0], NULL, dstfd, NULL, n, SPLICE_F_MOVE | more);
+      if (m < 0 && errno == EINTR) {
+        continue;
+      }
+      if (m <= 0) {
+        pipe_reset();
+        return -1;
+      }
+      n -= m;
+      total += m;
+    }
+    if (t) {
+      dl_touch(t);
+    }
+  }
+  return total;
+}
@@ -0,0 +1,21 @@
+/*
+ * relay.h - 원격 서버 응답 바디를 클라이언트로 대량 전달
+ *
+ * 응답 헤더 블록은 http_read_head 로 rio 버퍼에 모아 한 번에 파싱하고,
+ * 바디는 그 버퍼에 남은 바이트부터 큰 블록 단위로 옮긴다. 바이트를 user space 에서 볼 필요가 없으면
+ * (캐시하지 않는 응답) pipe 를 거쳐 splice() 로 커널 안에서만 옮긴다.
+ */
+#ifndef __RELAY_H__
+#define __RELAY_H__
+
+#include "csapp.h"
+#include "deadline.h"
+
+#define RELAY_BLOCK    65536   /* 블록 복사 단위 */
+#define RELAY_PIPESIZE 262144  /* splice 용 pipe 버퍼 크기 */
+
+ssize_t relay_read(rio_t *rp, char *buf, size_t n);
+ssize_t relay_copy(rio_t *rp, int dstfd, ssize_t limit, dl_timer_t *t);
+ssize_t relay_splice(rio_t *rp, int dstfd, ssize_t limit, dl_timer_t *t);
+
+#endif /* __RELAY_H__ */
@@ -0,0 +1,62 @@
+/*
+ * sbuf.c - 워커 쓰레드 풀에 연결 fd 를 넘겨주는 bounded 큐 (CS:APP 12.5.5)
+ */
+#include "sbuf.h"
+
+/*
+ * sbuf_init - 슬롯 n 개짜리 빈 큐 만들기
+ */
+void sbuf_init(sbuf_t *sp, int n) {
+  sp->buf = Calloc(n, sizeof(sbuf_item_t));
+  sp->n = n;
+  sp->front = sp->rear = 0;
+  Sem_init(&sp->mutex, 0, 1);
+  Sem_init(&sp->slots, 0, n);
+  Sem_init(&sp->items, 0, 0);
+}
+
+/*
+ * sbuf_deinit - 큐 메모리 해제
+ */
+void sbuf_deinit(sbuf_t *sp) {
+  Free(sp->buf);
+}
+
+/*
+ * sbuf_insert - 큐 뒤에 넣기. 자리가 없으면 빌 때까지 기다림
+ */
+void sbuf_insert(sbuf_t *sp, sbuf_item_t item) {
+  P(&sp->slots);
+  P(&sp->mutex);
+  sp->buf[(++sp->rear) % (sp->n)] = item;
+  V(&sp->mutex);
+  V(&sp->items);
+}
+
+/*
+ * sbuf_tryinsert - 큐 뒤에 넣기. 자리가 없으면 기다리지 않고 -1
+ */
+int sbuf_tryinsert(sbuf_t *sp, sbuf_item_t item) {
+  if (sem_trywait(&sp->slots) < 0) {
+    return -1;
+  }
+  P(&sp->mutex);
+  sp->buf[(++sp->rear) % (sp->n)] = item;
+  V(&sp->mutex);
+  V(&sp->items);
+  return 0;
+}
+
+/*
+ * sbuf_remove - 큐 앞에서 꺼내기. 비어 있으면 들어올 때까지 기다림
+ */
+sbuf_item_t sbuf_remove(sbuf_t *sp) {
+  sbuf_item_t item;
+
+  P(&sp->items);
+  P(&sp->mutex);
+  item = sp->buf[(++sp->front) % (sp->n)];
+  V(&sp->mutex);
+  V(&sp->slots);
+  return item;
+}
@@ -0,0 +1,31 @@
+/*
+ * sbuf.h - 워커 쓰레드 풀에 연결 fd 를 넘겨주는 bounded 큐 (CS:APP 12.5.5)
+ */
+#ifndef __SBUF_H__
+#define __SBUF_H__
+
+#include "csapp.h"
+
+/* 큐에 들어가는 연결 하나 */
+typedef struct {
+  int fd;
+  long long accepted;   /* accept 한 시각 (ns), 큐에서 기다린 시간 통계용 */
+} sbuf_item_t;
+
+typedef struct {
+  sbuf_item_t *buf;       /* 원형 버퍼 */
+  int n;          /* 슬롯 개수 */
+  int front;      /* buf[(front+1)%n] 이 첫 번째 아이템 */
+  int rear;       /* buf[rear%n] 이 마지막 아이템 */
+  sem_t mutex;    /* buf 접근 보호 */
+  sem_t slots;    /* 빈 슬롯 수 */
+  sem_t items;    /* 들어 있는 아이템 수 */
+} sbuf_t;
+
+void sbuf_init(sbuf_t *sp, int n);
+void sbuf_deinit(sbuf_t *sp);
+void sbuf_insert(sbuf_t *sp, sbuf_item_t item);
+int sbuf_tryinsert(sbuf_t *sp, sbuf_item_t item);
+sbuf_item_t sbuf_remove(sbuf_t *sp);
+
+#endif /* __SBUF_H__ */
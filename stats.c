@@ -0,0 +1,289 @@
+/*
+ * stats.c - 요청 처리 단계별 지연 시간 히스토그램과 카운터
+ *
+ * - 칸 번호: v < STATS_SUB 이면 v 그대로. 그보다 크면 가장 높은 비트 e 를
+ *   찾아 그 아래 STATS_SUBBITS 비트를 칸 안의 위치로 쓴다. 그래서 칸 폭은
+ *   2^(e - STATS_SUBBITS) 이고 값에 대한 상대 오차는 1/STATS_SUB 이하다.
+ * - 모든 값은 relaxed atomic 이다. 읽는 쪽은 칸을 하나씩 읽으므로 기록과
+ *   겹치면 몇 개쯤 어긋날 수 있지만, 통계로 보기에는 문제가 없다.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "stats.h"
+
+static stats_hist_t hists[ST_NPHASES];
+static atomic_ulong counters[SC_NCOUNTERS];
+static long long started;
+
+static const char *phase_name[ST_NPHASES] = {
+  "queue", "read", "connect", "ttfb", "transfer", "hit", "total"
+};
+
+static const char *counter_name[SC_NCOUNTERS] = {
+  "conns", "requests", "hits", "misses", "coalesced", "errors", "bytes_out",
+  "upstream_reused", "upstream_new", "upstream_timeouts", "upstream_rejected"
+};
+
+/*
+ * stats_init - 시작 시각 기록, main 에서 한 번 호출
+ */
+void stats_init(void) {
+  started = stats_now();
+}
+
+/*
+ * stats_now - 단조 증가 시계의 현재 시각 (ns)
+ */
+long long stats_now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*
+ * bucket_of - 값 v 가 들어갈 칸 번호
+ */
+static int bucket_of(unsigned long v) {
+  int e;
+
+  if (v < STATS_SUB) {
+    return v;
+  }
+  if (v >> (STATS_MAXEXP + 1)) {
+    return STATS_NBUCKETS - 1;
+  }
+  e = 63 - __builtin_clzl(v);
+  return (e - STATS_SUBBITS + 1) * STATS_SUB + ((v >> (e - STATS_SUBBITS)) & (STATS_SUB - 1));
+}
+
+/*
+ * bucket_high - 칸 i 에 들어가는 가장 큰 값 (백분위수로 보고하는 값)
+ */
+static unsigned long bucket_high(int i) {
+  int e, shift;
+
+  if (i < STATS_SUB) {
+    return i;
+  }
+  e = i / STATS_SUB + STATS_SUBBITS - 1;
+  shift = e - STATS_SUBBITS;
+  return ((unsigned long)(STATS_SUB + i % STATS_SUB) << shift) + (1UL << shift) - 1;
+}
+
+/*
+ * stats_hist_add - 히스토그램에 값 ns 하나를 기록, 음수는 무시
+ */
+void stats_hist_add(stats_hist_t *h, long long ns) {
+  unsigned long v, old;
+
+  if (ns < 0) {
+    return;
+  }
+  v = ns;
+  atomic_fetch_add_explicit(&h->buckets[bucket_of(v)], 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&h->count, 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&h->sum, v, memory_order_relaxed);
+  old = atomic_load_explicit(&h->max, memory_order_relaxed);
+  while (v > old && !atomic_compare_exchange_weak_explicit(&h->max, &old, v,
+                                                          memory_order_relaxed,
+                                                          memory_order_relaxed)) {
+  }
+}
+
+/*
+ * stats_hist_quantiles - 오름차순인 분위 q[0..nq) 마다 그 값 이하인 칸의 가장 큰 값
+ *   (최댓값을 넘지 않게 자름)을 out 에 씀. 비어 있으면 모두 0
+ */
+void stats_hist_quantiles(stats_hist_t *h, const double *q, int nq, unsigned long *out) {
+  static __thread unsigned long snap[STATS_NBUCKETS];
+  unsigned long total = 0, seen = 0, want, max, v;
+  int i, k;
+
+  for (i = 0; i < STATS_NBUCKETS; i++) {
+    snap[i] = atomic_load_explicit(&h->buckets[i], memory_order_relaxed);
+    total += snap[i];
+  }
+  max = atomic_load_explicit(&h->max, memory_order_relaxed);
+  for (k = 0, i = 0; k < nq; k++) {
+    if (total == 0) {
+      out[k] = 0;
+      continue;
+    }
+    // 작은 쪽부터 q[k] 에 해당하는 순번 (1 부터)
+    want = (unsigned long)(q[k] * total + 0.999999);
+    if (want < 1) {
+      want = 1;
+    }
+    while (seen < want && i < STATS_NBUCKETS) {
+      seen += snap[i++];
+    }
+    v = bucket_high(i - 1);
+    out[k] = v < max ? v : max;
+  }
+}
+
+/*
+ * stats_record - phase 단계에 걸린 시간 ns 를 기록, 음수(시점을 못 찍음)는 무시
+ */
+void stats_record(int phase, long long ns) {
+  stats_hist_add(&hists[phase], ns);
+}
+
+/*
+ * stats_count - 카운터에 n 을 더함
+ */
+void stats_count(int counter, long long n) {
+  atomic_fetch_add_explicit(&counters[counter], n, memory_order_relaxed);
+}
+
+/*
+ * span - a 부터 b 까지 걸린 시간, 둘 중 하나라도 찍지 못했으면 -1
+ */
+static long long span(long long a, long long b) {
+  return a && b ? b - a : -1;
+}
+
+/*
+ * stats_finish - 끝난 요청 하나의 시점들을 단계별로 기록하고 카운터를 올림
+ *   kind 는 SC_HITS, SC_MISSES, SC_COALESCED 중 하나, 헤더 파싱 전에 실패했으면 -1
+ */
+void stats_finish(stats_times_t *t, int kind, int status, long long bytes) {
+  if (!t->done) {
+    t->done = stats_now();
+  }
+  stats_record(ST_READ, span(t->ready, t->head));
+  stats_record(ST_CONNECT, span(t->head, t->connect));
+  stats_record(ST_TTFB, span(t->connect, t->first));
+  stats_record(ST_TRANSFER, span(t->first, t->done));
+  if (kind == SC_HITS) {
+    stats_record(ST_HIT, span(t->head, t->done));
+  }
+  stats_record(ST_TOTAL, span(t->ready, t->done));
+
+  stats_count(SC_REQUESTS, 1);
+  if (kind >= 0) {
+    stats_count(kind, 1);
+  }
+  if (status >= 400) {
+    stats_count(SC_ERRORS, 1);
+  }
+  stats_count(SC_BYTES, bytes);
+}
+
+/*
+ * stats_match - 통계 페이지 요청인지 확인
+ * @return 아니면 -1, text 면 0, JSON 이면 1
+ */
+int stats_match(view_t hostname, view_t pathname) {
+  int n = strlen(STATS_PATH);
+  view_t rest;
+
+  if (!view_is(hostname, STATS_HOST) || pathname.len < n ||
+      memcmp(pathname.p, STATS_PATH, n)) {
+    return -1;
+  }
+  rest.p = pathname.p + n;
+  rest.len = pathname.len - n;
+  if (rest.len == 0 || view_is(rest, "?text") || view_is(rest, "?format=text")) {
+    return 0;
+  }
+  if (view_is(rest, ".json") || view_is(rest, "?json") || view_is(rest, "?format=json")) {
+    return 1;
+  }
+  return -1;
+}
+
+/* 백분위수를 구할 때 쓰는 한 단계의 스냅샷 */
+typedef struct {
+  unsigned long count, max;
+  double mean;
+  unsigned long p[4];                   /* p50, p90, p99, p999 */
+} summary_t;
+
+static const double quantiles[4] = {0.50, 0.90, 0.99, 0.999};
+static const char *quantile_name[4] = {"p50", "p90", "p99", "p999"};
+
+/*
+ * summarize - 히스토그램 하나의 개수, 평균, 최댓값, 백분위수
+ */
+static void summarize(stats_hist_t *h, summary_t *s) {
+  unsigned long count = atomic_load_explicit(&h->count, memory_order_relaxed);
+
+  s->count = count;
+  s->max = atomic_load_explicit(&h->max, memory_order_relaxed);
+  s->mean = count ? (double)atomic_load_explicit(&h->sum, memory_order_relaxed) / count : 0;
+  stats_hist_quantiles(h, quantiles, 4, s->p);
+}
+
+/*
+ * stats_render - 현재 통계를 buf 에 씀 (json 이 0 이면 text)
+ * @return 쓴 길이
+ */
+int stats_render(char *buf, size_t size, int json) {
+  double uptime = (stats_now() - started) / 1e9;
+  summary_t s;
+  size_t n = 0;
+  int i, q;
+
+#define PUT(...)                                              \
+  do {                                                        \
+    if (n < size) {                                           \
+      n += snprintf(buf + n, size - n, __VA_ARGS__);          \
+    }                                                         \
+  } while (0)
+
+  if (json) {
+    PUT("{\"uptime_s\":%.3f,\"counters\":{", uptime);
+    for (i = 0; i < SC_NCOUNTERS; i++) {
+      PUT("%s\"%s\":%lu", i ? "," : "", counter_name[i],
+          atomic_load_explicit(&counters[i], memory_order_relaxed));
+    }
+    PUT("},\"phases_us\":{");
+    for (i = 0; i < ST_NPHASES; i++) {
+      summarize(&hists[i], &s);
+      PUT("%s\"%s\":{\"count\":%lu,\"mean\":%.1f", i ? "," : "", phase_name[i], s.count,
+          s.mean / 1e3);
+      for (q = 0; q < 4; q++) {
+        PUT(",\"%s\":%.1f", quantile_name[q], s.p[q] / 1e3);
+      }
+      PUT(",\"max\":%.1f}", s.max / 1e3);
+    }
+    PUT("}}\n");
+  } else {
+    PUT("uptime %.3f s\n\n", uptime);
+    for (i = 0; i < SC_NCOUNTERS; i++) {
+      PUT("%-16s %lu\n", counter_name[i],
+          atomic_load_explicit(&counters[i], memory_order_relaxed));
+    }
+    PUT("\n%-9s %9s %10s %10s %10s %10s %10s %10s  (us)\n", "phase", "count", "mean",
+        "p50", "p90", "p99", "p999", "max");
+    for (i = 0; i < ST_NPHASES; i++) {
+      summarize(&hists[i], &s);
+      PUT("%-9s %9lu %10.1f", phase_name[i], s.count, s.mean / 1e3);
+      for (q = 0; q < 4; q++) {
+        PUT(" %10.1f", s.p[q] / 1e3);
+      }
+      PUT(" %10.1f\n", s.max / 1e3);
+    }
+  }
+#undef PUT
+  return n < size ? n : size - 1;
+}
+
+/*
+ * stats_response - 통계 페이지 응답 전체(헤더 + 바디)를 buf 에 씀
+ *   Connection 헤더는 붙이지 않으므로 보내는 쪽이 정함
+ * @return 쓴 길이
+ */
+int stats_response(char *buf, size_t size, int json) {
+  char body[STATS_BODYSIZE];
+  int n, len;
+
+  n = stats_render(body, sizeof(body), json);
+  len = snprintf(buf, size, "HTTP/1.0 200 OK\r\nContent-type: %s\r\nContent-length: %d\r\n"
+                 "Cache-Control: no-store\r\n\r\n%s",
+                 json ? "application/json" : "text/plain; charset=utf-8", n, body);
+  return len < (int)size ? len : (int)size - 1;
+}
@@ -0,0 +1,85 @@
+/*
+ * stats.h - 요청 처리 단계별 지연 시간 히스토그램과 카운터
+ *
+ * 요청마다 아래 시점에 시각을 찍고, 이웃한 두 시점 사이의 시간을 단계별
+ * 히스토그램에 넣는다.
+ *
+ *   accept -> (대기 큐) -> 워커가 꺼냄 -> 요청 헤더 파싱 끝 -> 원격 서버 연결
+ *          -> 원격 서버 첫 바이트 -> 클라이언트에게 마지막 바이트
+ *
+ * 히스토그램은 HDR 처럼 2 의 거듭제곱 구간마다 STATS_SUB 개의 칸으로 나눈
+ * log-linear 구조라서 값의 크기와 상관없이 상대 오차가 1/STATS_SUB 이하다.
+ * 기록은 칸 하나에 atomic add 한 번이라 lock 이 없다.
+ *
+ * http://proxy.local/__stats 로 요청하면 원격 서버에 가지 않고 현재 값을
+ * text 로, ?json 을 붙이면 JSON 으로 돌려준다.
+ */
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <stdatomic.h>
+#include "httpparse.h"
+
+#define STATS_HOST "proxy.local"
+#define STATS_PATH "/__stats"
+#define STATS_BODYSIZE 4096                /* 통계 페이지 바디 최대 크기 */
+
+#define STATS_SUBBITS 5                     /* 구간 하나를 2^5 칸으로 */
+#define STATS_SUB     (1 << STATS_SUBBITS)
+#define STATS_MAXEXP  40                    /* 2^40 ns (약 18 분) 까지 기록, 넘으면 마지막 칸 */
+#define STATS_NBUCKETS ((STATS_MAXEXP - STATS_SUBBITS + 2) * STATS_SUB)
+
+/* 단계 */
+#define ST_QUEUE    0   /* accept -> 워커가 꺼냄 (쓰레드 엔진) */
+#define ST_READ     1   /* 연결이 준비됨 -> 요청 줄과 헤더 파싱 끝 */
+#define ST_CONNECT  2   /* 헤더 파싱 끝 -> 원격 서버 연결 (이름 해석, 풀 포함) */
+#define ST_TTFB     3   /* 원격 서버 연결 -> 응답 첫 바이트 */
+#define ST_TRANSFER 4   /* 응답 첫 바이트 -> 클라이언트에게 마지막 바이트 */
+#define ST_HIT      5   /* 캐시 hit: 헤더 파싱 끝 -> 마지막 바이트 */
+#define ST_TOTAL    6   /* 연결이 준비됨 -> 마지막 바이트 */
+#define ST_NPHASES  7
+
+/* 카운터 */
+#define SC_CONNS      0   /* accept 한 연결 */
+#define SC_REQUESTS   1
+#define SC_HITS       2
+#define SC_MISSES     3
+#define SC_COALESCED  4   /* 다른 쓰레드가 받아오던 응답을 같이 받음 */
+#define SC_ERRORS     5   /* 상태 코드 400 이상 */
+#define SC_BYTES      6   /* 클라이언트에게 보낸 바이트 */
+#define SC_UPREUSED   7   /* upstream 풀에서 꺼낸 연결을 씀 */
+#define SC_UPNEW      8   /* 원격 서버에 새로 연결 */
+#define SC_UPTIMEOUT  9   /* 원격 서버 마감 초과 (deadline.h) */
+#define SC_UPREJECTED 10  /* circuit breaker 가 열려 있어서 바로 실패시킴 */
+#define SC_NCOUNTERS  11
+
+/* log-linear 히스토그램 하나 (값은 ns), 여러 쓰레드가 동시에 기록해도 됨 */
+typedef struct {
+  atomic_ulong count;
+  atomic_ulong sum;
+  atomic_ulong max;
+  atomic_ulong buckets[STATS_NBUCKETS];
+} stats_hist_t;
+
+/* 요청 하나의 시점들 (stats_now, 찍지 못한 시점은 0) */
+typedef struct {
+  long long ready;      /* accept 했거나 keep-alive 연결에서 다음 요청이 보임 */
+  long long head;       /* 요청 줄과 헤더 파싱 끝 */
+  long long connect;    /* 원격 서버 연결 */
+  long long first;      /* 원격 서버 응답 첫 바이트 */
+  long long done;       /* 클라이언트에게 마지막 바이트 */
+} stats_times_t;
+
+void stats_hist_add(stats_hist_t *h, long long ns);
+void stats_hist_quantiles(stats_hist_t *h, const double *q, int nq, unsigned long *out);
+
+void stats_init(void);
+long long stats_now(void);
+void stats_record(int phase, long long ns);
+void stats_count(int counter, long long n);
+void stats_finish(stats_times_t *t, int kind, int status, long long bytes);
+int stats_match(view_t hostname, view_t pathname);
+int stats_render(char *buf, size_t size, int json);
+int stats_response(char *buf, size_t size, int json);
+
+#endif /* __STATS_H__ */
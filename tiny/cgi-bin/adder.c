@@ -1,41 +1,39 @@
 /*
  * adder.c - a minimal CGI program that adds two numbers together
+ *   tiny 의 CGI 워커로 실행되면 (cgiworker.h) 한 번 뜬 채로 요청을 계속 받음
  */
 #include "csapp.h"
+#include "cgiworker.h"
+
 int main(void) {
-  char *buf, *p; 
-  char arg1[MAXLINE], arg2[MAXLINE], content[MAXLINE];
-  int n1=0, n2=0;
+  char *buf, *p, *method;
+  char arg1[MAXLINE], arg2[MAXLINE], content[MAXLINE], header[MAXLINE];
+  int n1, n2, len;
 
-  // 숙제문제 11.10
-  // 인수 추출
-  if ((buf = getenv("QUERY_STRING")) != NULL) {
-    p = strchr(buf, '&');
-    *p = '\0';
-    strcpy(arg1, buf);
-    strcpy(arg2, p+1);
-    n1 = atoi(arg1);
-    n2 = atoi(arg2);
-  }
+  while (cgi_accept()) {
+    n1 = n2 = 0;
+    // 숙제문제 11.10
+    // 인수 추출 (환경 변수 값은 그대로 두고 복사해서 씀)
+    if ((buf = getenv("QUERY_STRING")) != NULL && (p = strchr(buf, '&')) != NULL) {
+      snprintf(arg1, MAXLINE, "%.*s", (int)(p - buf), buf);
+      snprintf(arg2, MAXLINE, "%s", p + 1);
+      n1 = atoi(arg1);
+      n2 = atoi(arg2);
+    }
 
-  // response body 만들기
-  sprintf(content, "QUERY_STRING=%s", buf);
-  sprintf(content, "Welcome to add.com: ");
-  sprintf(content, "%sTHE Internet addition portal.\r\n<p>", content);
-  sprintf(content, "%sThe answer is: %d + %d = %d\r\n<p>", content, n1, n2, n1 + n2);
-  sprintf(content, "%sThanks for visiting!\r\n", content);
+    // response body 만들기
+    len = snprintf(content, MAXLINE, "Welcome to add.com: THE Internet addition portal.\r\n<p>"
+                   "The answer is: %d + %d = %d\r\n<p>Thanks for visiting!\r\n",
+                   n1, n2, n1 + n2);
 
-  // HTTP 응답 생성
-  printf("Connection: close\r\n");
-  printf("Content-length: %d\r\n", (int)strlen(content));
-  printf("Content-type: text/html\r\n\r\n");
+    // HTTP 응답 생성
+    cgi_write(header, snprintf(header, MAXLINE, "Connection: close\r\nContent-length: %d\r\n"
+                               "Content-type: text/html\r\n\r\n", len));
 
-  if (getenv("REQUEST_METHOD") != NULL){
-    fflush(stdout);
-    exit(0);
+    if ((method = getenv("REQUEST_METHOD")) == NULL || strcasecmp(method, "HEAD")) {
+      cgi_write(content, len);
+    }
+    cgi_finish();
   }
-
-  printf("%s", content);
-  fflush(stdout);
   exit(0);
-}
\ No newline at end of file
+}
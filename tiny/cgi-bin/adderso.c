@@ -0,0 +1,26 @@
+/*
+ * adderso.c - adder 를 tiny 의 in-process 핸들러로 만든 것 (cgi-bin/adder.so)
+ *   프로세스를 띄우지 않고 워커 쓰레드에서 바로 불림 (../plugin.h)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "plugin.h"
+
+int tiny_plugin_abi = TINY_PLUGIN_ABI;
+
+int tiny_handle(const tiny_request_t *req, tiny_response_t *resp) {
+  const char *p = strchr(req->query, '&');
+  int n1 = 0, n2 = 0, len;
+
+  // 숙제문제 11.10 과 같은 인수 "n1&n2"
+  if (p != NULL) {
+    n1 = atoi(req->query);
+    n2 = atoi(p + 1);
+  }
+  len = snprintf(resp->body, resp->size, "Welcome to add.com: THE Internet addition portal.\r\n"
+                 "<p>The answer is: %d + %d = %d\r\n<p>Thanks for visiting!\r\n",
+                 n1, n2, n1 + n2);
+  resp->len = len < (int)resp->size ? len : resp->size;
+  return 0;
+}
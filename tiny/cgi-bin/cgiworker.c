@@ -0,0 +1,83 @@
+/*
+ * cgiworker.c - CGI 프로그램 쪽 요청 루프 (tiny 의 cgipool 워커 프로토콜)
+ */
+#include "csapp.h"
+#include "cgipool.h"
+#include "cgiworker.h"
+
+/* tiny 가 실행 파일에서 찾는 표시, 이 파일을 링크하면 워커로 실행됨 (../cgipool.h) */
+__attribute__((used)) const char cgi_marker[] = CGI_MARKER;
+
+static int persist = -1;    /* 워커로 실행됐는지, 처음 cgi_accept 에서 정함 */
+static int served;          /* 워커가 아닐 때 이미 요청 하나를 처리했는지 */
+
+/*
+ * cgi_accept - 다음 요청을 받아 환경 변수(QUERY_STRING 등)로 설정
+ * @return 처리할 요청이 있으면 1, tiny 가 소켓을 닫았으면 (또는 워커가 아니면 두 번째부터) 0
+ */
+int cgi_accept(void) {
+  char buf[CGI_MSGSIZE], *p, *eq;
+  ssize_t n;
+
+  if (persist < 0) {
+    persist = getenv(CGI_ENV_PERSIST) != NULL;
+  }
+  if (!persist) {
+    return served++ == 0;
+  }
+  do {
+    n = recv(STDIN_FILENO, buf, sizeof(buf) - 1, 0);
+  } while (n < 0 && errno == EINTR);
+  if (n <= 0 || buf[0] != CGI_REC_REQUEST) {
+    return 0;
+  }
+  buf[n] = '\0';
+  // 이전 요청의 값이 남지 않도록 지우고 "NAME=value\0" 들을 다시 설정
+  unsetenv("QUERY_STRING");
+  unsetenv("REQUEST_METHOD");
+  for (p = buf + 1; p < buf + n; p += strlen(p) + 1) {
+    if ((eq = strchr(p, '=')) != NULL) {
+      *eq = '\0';
+      setenv(p, eq + 1, 1);
+    }
+  }
+  return 1;
+}
+
+/*
+ * cgi_write - 응답 출력, 워커면 CGI_REC_DATA 레코드로 나눠서 보냄
+ */
+void cgi_write(const char *data, size_t n) {
+  char buf[CGI_MSGSIZE];
+  size_t m;
+
+  if (!persist) {
+    fwrite(data, 1, n, stdout);
+    return;
+  }
+  buf[0] = CGI_REC_DATA;
+  while (n > 0) {
+    m = n < sizeof(buf) - 1 ? n : sizeof(buf) - 1;
+    memcpy(buf + 1, data, m);
+    if (send(STDIN_FILENO, buf, m + 1, MSG_NOSIGNAL) < 0) {
+      exit(1);
+    }
+    data += m;
+    n -= m;
+  }
+}
+
+/*
+ * cgi_finish - 요청 하나의 응답 끝
+ */
+void cgi_finish(void) {
+  char end = CGI_REC_END;
+
+  if (!persist) {
+    fflush(stdout);
+    return;
+  }
+  if (send(STDIN_FILENO, &end, 1, MSG_NOSIGNAL) < 0) {
+    exit(1);
+  }
+}
@@ -0,0 +1,23 @@
+/*
+ * cgiworker.h - CGI 프로그램 쪽 요청 루프 (tiny 의 cgipool 워커 프로토콜)
+ *
+ *   while (cgi_accept()) {
+ *     ... getenv("QUERY_STRING") ...
+ *     cgi_write(헤더와 바디);
+ *     cgi_finish();
+ *   }
+ *
+ * 워커로 실행되지 않았으면 (CGI_ENV_PERSIST 가 없으면) 첫 cgi_accept 만 1 을
+ * 돌려주고 cgi_write 는 stdout 에 쓰므로, 같은 프로그램이 예전 방식으로도
+ * 그대로 돈다.
+ */
+#ifndef __CGIWORKER_H__
+#define __CGIWORKER_H__
+
+#include <stddef.h>
+
+int cgi_accept(void);
+void cgi_write(const char *data, size_t n);
+void cgi_finish(void);
+
+#endif /* __CGIWORKER_H__ */
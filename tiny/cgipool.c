@@ -0,0 +1,279 @@
+/*
+ * cgipool.c - 오래 사는 CGI 워커 프로세스 풀
+ *
+ * 워커를 띄우고 거두는 일은 그 워커를 꺼내 간 쓰레드가 lock 밖에서 한다.
+ * lock 은 쉬는 워커 목록과 기다리는 수를 바꿀 때만 잡는다.
+ */
+#include <sys/socket.h>
+#include "csapp.h"
+#include "cgipool.h"
+
+#define CGI_UNSENT -4       /* 요청을 넘기지도 못함, 워커가 쉬는 동안 죽어 있었음 (exchange 안에서만) */
+
+/* 워커 프로세스 하나 */
+typedef struct {
+  pid_t pid;
+  int fd;                   /* 워커와 이어진 소켓, 아직 안 띄웠거나 거뒀으면 -1 */
+  int nreqs;                /* 지금 프로세스가 처리한 요청 수 */
+} cgi_worker_t;
+
+/* CGI 프로그램 하나의 워커들 */
+typedef struct cgi_prog {
+  char *path;
+  int legacy;               /* 프로토콜을 모름, 요청마다 Fork + Execve */
+  cgi_worker_t *workers;
+  cgi_worker_t **idle;      /* 쉬는 워커 스택 */
+  int nidle;
+  int nwait;                /* 워커를 기다리는 요청 수 */
+  pthread_cond_t cond;      /* 워커가 돌아옴 */
+  struct cgi_prog *next;
+} cgi_prog_t;
+
+static struct {
+  int n;                    /* 프로그램마다 워커 수, 0 이면 풀을 쓰지 않음 */
+  pthread_mutex_t lock;
+  cgi_prog_t *progs;
+  char **env;               /* 워커 환경: tiny 의 환경 + CGI_ENV_PERSIST=1 */
+} pool = {0, PTHREAD_MUTEX_INITIALIZER, NULL, NULL};
+
+/*
+ * cgi_init - 프로그램마다 워커 nworkers 개를 쓰도록 설정 (0 이면 끔)
+ *   워커는 프로그램이 처음 요청될 때 띄움
+ */
+void cgi_init(int nworkers) {
+  int n;
+
+  pool.n = nworkers;
+  for (n = 0; environ[n]; n++)
+    ;
+  pool.env = Calloc(n + 2, sizeof(char *));
+  memcpy(pool.env, environ, n * sizeof(char *));
+  pool.env[n] = CGI_ENV_PERSIST "=1";
+}
+
+/*
+ * has_marker - 실행 파일 path 에 CGI_MARKER 가 들어 있는지 (워커 프로토콜을 아는지)
+ */
+static int has_marker(char *path) {
+  struct stat sbuf;
+  size_t len = strlen(CGI_MARKER);
+  char *map, *p, *end;
+  int fd, found = 0;
+
+  if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+    return 0;
+  }
+  if (fstat(fd, &sbuf) == 0 && sbuf.st_size > 0) {
+    map = mmap(NULL, sbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map != MAP_FAILED) {
+      end = map + sbuf.st_size;
+      for (p = map; !found && (p = memchr(p, CGI_MARKER[0], end - p)) != NULL; p++) {
+        found = (size_t)(end - p) >= len && !memcmp(p, CGI_MARKER, len);
+      }
+      munmap(map, sbuf.st_size);
+    }
+  }
+  close(fd);
+  return found;
+}
+
+/*
+ * find_prog - path 의 워커 묶음을 찾고 없으면 만듦 (lock 을 잡고 호출)
+ *   처음 만들 때 실행 파일을 한 번 훑어 워커 모드를 정함
+ */
+static cgi_prog_t *find_prog(char *path) {
+  cgi_prog_t *p;
+  int i;
+
+  for (p = pool.progs; p; p = p->next) {
+    if (!strcmp(p->path, path)) {
+      return p;
+    }
+  }
+  p = Calloc(1, sizeof(cgi_prog_t));
+  p->path = strcpy(Malloc(strlen(path) + 1), path);
+  p->legacy = !has_marker(path);
+  p->workers = Calloc(pool.n, sizeof(cgi_worker_t));
+  p->idle = Calloc(pool.n, sizeof(cgi_worker_t *));
+  for (i = 0; i < pool.n; i++) {
+    p->workers[i].fd = -1;
+    p->idle[p->nidle++] = &p->workers[i];
+  }
+  pthread_cond_init(&p->cond, NULL);
+  p->next = pool.progs;
+  pool.progs = p;
+  return p;
+}
+
+/*
+ * spawn - 워커 프로세스를 띄워 w 에 연결
+ * @return 성공 0, 실패 -1
+ */
+static int spawn(cgi_prog_t *p, cgi_worker_t *w) {
+  char *argv[] = {p->path, NULL};
+  struct timeval tv = {CGI_RUN_MS / 1000, CGI_RUN_MS % 1000 * 1000};
+  int sv[2], devnull;
+
+  if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) < 0) {
+    return -1;
+  }
+  devnull = open("/dev/null", O_WRONLY | O_CLOEXEC);
+  if ((w->pid = fork()) == 0) {
+    // dup2 로 받은 fd 에는 CLOEXEC 가 붙지 않음
+    dup2(sv[1], STDIN_FILENO);
+    dup2(devnull, STDOUT_FILENO);
+    execve(p->path, argv, pool.env);
+    _exit(127);
+  }
+  close(sv[1]);
+  close(devnull);
+  if (w->pid < 0) {
+    close(sv[0]);
+    return -1;
+  }
+  // 멈춘 워커에 묶여 있지 않도록
+  setsockopt(sv[0], SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  w->fd = sv[0];
+  w->nreqs = 0;
+  return 0;
+}
+
+/*
+ * retire - 워커를 끝내고 거둠. 소켓을 닫으면 워커는 EOF 를 보고 끝나고,
+ *   kill_it 이 1 이면 (응답 도중 문제) 기다리지 않고 죽임
+ */
+static void retire(cgi_worker_t *w, int kill_it) {
+  close(w->fd);
+  w->fd = -1;
+  if (kill_it) {
+    kill(w->pid, SIGKILL);
+  }
+  waitpid(w->pid, NULL, 0);
+}
+
+/*
+ * exchange - 워커 w 에게 요청 하나를 넘기고 응답을 클라이언트 fd 로 흘려보냄
+ *   첫 출력 앞에 prefix (상태 줄)를 붙임. 클라이언트가 끊어도 워커와 맞춰
+ *   두려고 CGI_REC_END 까지는 읽음
+ * @return CGI_OK, 요청을 넘기지 못했으면 CGI_UNSENT, 넘긴 뒤 워커가 CGI_REC_END
+ *         전에 끝났거나 멈췄으면 CGI_FAILED (워커는 거둠, 이미 보낸 게 있으면
+ *         bytes 가 0 이 아님)
+ */
+static int exchange(cgi_worker_t *w, int fd, char *cgiargs, char *method, char *prefix,
+                    long *bytes) {
+  char buf[CGI_MSGSIZE];
+  int len, client_ok = 1;
+  ssize_t n;
+
+  len = snprintf(buf, sizeof(buf), "%cQUERY_STRING=%s%cREQUEST_METHOD=%s%c", CGI_REC_REQUEST,
+                 cgiargs, '\0', method, '\0');
+  if (len >= (int)sizeof(buf)) {
+    return CGI_FAILED;
+  }
+  if (send(w->fd, buf, len, MSG_NOSIGNAL) != len) {
+    retire(w, 1);
+    return CGI_UNSENT;
+  }
+  while (1) {
+    if ((n = recv(w->fd, buf, sizeof(buf), 0)) <= 0) {
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      retire(w, 1);
+      return CGI_FAILED;
+    }
+    if (buf[0] == CGI_REC_END) {
+      break;
+    }
+    if (buf[0] != CGI_REC_DATA || !client_ok) {
+      continue;
+    }
+    if (*bytes == 0) {
+      if (rio_writen(fd, prefix, strlen(prefix)) < 0) {
+        client_ok = 0;
+        continue;
+      }
+      *bytes += strlen(prefix);
+    }
+    if (rio_writen(fd, buf + 1, n - 1) < 0) {
+      client_ok = 0;
+      continue;
+    }
+    *bytes += n - 1;
+  }
+  if (++w->nreqs >= CGI_MAXREQS) {
+    retire(w, 0);
+  }
+  return CGI_OK;
+}
+
+/*
+ * cgi_serve - filename 의 워커에게 요청을 넘기고 응답을 fd 로 보냄
+ *   prefix 는 워커 출력 앞에 붙일 상태 줄과 서버 헤더, bytes 에 보낸 바이트 수
+ * @return CGI_OK, CGI_BUSY, CGI_FAILED, CGI_LEGACY (cgipool.h)
+ */
+int cgi_serve(int fd, char *filename, char *cgiargs, char *method, char *prefix,
+              long *bytes) {
+  struct timespec deadline;
+  cgi_worker_t *w;
+  cgi_prog_t *p;
+  int rc, timedout = 0, tries, reused;
+
+  *bytes = 0;
+  if (pool.n == 0) {
+    return CGI_LEGACY;
+  }
+  pthread_mutex_lock(&pool.lock);
+  p = find_prog(filename);
+  if (p->legacy) {
+    pthread_mutex_unlock(&pool.lock);
+    return CGI_LEGACY;
+  }
+  // 쉬는 워커가 없으면 기다리되, 줄이 너무 길면 바로 거절
+  if (p->nidle == 0 && p->nwait >= CGI_MAXWAIT) {
+    pthread_mutex_unlock(&pool.lock);
+    return CGI_BUSY;
+  }
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += CGI_WAIT_MS / 1000;
+  deadline.tv_nsec += CGI_WAIT_MS % 1000 * 1000000L;
+  if (deadline.tv_nsec >= 1000000000L) {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000L;
+  }
+  p->nwait++;
+  while (p->nidle == 0 && !timedout) {
+    timedout = pthread_cond_timedwait(&p->cond, &pool.lock, &deadline) == ETIMEDOUT;
+  }
+  p->nwait--;
+  if (p->nidle == 0) {
+    pthread_mutex_unlock(&pool.lock);
+    return CGI_BUSY;
+  }
+  w = p->idle[--p->nidle];
+  pthread_mutex_unlock(&pool.lock);
+
+  // 처음이거나 교체된 워커면 여기서 띄움. 쉬는 동안 죽은 워커였으면
+  // (요청을 넘기지도 못함) 새로 띄워서 한 번 더 시도. 요청을 받은 뒤 죽은
+  // 워커는 이미 실행했을 수 있으므로 다시 보내지 않음
+  for (tries = 0; tries < 2; tries++) {
+    reused = w->fd >= 0;
+    if (!reused && spawn(p, w) < 0) {
+      rc = CGI_FAILED;
+      break;
+    }
+    rc = exchange(w, fd, cgiargs, method, prefix, bytes);
+    if (rc != CGI_UNSENT || !reused) {
+      break;
+    }
+  }
+  if (rc == CGI_UNSENT) {
+    rc = CGI_FAILED;
+  }
+
+  pthread_mutex_lock(&pool.lock);
+  p->idle[p->nidle++] = w;
+  pthread_cond_signal(&p->cond);
+  pthread_mutex_unlock(&pool.lock);
+  return rc;
+}
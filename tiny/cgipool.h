@@ -0,0 +1,50 @@
+/*
+ * cgipool.h - 오래 사는 CGI 워커 프로세스 풀 (FastCGI 비슷한 방식)
+ *
+ * 요청마다 Fork + Execve 하지 않고, CGI 프로그램마다 워커 프로세스를 미리
+ * 띄워 두고 Unix 소켓으로 요청을 넘긴다.
+ *
+ * - 워커는 fd 0 에 SOCK_SEQPACKET 소켓을 받고 환경 변수 CGI_ENV_PERSIST 가
+ *   켜진 채로 실행된다. 메시지 경계가 유지되므로 레코드마다 첫 바이트로
+ *   종류를 구분한다.
+ *     tiny -> 워커: CGI_REC_REQUEST + "NAME=value\0NAME=value\0..."
+ *     워커 -> tiny: CGI_REC_DATA + 출력 (여러 개) 후 CGI_REC_END 하나
+ *   출력은 예전 CGI 의 stdout 과 같다 (헤더, 빈 줄, 바디).
+ * - 한 워커는 한 번에 요청 하나만 처리한다. 쉬는 워커가 없으면 기다리되,
+ *   이미 CGI_MAXWAIT 명이 기다리고 있거나 CGI_WAIT_MS 가 지나면 바로 503 으로
+ *   돌려보낸다 (back-pressure).
+ * - 워커는 CGI_MAXREQS 번 처리하면 소켓을 닫아 끝내고 새로 띄운다. 처리 중에
+ *   죽거나 CGI_RUN_MS 동안 아무것도 보내지 않으면 죽이고 새로 띄운다.
+ * - 워커 모드는 프로그램을 실행하기 전에 정한다. 워커 쪽 요청 루프
+ *   (cgi-bin/cgiworker.c) 를 링크한 프로그램에는 CGI_MARKER 문자열이 들어
+ *   있고, 처음 요청될 때 실행 파일에서 이 문자열을 찾지 못한 프로그램은
+ *   예전처럼 요청마다 Fork + Execve 한다. 워커를 띄우지 못했다고 해서 예전
+ *   방식으로 바꾸지는 않는다.
+ */
+#ifndef __CGIPOOL_H__
+#define __CGIPOOL_H__
+
+#define CGI_ENV_PERSIST "TINY_CGI_PERSIST"  /* 워커 모드로 실행됐음을 알리는 환경 변수 */
+#define CGI_MARKER "TINY_CGI_WORKER_PROTOCOL_1"  /* 워커 프로토콜을 아는 실행 파일의 표시 */
+#define CGI_MSGSIZE   8192  /* 레코드 하나의 최대 크기 (종류 바이트 포함) */
+#define CGI_MAXREQS  10000  /* 워커 하나가 처리하고 교체되는 요청 수 */
+#define CGI_MAXWAIT     32  /* 프로그램 하나에 워커를 기다릴 수 있는 요청 수 */
+#define CGI_WAIT_MS   2000  /* 워커를 기다리는 최대 시간 */
+#define CGI_RUN_MS   10000  /* 워커가 출력 레코드 하나를 보내기까지 기다리는 최대 시간 */
+
+/* 레코드 종류 */
+#define CGI_REC_REQUEST 'R'
+#define CGI_REC_DATA    'D'
+#define CGI_REC_END     'E'
+
+/* cgi_serve 결과 */
+#define CGI_OK       0      /* 응답을 다 보냄 */
+#define CGI_BUSY    -1      /* 워커가 모자라서 보내지 못함 (503) */
+#define CGI_FAILED  -2      /* 워커가 응답을 끝내기 전에 죽음 (보낸 게 없으면 502) */
+#define CGI_LEGACY  -3      /* 풀을 쓸 수 없는 프로그램, Fork + Execve 로 처리할 것 */
+
+void cgi_init(int nworkers);
+int cgi_serve(int fd, char *filename, char *cgiargs, char *method, char *prefix,
+              long *bytes);
+
+#endif /* __CGIPOOL_H__ */
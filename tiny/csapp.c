@@ -22,6 +22,7 @@
  *   - rio_readnb: removed redundant EINTR check
  */
 /* $begin csapp.c */
+#define _GNU_SOURCE     /* accept4 */
 #include "csapp.h"
 
 /************************** 
@@ -589,6 +590,15 @@ int Accept(int s, struct sockaddr *addr, socklen_t *addrlen)
     return rc;
 }
 
+int Accept4(int s, struct sockaddr *addr, socklen_t *addrlen, int flags) 
+{
+    int rc;
+
+    if ((rc = accept4(s, addr, addrlen, flags)) < 0)
+	unix_error("Accept4 error");
+    return rc;
+}
+
 void Connect(int sockfd, struct sockaddr *serv_addr, int addrlen) 
 {
     int rc;
@@ -1013,8 +1023,8 @@ int open_listenfd(char *port)
 
     /* Walk the list for one that we can bind to */
     for (p = listp; p; p = p->ai_next) {
-        /* Create a socket descriptor */
-        if ((listenfd = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) < 0) 
+        /* Create a socket descriptor (not inherited by CGI children) */
+        if ((listenfd = socket(p->ai_family, p->ai_socktype | SOCK_CLOEXEC, p->ai_protocol)) < 0) 
             continue;  /* Socket failed, try the next */
 
         /* Eliminates "Address already in use" error from bind */
@@ -0,0 +1,278 @@
+/*
+ * filecache.c - tiny 의 열린 파일 / 메타데이터 캐시
+ *
+ * 항목은 (디렉터리 watch 번호, 파일 이름) 으로도 찾을 수 있어야 하므로
+ * 어느 watch 아래에 있는지(wd)와 경로의 마지막 이름(name)을 같이 들고
+ * 있다. "./a/b", "./a//b", "./c/../a/b" 처럼 다르게 쓴 경로도 커널이 같은
+ * 디렉터리에 같은 wd 를 주므로 무효화가 빠지지 않는다.
+ *
+ * 감시 쓰레드는 이벤트를 처리할 때마다 그 wd 의 세대를 올린다. fc_get 은
+ * 파일을 열기 전에 세대를 읽어 두고, 넣을 때 세대가 그대로일 때만 넣는다.
+ * 열고 나서 넣기 전에 처리된 이벤트는 지울 항목을 찾지 못하므로, 이렇게
+ * 하지 않으면 바뀌기 전의 fd 와 헤더가 계속 캐시에 남는다.
+ */
+#include <sys/inotify.h>
+#include <libgen.h>
+#include "filecache.h"
+
+#define FC_NGENS 64         /* wd 별 세대 칸 수, 칸을 같이 쓰는 wd 끼리는 세대도 같이 오름 */
+#define FC_EVENTS (IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | \
+                   IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF)
+
+/* 캐시 안에서만 쓰는 항목 정보 */
+typedef struct {
+  fc_entry_t e;
+  int wd;                   /* 파일이 있는 디렉터리의 inotify watch */
+  const char *name;         /* path 의 마지막 이름 */
+} fc_item_t;
+
+static struct {
+  int ifd;                  /* inotify fd, 못 만들었으면 -1 (캐시하지 않음) */
+  pthread_rwlock_t lock;    /* buckets, nfiles */
+  fc_item_t *buckets[FC_NBUCKETS];
+  int nfiles;
+  atomic_uint gens[FC_NGENS];  /* wd % FC_NGENS 의 무효화 세대 */
+} fc = {-1, PTHREAD_RWLOCK_INITIALIZER, {NULL}, 0};
+
+/*
+ * hash_path - FNV-1a
+ */
+static unsigned int hash_path(const char *s) {
+  unsigned int h = 2166136261u;
+
+  while (*s) {
+    h = (h ^ (unsigned char)*s++) * 16777619u;
+  }
+  return h;
+}
+
+/*
+ * get_filetype - derive file type from file name
+ */
+const char *get_filetype(char *filename) {
+  // 파일명 내에서 마지막 . 찾기 -> 파일명 중간에 확장자가 들어가는 케이스 방어
+  char *ext = strrchr(filename, '.');
+
+  if (ext != NULL) {
+    if (strcmp(ext, ".html") == 0) {
+      return "text/html";
+    } else if (strcmp(ext, ".gif") == 0) {
+      return "image/gif";
+    } else if (strcmp(ext, ".jpg") == 0 || strcmp(ext, ".jpeg") == 0) {
+      return "image/jpeg";
+    // 숙제문제 11.7
+    } else if (strcmp(ext, ".mp4") == 0) {
+      return "video/mp4";
+    }
+  }
+  // 확장자가 없거나 모르는 확장자일 경우 기본 값
+  return "text/plain";
+}
+
+/*
+ * render_header - 정적 파일 응답 헤더 만들기
+ */
+static char *render_header(fc_entry_t *e, int keepalive, int *len) {
+  char buf[MAXLINE];
+
+  *len = snprintf(buf, MAXLINE, "HTTP/1.0 200 OK\r\nServer: Tiny Web Server\r\n"
+                  "Accept-Ranges: bytes\r\nContent-length: %lld\r\n%sContent-type: %s\r\n\r\n", (long long)e->size,
+                  keepalive ? "Connection: keep-alive\r\n" : "", e->type);
+  return strcpy(Malloc(*len + 1), buf);
+}
+
+/*
+ * fc_release - 항목 사용 종료, 마지막 참조면 fd 를 닫고 해제
+ */
+void fc_release(fc_entry_t *e) {
+  if (atomic_fetch_sub(&e->refcnt, 1) != 1) {
+    return;
+  }
+  close(e->fd);
+  Free(e->hdr[0]);
+  Free(e->hdr[1]);
+  Free(e->path);
+  Free(e);
+}
+
+/*
+ * unlink_if - 조건에 맞는 항목을 모두 테이블에서 빼고 세대를 올림 (write lock 을 잡고 호출)
+ *   wd < 0 이면 전부, name 이 NULL 이면 그 디렉터리 전부
+ */
+static void unlink_if(int wd, const char *name) {
+  fc_item_t **pp, *it;
+  int i;
+
+  // 지금 파일을 열어서 넣으려는 쓰레드가 있으면 넣지 않게 함
+  for (i = 0; i < FC_NGENS; i++) {
+    if (wd < 0 || i == wd % FC_NGENS) {
+      atomic_fetch_add(&fc.gens[i], 1);
+    }
+  }
+
+  for (i = 0; i < FC_NBUCKETS; i++) {
+    for (pp = &fc.buckets[i]; (it = *pp) != NULL;) {
+      if (wd < 0 || (it->wd == wd && (!name || !strcmp(it->name, name)))) {
+        *pp = (fc_item_t *)it->e.next;
+        fc.nfiles--;
+        fc_release(&it->e);
+      } else {
+        pp = (fc_item_t **)&it->e.next;
+      }
+    }
+  }
+}
+
+/*
+ * watcher - inotify 이벤트를 받아서 바뀐 파일의 항목을 지우는 쓰레드
+ */
+static void *watcher(void *vargp) {
+  char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  struct inotify_event *ev;
+  ssize_t n;
+  char *p;
+
+  Pthread_detach(pthread_self());
+  while (1) {
+    if ((n = read(fc.ifd, buf, sizeof(buf))) <= 0) {
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    pthread_rwlock_wrlock(&fc.lock);
+    for (p = buf; p < buf + n; p += sizeof(struct inotify_event) + ev->len) {
+      ev = (struct inotify_event *)p;
+      if (ev->mask & IN_Q_OVERFLOW) {
+        // 놓친 이벤트가 있으므로 전부 버림
+        unlink_if(-1, NULL);
+      } else if (ev->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF)) {
+        unlink_if(ev->wd, NULL);
+      } else if (ev->len > 0) {
+        unlink_if(ev->wd, ev->name);
+      }
+    }
+    pthread_rwlock_unlock(&fc.lock);
+  }
+  // inotify 를 더 읽을 수 없으면 캐시를 끔
+  pthread_rwlock_wrlock(&fc.lock);
+  unlink_if(-1, NULL);
+  fc.ifd = -1;
+  pthread_rwlock_unlock(&fc.lock);
+  return NULL;
+}
+
+/*
+ * fc_init - inotify 를 열고 감시 쓰레드 시작. 실패하면 캐시 없이 동작
+ */
+void fc_init(void) {
+  pthread_t tid;
+
+  if ((fc.ifd = inotify_init1(IN_CLOEXEC)) < 0) {
+    fprintf(stderr, "filecache: inotify_init1 failed, caching disabled\n");
+    return;
+  }
+  Pthread_create(&tid, NULL, watcher, NULL);
+}
+
+/*
+ * lookup - path 항목 찾아서 참조를 올림 (lock 을 잡고 호출)
+ */
+static fc_entry_t *lookup(char *path, unsigned int h) {
+  fc_item_t *it;
+
+  for (it = fc.buckets[h % FC_NBUCKETS]; it; it = (fc_item_t *)it->e.next) {
+    if (it->e.hash == h && !strcmp(it->e.path, path)) {
+      atomic_fetch_add(&it->e.refcnt, 1);
+      return &it->e;
+    }
+  }
+  return NULL;
+}
+
+/*
+ * add_watch - path 가 있는 디렉터리를 watch 하고 wd 반환, 실패하면 -1
+ */
+static int add_watch(char *path) {
+  char dir[MAXLINE];
+  int wd;
+
+  strncpy(dir, path, MAXLINE - 1);
+  dir[MAXLINE - 1] = '\0';
+  // 같은 디렉터리면 커널이 같은 wd 를 돌려줌
+  wd = inotify_add_watch(fc.ifd, dirname(dir), FC_EVENTS);
+  if (wd < 0 && errno == ENOSPC) {
+    fprintf(stderr, "filecache: too many inotify watches, %s not cached\n", path);
+  }
+  return wd;
+}
+
+/*
+ * fc_get - 읽을 수 있는 정적 파일이면 항목을 반환 (다 쓰면 fc_release)
+ *   없거나 일반 파일이 아니거나 읽을 수 없으면 NULL (호출한 쪽이 에러 응답)
+ */
+fc_entry_t *fc_get(char *path) {
+  unsigned int h = hash_path(path);
+  fc_entry_t *e, *old;
+  fc_item_t *it;
+  struct stat st;
+  char *slash;
+  unsigned int gen = 0;
+  int fd, wd = -1;
+
+  pthread_rwlock_rdlock(&fc.lock);
+  e = fc.ifd >= 0 ? lookup(path, h) : NULL;
+  pthread_rwlock_unlock(&fc.lock);
+  if (e) {
+    return e;
+  }
+
+  // watch 를 먼저 걸고 세대를 읽어 둬야 여는 동안부터 넣기 전까지의 변경을
+  // 놓치지 않음
+  if (fc.ifd >= 0 && (wd = add_watch(path)) >= 0) {
+    gen = atomic_load(&fc.gens[wd % FC_NGENS]);
+  }
+  if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+    return NULL;
+  }
+  if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || !(S_IRUSR & st.st_mode)) {
+    close(fd);
+    return NULL;
+  }
+  // 처음부터 끝까지 읽는 파일이므로 커널 readahead 창을 키움
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+  it = Calloc(1, sizeof(fc_item_t));
+  e = &it->e;
+  e->path = strcpy(Malloc(strlen(path) + 1), path);
+  e->hash = h;
+  e->fd = fd;
+  e->size = st.st_size;
+  e->mtime = st.st_mtim;
+  e->type = get_filetype(path);
+  e->hdr[0] = render_header(e, 0, &e->hdrlen[0]);
+  e->hdr[1] = render_header(e, 1, &e->hdrlen[1]);
+  atomic_init(&e->refcnt, 1);
+  it->wd = wd;
+  it->name = (slash = strrchr(e->path, '/')) ? slash + 1 : e->path;
+
+  if (wd < 0) {
+    return e;   // 무효화할 수 없으므로 이번 요청에만 씀
+  }
+  pthread_rwlock_wrlock(&fc.lock);
+  if (fc.ifd >= 0 && (old = lookup(path, h)) != NULL) {
+    // 그 사이 다른 쓰레드가 넣었음
+    pthread_rwlock_unlock(&fc.lock);
+    fc_release(e);
+    return old;
+  }
+  // 연 뒤에 이 디렉터리의 이벤트가 처리됐으면 이번 요청에만 씀
+  if (fc.ifd >= 0 && fc.nfiles < FC_MAXFILES && atomic_load(&fc.gens[wd % FC_NGENS]) == gen) {
+    atomic_fetch_add(&e->refcnt, 1);
+    e->next = (fc_entry_t *)fc.buckets[h % FC_NBUCKETS];
+    fc.buckets[h % FC_NBUCKETS] = it;
+    fc.nfiles++;
+  }
+  pthread_rwlock_unlock(&fc.lock);
+  return e;
+}
@@ -0,0 +1,42 @@
+/*
+ * filecache.h - tiny 의 열린 파일 / 메타데이터 캐시
+ *
+ * 정적 파일 경로마다 열어 둔 fd, 크기, mtime, MIME 타입, 미리 만든 응답
+ * 헤더를 들고 있다. hit 이면 stat, open, close 와 확장자 비교 없이 바로
+ * sendfile 할 수 있다.
+ *
+ * - 파일이 있는 디렉터리마다 inotify watch 를 걸고, 감시 쓰레드가 이벤트를
+ *   받으면 그 이름의 항목을 지운다 (수정, 속성 변경, 삭제, 이름 바꿈).
+ *   이벤트가 넘쳤거나 디렉터리 자체가 사라지면 전부 지운다.
+ * - 항목은 refcount 로 관리하므로 보내는 중에 무효화되어도 fd 는 다 보낸
+ *   뒤에 닫힌다.
+ * - 조회는 read lock 하나만 잡으므로 여러 쓰레드가 동시에 불러도 된다.
+ */
+#ifndef __FILECACHE_H__
+#define __FILECACHE_H__
+
+#include <stdatomic.h>
+#include "csapp.h"
+
+#define FC_NBUCKETS 256     /* 해시 버킷 개수 */
+#define FC_MAXFILES 512     /* 열어 둘 최대 파일 수, 넘으면 캐시하지 않고 매번 엶 */
+
+typedef struct fc_entry {
+  char *path;               /* "./home.html" */
+  unsigned int hash;
+  int fd;
+  off_t size;
+  struct timespec mtime;
+  const char *type;         /* MIME 타입 */
+  char *hdr[2];             /* 미리 만든 응답 헤더 [0]: 닫음, [1]: keep-alive */
+  int hdrlen[2];
+  atomic_int refcnt;        /* 테이블 1 + 사용 중인 요청 수 */
+  struct fc_entry *next;    /* 같은 버킷의 다음 항목 */
+} fc_entry_t;
+
+void fc_init(void);
+fc_entry_t *fc_get(char *path);
+void fc_release(fc_entry_t *e);
+const char *get_filetype(char *filename);
+
+#endif /* __FILECACHE_H__ */
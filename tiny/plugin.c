@@ -0,0 +1,170 @@
+/*
+ * plugin.c - cgi-bin 의 .so 핸들러를 dlopen 으로 올려서 워커 쓰레드에서 바로 부름
+ */
+#include <dlfcn.h>
+#include <sys/uio.h>
+#include "csapp.h"
+#include "log.h"
+#include "plugin.h"
+
+/* 올린 플러그인 하나 */
+typedef struct plugin {
+  char *path;
+  tiny_handler_t handle;
+  struct plugin *next;
+} plugin_t;
+
+static plugin_t *plugins;
+static pthread_rwlock_t plugins_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+/*
+ * broken - 올리지 못한 플러그인 자리에 들어가는 핸들러 (항상 500)
+ */
+static int broken(const tiny_request_t *req, tiny_response_t *resp) {
+  return -1;
+}
+
+/*
+ * load - path 의 .so 를 올리고 ABI 를 확인해서 핸들러를 꺼냄, 실패하면 broken
+ */
+static tiny_handler_t load(char *path) {
+  void *dl;
+  int *abi;
+  tiny_handler_t handle;
+
+  if ((dl = dlopen(path, RTLD_NOW | RTLD_LOCAL)) == NULL) {
+    log_msg(LOG_ERROR, "plugin %s: %s", path, dlerror());
+    return broken;
+  }
+  abi = dlsym(dl, "tiny_plugin_abi");
+  handle = (tiny_handler_t)dlsym(dl, "tiny_handle");
+  if (abi == NULL || *abi != TINY_PLUGIN_ABI || handle == NULL) {
+    log_msg(LOG_ERROR, "plugin %s: missing tiny_handle or ABI mismatch", path);
+    dlclose(dl);
+    return broken;
+  }
+  return handle;
+}
+
+/*
+ * plugin_get - filename 이 .so 면 그 핸들러 (처음이면 여기서 올림)
+ * @return 핸들러, .so 가 아니면 NULL (예전처럼 프로그램으로 실행)
+ */
+tiny_handler_t plugin_get(char *filename) {
+  char *ext = strrchr(filename, '.');
+  tiny_handler_t handle = NULL;
+  plugin_t *p;
+
+  if (ext == NULL || strcmp(ext, ".so")) {
+    return NULL;
+  }
+  pthread_rwlock_rdlock(&plugins_lock);
+  for (p = plugins; p; p = p->next) {
+    if (!strcmp(p->path, filename)) {
+      handle = p->handle;
+      break;
+    }
+  }
+  pthread_rwlock_unlock(&plugins_lock);
+  if (handle) {
+    return handle;
+  }
+
+  // 두 쓰레드가 같이 올려도 dlopen 은 같은 핸들을 돌려주므로 먼저 넣은 쪽을 씀
+  handle = load(filename);
+  pthread_rwlock_wrlock(&plugins_lock);
+  for (p = plugins; p; p = p->next) {
+    if (!strcmp(p->path, filename)) {
+      handle = p->handle;
+      break;
+    }
+  }
+  if (p == NULL) {
+    p = Malloc(sizeof(plugin_t));
+    p->path = strcpy(Malloc(strlen(filename) + 1), filename);
+    p->handle = handle;
+    p->next = plugins;
+    plugins = p;
+  }
+  pthread_rwlock_unlock(&plugins_lock);
+  return handle;
+}
+
+/*
+ * reason - 상태 코드의 설명 문구
+ */
+static const char *reason(int status) {
+  switch (status) {
+  case 200: return "OK";
+  case 201: return "Created";
+  case 204: return "No Content";
+  case 400: return "Bad Request";
+  case 403: return "Forbidden";
+  case 404: return "Not Found";
+  case 503: return "Service Unavailable";
+  default:  return status < 400 ? "OK" : "Error";
+  }
+}
+
+/*
+ * plugin_serve - 핸들러를 불러서 그 응답을 헤더와 함께 한 번의 writev 로 보냄
+ *   바디 길이를 알므로 CGI 와 달리 keep-alive 연결을 유지할 수 있음
+ * @return 응답 상태, 핸들러가 실패했으면 -1 (아무것도 보내지 않았으니 호출한 쪽이 500)
+ */
+int plugin_serve(int fd, tiny_handler_t handle, char *filename, char *cgiargs, char *method,
+                 int keepalive, long *bytes) {
+  static __thread char *body;
+  char hdr[MAXLINE];
+  tiny_request_t req;
+  tiny_response_t resp;
+  struct iovec iov[2];
+  ssize_t n;
+  int len;
+
+  if (body == NULL) {
+    body = Malloc(PLUGIN_BUFSIZE);
+  }
+  req.method = method;
+  req.path = filename;
+  req.query = cgiargs;
+  resp.status = 200;
+  resp.type = "text/html";
+  resp.body = body;
+  resp.size = PLUGIN_BUFSIZE;
+  resp.len = 0;
+  *bytes = 0;
+  if (handle(&req, &resp) != 0 || resp.len > resp.size || resp.status < 100 ||
+      resp.status > 999) {
+    return -1;
+  }
+
+  len = snprintf(hdr, MAXLINE, "HTTP/1.0 %d %s\r\nServer: Tiny Web Server\r\n"
+                 "Content-length: %zu\r\n%sContent-type: %s\r\n\r\n", resp.status,
+                 reason(resp.status), resp.len, keepalive ? "Connection: keep-alive\r\n" : "",
+                 resp.type);
+  iov[0].iov_base = hdr;
+  iov[0].iov_len = len;
+  iov[1].iov_base = body;
+  // HEAD 메소드면 헤더만
+  iov[1].iov_len = strcasecmp(method, "HEAD") ? resp.len : 0;
+  while (iov[0].iov_len + iov[1].iov_len > 0) {
+    if ((n = writev(fd, iov, 2)) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    *bytes += n;
+    // 보낸 만큼 앞에서부터 덜어냄
+    if ((size_t)n >= iov[0].iov_len) {
+      n -= iov[0].iov_len;
+      iov[0].iov_len = 0;
+      iov[1].iov_base = (char *)iov[1].iov_base + n;
+      iov[1].iov_len -= n;
+    } else {
+      iov[0].iov_base = (char *)iov[0].iov_base + n;
+      iov[0].iov_len -= n;
+    }
+  }
+  return resp.status;
+}
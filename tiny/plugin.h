@@ -0,0 +1,49 @@
+/*
+ * plugin.h - tiny 의 in-process 동적 핸들러 (cgi-bin 의 .so) 의 C ABI
+ *
+ * cgi-bin 아래의 .so 파일은 프로세스를 띄우지 않고 dlopen 으로 한 번 올려서
+ * 워커 쓰레드에서 바로 부른다. 플러그인은 아래 두 심볼을 내보낸다.
+ *
+ *   int tiny_plugin_abi = TINY_PLUGIN_ABI;
+ *   int tiny_handle(const tiny_request_t *req, tiny_response_t *resp);
+ *
+ * - tiny_handle 은 resp->body (크기 resp->size) 에 바디를 쓰고 길이를
+ *   resp->len 에 넣는다. 상태와 타입은 안 바꾸면 200, text/html 이다.
+ *   0 이 아닌 값을 돌려주면 tiny 가 500 으로 답한다.
+ * - 여러 쓰레드가 동시에 부르므로 재진입 가능해야 하고, 요청 사이에 상태를
+ *   가지려면 플러그인이 직접 동기화한다.
+ * - 한 번 올린 .so 는 내리지 않는다. 바꾸려면 tiny 를 다시 띄운다.
+ *
+ * 플러그인도 이 헤더만 포함하므로 csapp.h 에 기대지 않는다.
+ */
+#ifndef __PLUGIN_H__
+#define __PLUGIN_H__
+
+#include <stddef.h>
+
+#define TINY_PLUGIN_ABI 1
+#define PLUGIN_BUFSIZE  65536   /* 바디 버퍼 크기 (워커 쓰레드마다 하나) */
+
+/* 플러그인에 넘기는 요청 (문자열은 호출 동안만 유효) */
+typedef struct {
+  const char *method;       /* "GET", "HEAD" */
+  const char *path;         /* "./cgi-bin/adder.so" */
+  const char *query;        /* '?' 뒤, 없으면 "" */
+} tiny_request_t;
+
+/* 플러그인이 채우는 응답 */
+typedef struct {
+  int status;               /* 기본 200 */
+  const char *type;         /* Content-type, 기본 "text/html" (정적 문자열이어야 함) */
+  char *body;
+  size_t size;              /* body 버퍼 크기 */
+  size_t len;               /* 쓴 바디 길이 */
+} tiny_response_t;
+
+typedef int (*tiny_handler_t)(const tiny_request_t *req, tiny_response_t *resp);
+
+tiny_handler_t plugin_get(char *filename);
+int plugin_serve(int fd, tiny_handler_t handle, char *filename, char *cgiargs, char *method,
+                 int keepalive, long *bytes);
+
+#endif /* __PLUGIN_H__ */
@@ -4,22 +4,61 @@
  *
  * Updated 11/2019 droh
  *   - Fixed sprintf() aliasing issue in serve_static(), and clienterror().
+ *
+ * 정적 파일 응답은 클라이언트가 원하면(HTTP/1.1 이거나 Connection: keep-alive)
+ * 연결을 닫지 않고 같은 연결에서 다음 요청을 기다린다. iterative 서버이므로
+ * 기다리는 동안 다른 클라이언트가 연결해 오면 idle 연결을 닫고 넘어간다.
  */
+#include <ctype.h>
+#include <poll.h>
+#include <netinet/tcp.h>
+#include <sys/sendfile.h>
 #include "csapp.h"
-
-void doit(int fd);
-void read_requesthdrs(rio_t *rp);
+#include "log.h"
+#include "filecache.h"
+#include "sbuf.h"
+#include "cgipool.h"
+#include "plugin.h"
+
+#define KEEPALIVE_TIMEOUT 5000  /* 다음 요청을 기다리는 최대 시간 (ms) */
+#define SBUFSIZE 64             /* -t 모드에서 워커를 기다리는 연결 큐 크기 */
+#define STREAM_CHUNK (1 << 20) /* sendfile 한 번에 보내는 최대 크기, 이만큼씩 앞을 미리 읽힘 */
+#define STREAM_AHEAD (4 << 20) /* 보내는 위치보다 앞서 page cache 에 올려 둘 범위 */
+#define STREAM_BUFSIZE 65536    /* sendfile 을 못 쓸 때 워커마다 쓰는 읽기 버퍼 */
+#define RANGE_MAX 16            /* Range 헤더에서 받아 주는 최대 구간 수, 넘으면 전체를 보냄 */
+#define BOUNDARY "TINY_BYTERANGES_5f3a9c" /* multipart/byteranges 구분자 */
+
+/* 요청한 바이트 구간 하나 [start, end] (end 포함) */
+typedef struct {
+  off_t start, end;
+} range_t;
+
+int doit(int fd, rio_t *rp);
+void serve_conn(int listenfd, int connfd);
+void *thread(void *vargp);
+long usec_since(struct timespec *start);
+int read_requesthdrs(rio_t *rp, int keepalive, char *range);
+int has_token(const char *value, const char *token);
+int wait_next(int listenfd, int connfd, rio_t *rp);
 int parse_uri(char *uri, char *filename, char *cgiargs);
-void serve_static(int fd, char *filename, int filesize, char *method);
-void get_filetype(char *filename, char *filetype);
-void serve_dynamic(int fd, char *filename, char *cgiargs, char *method);
+long serve_static(int fd, fc_entry_t *e, char *method, int keepalive, char *range, int *status);
+long serve_ranges(int fd, fc_entry_t *e, int head, int keepalive, range_t *r, int n);
+int parse_range(char *spec, off_t size, range_t *r);
+off_t send_body(int fd, fc_entry_t *e, off_t pos, off_t end);
+off_t stream_copy(int fd, fc_entry_t *e, off_t pos, off_t end);
+int serve_dynamic(int fd, char *filename, char *cgiargs, char *method, long *bytes);
 void clienterror(int fd, char *cause, char *errnum, char *shortmsg, char *longmsg);
 
+sbuf_t sbuf;  /* -t 모드에서 accept 한 연결 fd 를 워커에게 넘기는 큐 */
+int use_sendfile = 1;  /* 0 이면 (-r) 항상 버퍼로 읽어서 씀 */
+
 int main(int argc, char **argv) {
-  int listenfd, connfd;
+  int listenfd, connfd, c, i, level = LOG_INFO, nthreads = 0, ncgi = 0;
   char hostname[MAXLINE], port[MAXLINE];
   socklen_t clientlen;
   struct sockaddr_storage clientaddr;
+  sbuf_item_t item;
+  pthread_t tid;
 
   /**
    * proxy lab pdf - Hints
@@ -29,36 +68,144 @@ int main(int argc, char **argv) {
   // 위의 내용에 의거하여 아래 처리를 진행
   signal(SIGPIPE, SIG_IGN);
 
+  // 로그 레벨, 워커 쓰레드 수 옵션 (0 이면 예전처럼 한 번에 연결 하나),
+  // sendfile 대신 read/write 로 보내기, CGI 프로그램마다 띄워 둘 워커 프로세스 수
+  while ((c = getopt(argc, argv, "l:t:rc:")) != -1) {
+    if (c == 'l' && (level = log_parse_level(optarg)) >= 0) {
+      continue;
+    }
+    if (c == 'r') {
+      use_sendfile = 0;
+      continue;
+    }
+    if (c == 't' && (nthreads = atoi(optarg)) >= 0) {
+      continue;
+    }
+    if (c == 'c' && (ncgi = atoi(optarg)) >= 0) {
+      continue;
+    }
+    argc = 0;
+    break;
+  }
+
   // 실행 시 인수로 포트번호가 들어오지 않았을 경우 exit
-  if (argc != 2) {
-    fprintf(stderr, "usage: %s <port>\n", argv[0]);
+  if (optind != argc - 1) {
+    fprintf(stderr, "usage: %s [-t threads] [-c cgi_workers] [-r] [-l error|info|debug] <port>\n", argv[0]);
     exit(1);
   }
 
-  // 서버 소켓 열기
-  listenfd = Open_listenfd(argv[1]);
+  // stdout 에 직접 쓰지 않고 로그 쓰레드가 모아서 출력
+  log_init(level, STDOUT_FILENO);
+  // 정적 파일 fd / 헤더 캐시와 inotify 감시 쓰레드
+  fc_init();
+  // 0 이면 예전처럼 CGI 요청마다 Fork + Execve
+  cgi_init(ncgi);
+
+  // 서버 소켓 열기 (SOCK_CLOEXEC 로 열려서 CGI 자식에게 넘어가지 않음)
+  listenfd = Open_listenfd(argv[optind]);
+
+  // 워커 쓰레드를 미리 만들어 둠
+  if (nthreads > 0) {
+    sbuf_init(&sbuf, SBUFSIZE);
+    for (i = 0; i < nthreads; i++) {
+      Pthread_create(&tid, NULL, thread, NULL);
+    }
+  }
 
   while (1) {
     clientlen = sizeof(clientaddr);
-    connfd = Accept(listenfd, (SA *)&clientaddr, &clientlen);
+    // 다른 쓰레드가 띄운 CGI 자식이 이 연결을 물고 있으면 EOF 가 늦어지므로
+    // accept 와 동시에 CLOEXEC 를 붙임 (따로 fcntl 하면 그 사이에 fork 될 수 있음)
+    connfd = Accept4(listenfd, (SA *)&clientaddr, &clientlen, SOCK_CLOEXEC);
 
     // 클라이언트 진입 시 대기 끝내고 여기부터 실행
-    Getnameinfo((SA *)&clientaddr, clientlen, hostname, MAXLINE, port, MAXLINE, 0);
-    printf("Accepted connection from (%s, %s)\n", hostname, port);
-    doit(connfd);
-    Close(connfd);
+    // 역방향 DNS 조회는 debug 로그를 켰을 때만
+    if (LOG_DEBUG <= log_level) {
+      Getnameinfo((SA *)&clientaddr, clientlen, hostname, MAXLINE, port, MAXLINE, 0);
+      log_msg(LOG_DEBUG, "Accepted connection from (%s, %s)", hostname, port);
+    }
+    if (nthreads > 0) {
+      item.fd = connfd;
+      item.accepted = 0;
+      sbuf_insert(&sbuf, item);
+    } else {
+      serve_conn(listenfd, connfd);
+    }
+  }
+}
+
+/*
+ * thread - 워커 쓰레드. 큐에서 연결을 하나씩 꺼내 끝날 때까지 처리
+ */
+void *thread(void *vargp) {
+  Pthread_detach(pthread_self());
+  while (1) {
+    serve_conn(-1, sbuf_remove(&sbuf).fd);
+  }
+  return NULL;
+}
+
+/*
+ * serve_conn - 연결 하나의 요청들을 keep-alive 가 끝날 때까지 처리하고 닫음
+ *   listenfd 가 -1 이 아니면 (한 번에 연결 하나 모드) 다른 클라이언트가
+ *   기다릴 때 쉬고 있는 연결을 먼저 닫음
+ */
+void serve_conn(int listenfd, int connfd) {
+  int one = 1;
+  rio_t rio;
+
+  // 응답 헤더와 바디를 따로 쓰므로, keep-alive 연결에서 Nagle 이 바디를 붙잡지 않도록
+  setsockopt(connfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  Rio_readinitb(&rio, connfd);
+  while (doit(connfd, &rio) && wait_next(listenfd, connfd, &rio))
+    ;
+  Close(connfd);
+}
+
+/*
+ * wait_next - keep-alive 연결에서 다음 요청이 올 때까지 기다림
+ * @return 1: 다음 요청이 왔음, 0: 연결을 닫을 차례 (시간 초과, 또는 다른 클라이언트가 대기 중)
+ */
+int wait_next(int listenfd, int connfd, rio_t *rp) {
+  struct pollfd pfds[2];
+
+  // 파이프라인으로 이미 읽어 둔 요청이 있음
+  if (rp->rio_cnt > 0) {
+    return 1;
+  }
+  pfds[0].fd = connfd;
+  pfds[0].events = POLLIN;
+  pfds[1].fd = listenfd;   // -1 이면 poll 이 무시함
+  pfds[1].events = POLLIN;
+  if (poll(pfds, 2, KEEPALIVE_TIMEOUT) <= 0) {
+    return 0;
   }
+  return (pfds[0].revents & POLLIN) != 0;
+}
+
+/*
+ * usec_since - start 부터 지금까지 걸린 시간 (us)
+ */
+long usec_since(struct timespec *start) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (ts.tv_sec - start->tv_sec) * 1000000L + (ts.tv_nsec - start->tv_nsec) / 1000;
 }
 
 /*
  * doit - 한 개의 HTTP transaction 을 처리
+ * @return 같은 연결에서 다음 요청을 받아도 되면 1, 닫아야 하면 0
  */
-void doit(int fd) {
-  int is_static;
+int doit(int fd, rio_t *rp) {
+  int is_static, keepalive, status;
   struct stat sbuf;
+  fc_entry_t *e;
+  tiny_handler_t handle;
   char buf[MAXLINE], method[MAXLINE], uri[MAXLINE], version[MAXLINE];
-  char filename[MAXLINE], cgiargs[MAXLINE];
-  rio_t rio;
+  char filename[MAXLINE], cgiargs[MAXLINE], range[MAXLINE];
+  struct timespec start;
+  long bytes;
 
   /**
    * proxy lab pdf - Hints
@@ -69,58 +216,140 @@ void doit(int fd) {
   signal(SIGPIPE, SIG_IGN);
 
   // 여기서 요청을 읽고 HTTP 메소드, URI, HTTP 버전을 파싱
-  Rio_readinitb(&rio, fd);
-  Rio_readlineb(&rio, buf, MAXLINE);
-  sscanf(buf, "%s %s %s", method, uri, version);
+  // keep-alive 연결을 클라이언트가 닫았으면 끝
+  if (rio_readlineb(rp, buf, MAXLINE) <= 0 ||
+      sscanf(buf, "%s %s %s", method, uri, version) != 3) {
+    return 0;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &start);
   // 숙제문제 11.6
-  printf(":: %s %s %s ::\n", method, uri, version);
+  LOG(LOG_DEBUG, ":: %s %s %s ::", method, uri, version);
   
   // tiny 는 GET 메소드 이외에는 오류로 떨어트림
   // 숙제문제 11.11 - HEAD 메소드 추가
   if (strcasecmp(method, "GET") && strcasecmp(method, "HEAD")) {
     clienterror(fd, method, "501", "Not Implemented", "Tiny does not implement this method");
-    return;
+    log_access(method, strlen(method), uri, strlen(uri), 501, 0, usec_since(&start), "-");
+    return 0;
+  }
+  // HTTP/1.1 은 기본이 keep-alive, HTTP/1.0 은 헤더로 요청해야 함
+  // 헤더를 다 받기 전에 끊긴 요청에는 응답하지 않음
+  if ((keepalive = read_requesthdrs(rp, !strcmp(version, "HTTP/1.1"), range)) < 0) {
+    return 0;
   }
-  read_requesthdrs(&rio);
 
-  // URI 파싱
+  // URI 파싱 (접근 로그에는 query string 을 뺀 경로가 남음)
   is_static = parse_uri(uri, filename, cgiargs);
+  // 캐시에 있으면 stat, open 없이 바로 보냄
+  if (is_static && (e = fc_get(filename)) != NULL) {
+    bytes = serve_static(fd, e, method, keepalive, range, &status);
+    fc_release(e);
+    log_access(method, strlen(method), uri, strlen(uri), status, bytes, usec_since(&start),
+               "STATIC");
+    return keepalive;
+  }
+  // 여기부터는 에러 응답 또는 CGI
   if (stat(filename, &sbuf) < 0) {
     clienterror(fd, filename, "404", "Not found", "Tiny couldn't find this file");
-    return;
+    log_access(method, strlen(method), uri, strlen(uri), 404, 0, usec_since(&start), "-");
+    return 0;
   }
 
   // 정적컨텐츠 처리
   if (is_static) {
     if (!(S_ISREG(sbuf.st_mode)) || !(S_IRUSR & sbuf.st_mode)) {
       clienterror(fd, filename, "403", "Forbidden", "Tiny couldn't read the file");
-      return;
+      log_access(method, strlen(method), uri, strlen(uri), 403, 0, usec_since(&start), "-");
+      return 0;
     }
-    serve_static(fd, filename, sbuf.st_size, method);
+    // 읽을 수 있는 파일인데 열지 못함 (fd 부족 등)
+    clienterror(fd, filename, "500", "Internal Server Error", "Tiny couldn't open the file");
+    log_access(method, strlen(method), uri, strlen(uri), 500, 0, usec_since(&start), "-");
+    return 0;
 
   // 동적컨텐츠 처리
   } else {
     if (!(S_ISREG(sbuf.st_mode)) || !(S_IXUSR & sbuf.st_mode)) {
       clienterror(fd, filename, "403", "Forbidden", "Tiny couldn't run the CGI program");
-      return;
+      log_access(method, strlen(method), uri, strlen(uri), 403, 0, usec_since(&start), "-");
+      return 0;
+    }
+    // cgi-bin/*.so 는 프로세스 없이 이 쓰레드에서 바로 부름
+    if ((handle = plugin_get(filename)) != NULL) {
+      if ((status = plugin_serve(fd, handle, filename, cgiargs, method, keepalive, &bytes)) < 0) {
+        clienterror(fd, filename, "500", "Internal Server Error", "The handler failed");
+        log_access(method, strlen(method), uri, strlen(uri), 500, 0, usec_since(&start),
+                   "PLUGIN");
+        return 0;
+      }
+      log_access(method, strlen(method), uri, strlen(uri), status, bytes, usec_since(&start),
+                 "PLUGIN");
+      return keepalive;
     }
-    serve_dynamic(fd, filename, cgiargs, method);
+    // CGI 출력은 길이를 모르므로 EOF 로 끝을 알려야 함
+    status = serve_dynamic(fd, filename, cgiargs, method, &bytes);
+    log_access(method, strlen(method), uri, strlen(uri), status, bytes, usec_since(&start),
+               "CGI");
+    return 0;
   }
 }
 
 /*
  * read_requesthdrs - HTTP request headers 를 읽고 파싱
+ *   Range 헤더 값은 range 에 복사 (없으면 빈 문자열)
+ * @return Connection 헤더를 반영한 keep-alive 여부 (없으면 keepalive 그대로),
+ *         빈 줄까지 읽기 전에 EOF 나 오류가 나면 -1
  */
-void read_requesthdrs(rio_t *rp) {
-  char buf[MAXLINE];
+int read_requesthdrs(rio_t *rp, int keepalive, char *range) {
+  char buf[MAXLINE], *value;
 
-  Rio_readlineb(rp, buf, MAXLINE);
-  while (strcmp(buf, "\r\n")) {
-    Rio_readlineb(rp, buf, MAXLINE);
-    printf("%s", buf); // 헤더 로그에 찍기
-  }
+  range[0] = '\0';
+  do {
+    if (rio_readlineb(rp, buf, MAXLINE) <= 0) {
+      return -1;
+    }
+    LOG(LOG_DEBUG, "%.*s", (int)strcspn(buf, "\r\n"), buf); // 헤더 로그에 찍기
+    if (!strncasecmp(buf, "Connection:", 11) || !strncasecmp(buf, "Proxy-Connection:", 17)) {
+      value = strchr(buf, ':') + 1;
+      value[strcspn(value, "\r\n")] = '\0';
+      if (has_token(value, "close")) {
+        keepalive = 0;
+      } else if (has_token(value, "keep-alive")) {
+        keepalive = 1;
+      }
+    } else if (!strncasecmp(buf, "Range:", 6)) {
+      strcpy(range, buf + 6 + strspn(buf + 6, " \t"));
+      range[strcspn(range, "\r\n")] = '\0';
+    }
+  } while (strcmp(buf, "\r\n"));
 
-  return;
+  return keepalive;
+}
+
+/*
+ * has_token - "a, b, c" 꼴의 헤더 값에 token 이 있는지 (대소문자 무시)
+ */
+int has_token(const char *value, const char *token) {
+  const char *p = value, *q;
+  size_t n = strlen(token);
+
+  while (*p) {
+    while (*p == ' ' || *p == '\t' || *p == ',') {
+      p++;
+    }
+    for (q = p; *q && *q != ','; q++)
+      ;
+    while (q > p && (q[-1] == ' ' || q[-1] == '\t')) {
+      q--;
+    }
+    if ((size_t)(q - p) == n && !strncasecmp(p, token, n)) {
+      return 1;
+    }
+    while (*p && *p != ',') {
+      p++;
+    }
+  }
+  return 0;
 }
 
 /*
@@ -134,6 +363,10 @@ int parse_uri(char *uri, char *filename, char *cgiargs) {
 
   /* Static content */
   if (!strstr(uri, "cgi-bin")){
+    // 정적 파일에는 query string 이 의미 없음
+    if ((ptr = index(uri, '?')) != NULL) {
+      *ptr = '\0';
+    }
     strcpy(cgiargs, "");
     strcpy(filename, ".");
     strcat(filename, uri);
@@ -158,97 +391,306 @@ int parse_uri(char *uri, char *filename, char *cgiargs) {
 
 /*
  * serve_static - copy a file back to the client
+ *   바디는 sendfile 로 page cache 에서 소켓으로 바로 보내므로 파일 크기와
+ *   상관없이 요청 하나가 쓰는 메모리는 헤더 버퍼뿐이다. TCP_CORK 를 켠 채로
+ *   헤더와 바디를 쓰고 마지막에 풀어서, 헤더가 작은 패킷 하나로 따로 나가지
+ *   않고 바디 앞부분과 같은 세그먼트에 실리게 한다.
+ *   헤더와 열린 fd 는 filecache 의 것을 그대로 쓴다. 오프셋을 따로 넘기므로
+ *   같은 fd 를 여러 요청이 같이 써도 된다.
+ *   range 가 있으면 그 구간만 206 으로 보내고, 맞는 구간이 하나도 없으면 416.
+ *   Range 문법이 틀렸으면 RFC 9110 대로 무시하고 전체를 보낸다.
+ * @return 보낸 바이트 수 (헤더 포함), 응답 상태는 status 에
  */
-void serve_static(int fd, char *filename, int filesize, char *method) {
-  int srcfd, n;
-  char *srcp, filetype[MAXLINE], buf[MAXBUF];
-
-  /* 파일 전송을 위한 청크 크기 설정 (예: 8192 바이트) */
-  const int CHUNK_SIZE = MAXBUF;
-  char chunk[CHUNK_SIZE];
-  int remaining_size = filesize;
-
-  /* Send response headers to client */
-  get_filetype(filename, filetype);
-  // 서버 응답 버전 명시
-  sprintf(buf, "HTTP/1.0 200 OK\r\n"); // 여기 바꾸면 http 프로토콜 바뀜
-  sprintf(buf, "%sServer: Tiny Web Server\r\n", buf);
-  sprintf(buf, "%sContent-length: %d\r\n", buf, filesize);
-  sprintf(buf, "%sContent-type: %s\r\n\r\n", buf, filetype);
-  Rio_writen(fd, buf, strlen(buf));
+long serve_static(int fd, fc_entry_t *e, char *method, int keepalive, char *range, int *status) {
+  int on = 1, off = 0, head = !strcasecmp(method, "HEAD"), n;
+  long hdrlen = e->hdrlen[keepalive != 0];
+  range_t r[RANGE_MAX];
+  off_t pos;
+
+  if (range[0] && (n = parse_range(range, e->size, r)) != 0) {
+    *status = n > 0 ? 206 : 416;
+    return serve_ranges(fd, e, head, keepalive, r, n);
+  }
+  *status = 200;
 
-  // HEAD 메소드로 진입한 경우 여기서 return
-  if (!strcasecmp(method, "HEAD")) {
-    return;
+  // HEAD 메소드로 진입한 경우 헤더만 보내고 return
+  // 클라이언트가 끊겼어도 (EPIPE) 서버를 내리지 않고 이 연결만 접음
+  if (head) {
+    return rio_writen(fd, e->hdr[keepalive != 0], hdrlen) == hdrlen ? hdrlen : 0;
   }
 
-  // response body 를 클라이언트로 전송
-  // srcfd = Open(filename, O_RDONLY, 0);
-  // srcp = Mmap(0, filesize, PROT_READ, MAP_PRIVATE, srcfd, 0);
-  // Close(srcfd);
-  // Rio_writen(fd, srcp, filesize);
-  // Munmap(srcp, filesize);
-
-  // 숙제문제 11.9
-  srcfd = Open(filename, O_RDONLY, 0);
-  srcp = (char*)malloc(filesize);
-  Rio_readn(srcfd, srcp, filesize);
-  Close(srcfd);
-  Rio_writen(fd, srcp, filesize);
-  free(srcp);
+  // 숙제문제 11.9 - 예전에는 파일 전체를 malloc 한 버퍼로 읽어서 썼음
+  setsockopt(fd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+  if (rio_writen(fd, e->hdr[keepalive != 0], hdrlen) != hdrlen) {
+    return 0;
+  }
+  pos = send_body(fd, e, 0, e->size);
+  setsockopt(fd, IPPROTO_TCP, TCP_CORK, &off, sizeof(off));
+  return hdrlen + pos;
 }
 
 /*
- * get_filetype - derive file type from file name
+ * parse_range - "bytes=a-b, c-, -n" 형식의 Range 값을 파일 크기에 맞춰 구간으로 바꿈
+ *   파일 밖에서 시작하는 구간은 빼고, 끝이 파일을 넘으면 파일 끝으로 자름
+ * @return 구간 수, 문법이 틀렸거나 RANGE_MAX 를 넘으면 0 (무시), 맞는 구간이 없으면 -1
  */
-void get_filetype(char *filename, char *filetype) {
-  // 파일명 내에서 마지막 . 찾기 -> 파일명 중간에 확장자가 들어가는 케이스 방어
-  char *ext = strrchr(filename, '.');
-
-  if (ext != NULL) {
-    if (strcmp(ext, ".html") == 0) {
-      strcpy(filetype, "text/html");
-    } else if (strcmp(ext, ".gif") == 0) {
-      strcpy(filetype, "image/gif");
-    } else if (strcmp(ext, ".jpg") == 0 || strcmp(ext, ".jpeg") == 0) {
-      strcpy(filetype, "image/jpeg");
-    // 숙제문제 11.7
-    } else if (strcmp(ext, ".mp4") == 0) {
-      strcpy(filetype, "video/mp4");
+int parse_range(char *spec, off_t size, range_t *r) {
+  char *p = spec + 6, *end;
+  long long a, b;
+  int n = 0;
+
+  if (strncasecmp(spec, "bytes=", 6)) {
+    return 0;
+  }
+  while (1) {
+    p += strspn(p, " \t");
+    if (*p == '-') {
+      // 뒤에서부터 b 바이트
+      if (!isdigit(p[1])) {
+        return 0;
+      }
+      b = strtoll(p + 1, &end, 10);
+      a = size - b > 0 ? size - b : 0;
+      b = size - 1;
+      if (a > b) {
+        a = -1;
+      }
     } else {
-      strcpy(filetype, "text/plain");
+      if (!isdigit(*p)) {
+        return 0;
+      }
+      a = strtoll(p, &end, 10);
+      if (*end++ != '-') {
+        return 0;
+      }
+      if (isdigit(*end)) {
+        b = strtoll(end, &end, 10);
+        if (b < a) {
+          return 0;
+        }
+      } else {
+        b = size - 1;
+      }
+      if (a >= size) {
+        a = -1;
+      } else if (b >= size) {
+        b = size - 1;
+      }
+    }
+    if (a >= 0) {
+      if (n == RANGE_MAX) {
+        return 0;
+      }
+      r[n].start = a;
+      r[n].end = b;
+      n++;
+    }
+    p = end + strspn(end, " \t");
+    if (*p == '\0') {
+      break;
+    }
+    if (*p++ != ',') {
+      return 0;
+    }
+  }
+  return n > 0 ? n : -1;
+}
+
+/*
+ * serve_ranges - 구간 n 개를 206 으로 보냄. 하나면 그 구간만, 여러 개면
+ *   multipart/byteranges 로 각 부분 앞에 헤더를 붙여 보낸다. 바디는 모두
+ *   sendfile 로 파일의 해당 오프셋에서 바로 보낸다. n 이 -1 이면 416.
+ * @return 보낸 바이트 수 (헤더 포함)
+ */
+long serve_ranges(int fd, fc_entry_t *e, int head, int keepalive, range_t *r, int n) {
+  static char tail[] = "\r\n--" BOUNDARY "--\r\n";
+  int on = 1, off = 0, i, len;
+  char buf[MAXBUF], part[MAXLINE];
+  long long total = 0;
+  long sent;
+
+  if (n < 0) {
+    len = snprintf(buf, MAXBUF, "HTTP/1.0 416 Range Not Satisfiable\r\n"
+                   "Server: Tiny Web Server\r\nAccept-Ranges: bytes\r\n"
+                   "Content-range: bytes */%lld\r\nContent-length: 0\r\n%s\r\n",
+                   (long long)e->size, keepalive ? "Connection: keep-alive\r\n" : "");
+    return rio_writen(fd, buf, len) == len ? len : 0;
+  }
+
+  if (n == 1) {
+    total = r[0].end - r[0].start + 1;
+    len = snprintf(buf, MAXBUF, "HTTP/1.0 206 Partial Content\r\n"
+                   "Server: Tiny Web Server\r\nAccept-Ranges: bytes\r\n"
+                   "Content-range: bytes %lld-%lld/%lld\r\nContent-length: %lld\r\n"
+                   "%sContent-type: %s\r\n\r\n", (long long)r[0].start, (long long)r[0].end,
+                   (long long)e->size, total, keepalive ? "Connection: keep-alive\r\n" : "",
+                   e->type);
+  } else {
+    // 바디 길이 = 부분마다 (구분자 + 부분 헤더 + 구간) + 끝 구분자
+    for (i = 0; i < n; i++) {
+      total += snprintf(part, MAXLINE, "\r\n--" BOUNDARY "\r\nContent-type: %s\r\n"
+                        "Content-range: bytes %lld-%lld/%lld\r\n\r\n", e->type,
+                        (long long)r[i].start, (long long)r[i].end, (long long)e->size);
+      total += r[i].end - r[i].start + 1;
     }
+    total += strlen(tail);
+    len = snprintf(buf, MAXBUF, "HTTP/1.0 206 Partial Content\r\n"
+                   "Server: Tiny Web Server\r\nAccept-Ranges: bytes\r\n"
+                   "Content-length: %lld\r\n%sContent-type: multipart/byteranges; "
+                   "boundary=" BOUNDARY "\r\n\r\n", total,
+                   keepalive ? "Connection: keep-alive\r\n" : "");
+  }
+  if (head) {
+    return rio_writen(fd, buf, len) == len ? len : 0;
+  }
+
+  setsockopt(fd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+  if (rio_writen(fd, buf, len) != len) {
+    return 0;
+  }
+  sent = len;
+  if (n == 1) {
+    sent += send_body(fd, e, r[0].start, r[0].end + 1) - r[0].start;
   } else {
-    // 확장자가 없을 경우 기본 값
-    strcpy(filetype, "text/plain");
+    for (i = 0; i < n; i++) {
+      len = snprintf(part, MAXLINE, "\r\n--" BOUNDARY "\r\nContent-type: %s\r\n"
+                     "Content-range: bytes %lld-%lld/%lld\r\n\r\n", e->type,
+                     (long long)r[i].start, (long long)r[i].end, (long long)e->size);
+      if (rio_writen(fd, part, len) != len) {
+        break;
+      }
+      sent += len;
+      if (send_body(fd, e, r[i].start, r[i].end + 1) != r[i].end + 1) {
+        break;
+      }
+      sent += r[i].end - r[i].start + 1;
+    }
+    if (i == n && rio_writen(fd, tail, strlen(tail)) > 0) {
+      sent += strlen(tail);
+    }
+  }
+  setsockopt(fd, IPPROTO_TCP, TCP_CORK, &off, sizeof(off));
+  return sent;
+}
+
+/*
+ * send_body - 파일의 [pos, end) 구간을 소켓으로 보냄
+ *   클라이언트가 중간에 끊으면 보낸 데까지만 (다음 read 에서 연결이 정리됨)
+ * @return 보낸 뒤의 위치
+ */
+off_t send_body(int fd, fc_entry_t *e, off_t pos, off_t end) {
+  ssize_t n;
+
+  while (pos < end) {
+    // 큰 파일은 보내는 동안 디스크가 소켓보다 앞서 있도록 다음 구간을 미리 읽힘
+    if (end - pos > STREAM_CHUNK) {
+      posix_fadvise(e->fd, pos + STREAM_CHUNK, STREAM_AHEAD, POSIX_FADV_WILLNEED);
+    }
+    if (!use_sendfile) {
+      return stream_copy(fd, e, pos, end);
+    }
+    if ((n = sendfile(fd, e->fd, &pos, end - pos < STREAM_CHUNK ? end - pos : STREAM_CHUNK)) <= 0) {
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      // sendfile 을 지원하지 않는 파일 시스템이면 버퍼로 이어서 보냄
+      if (n < 0 && (errno == EINVAL || errno == ENOSYS)) {
+        return stream_copy(fd, e, pos, end);
+      }
+      break;
+    }
+  }
+  return pos;
+}
+
+/*
+ * stream_copy - 파일의 [pos, end) 구간을 고정 크기 버퍼로 읽어서 소켓에 씀
+ *   버퍼는 워커 쓰레드마다 한 번만 잡아서 계속 쓰므로, 파일이 아무리
+ *   커도 동시에 보내는 요청 수 x STREAM_BUFSIZE 이상 메모리를 쓰지 않는다.
+ *   pread 로 읽어서 캐시의 fd 를 다른 요청과 같이 써도 된다.
+ * @return 보낸 뒤의 위치 (중간에 실패하면 거기까지)
+ */
+off_t stream_copy(int fd, fc_entry_t *e, off_t pos, off_t end) {
+  static __thread char *buf;
+  ssize_t n;
+
+  if (buf == NULL) {
+    buf = Malloc(STREAM_BUFSIZE);
+  }
+  while (pos < end) {
+    if (pos % STREAM_CHUNK == 0 && end - pos > STREAM_CHUNK) {
+      posix_fadvise(e->fd, pos + STREAM_CHUNK, STREAM_AHEAD, POSIX_FADV_WILLNEED);
+    }
+    if ((n = pread(e->fd, buf, end - pos < STREAM_BUFSIZE ? end - pos : STREAM_BUFSIZE, pos)) <= 0) {
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    if (rio_writen(fd, buf, n) != n) {
+      break;
+    }
+    pos += n;
   }
+  return pos;
 }
 
 /*
  * serve_dynamic - run a CGI program on behalf of the client
+ *   -c 로 워커 풀을 켰으면 오래 사는 워커에게 넘기고, 아니면 (또는 워커
+ *   프로토콜을 모르는 프로그램이면) 요청마다 Fork + Execve
+ * @return 응답 상태 (워커가 응답 도중 죽었으면 502), 보낸 바이트 수는 bytes 에
+ *         (Fork 로 실행하면 헤더만 셈)
  */
-void serve_dynamic(int fd, char *filename, char *cgiargs, char *method) {
+int serve_dynamic(int fd, char *filename, char *cgiargs, char *method, long *bytes) {
   char buf[MAXLINE], *emptylist[] = {NULL};
+  struct linger lg = {1, 0};
+  pid_t pid;
 
   /* Return first part of HTTP response */
   // 서버 응답 버전 명시
-  sprintf(buf, "HTTP/1.0 200 OK\r\n");
-  Rio_writen(fd, buf, strlen(buf));
-  sprintf(buf, "Server: Tiny Web Server\r\n");
-  Rio_writen(fd, buf, strlen(buf));
+  sprintf(buf, "HTTP/1.0 200 OK\r\nServer: Tiny Web Server\r\n");
+  *bytes = 0;
 
   // HEAD 메소드로 진입한 경우 여기서 return
   if (!strcasecmp(method, "HEAD")) {
-    return;
+    if (rio_writen(fd, buf, strlen(buf)) > 0) {
+      *bytes = strlen(buf);
+    }
+    return 200;
+  }
+
+  switch (cgi_serve(fd, filename, cgiargs, method, buf, bytes)) {
+  case CGI_OK:
+    return 200;
+  case CGI_BUSY:
+    clienterror(fd, filename, "503", "Service Unavailable", "All CGI workers are busy");
+    return 503;
+  case CGI_FAILED:
+    // 응답 도중이면 상태 줄은 이미 나갔으므로, 잘린 바디가 끝까지 받은
+    // 응답으로 보이지 않게 닫을 때 RST 를 보냄 (호출한 쪽이 연결을 닫음)
+    if (*bytes) {
+      setsockopt(fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+    } else {
+      clienterror(fd, filename, "502", "Bad Gateway", "The CGI worker failed");
+    }
+    return 502;
   }
 
-  if (Fork() == 0) { /* child */
+  // 클라이언트가 이미 끊겼으면 (EPIPE) 프로그램을 실행하지 않음
+  if (rio_writen(fd, buf, strlen(buf)) < 0) {
+    return 200;
+  }
+  *bytes = strlen(buf);
+  if ((pid = Fork()) == 0) { /* child */
     /* Real server would set all CGI vars here */
     setenv("QUERY_STRING", cgiargs, 1);
     Dup2(fd, STDOUT_FILENO); /* Redirect stdout to client */
     Execve(filename, emptylist, environ); /* Run CGI program */
   }
-  Wait(NULL); /* Parent waits for and reaps child */
+  // 워커 쓰레드가 여럿이면 다른 쓰레드의 자식을 거두지 않도록 pid 를 지정
+  Waitpid(pid, NULL, 0); /* Parent waits for and reaps child */
+  return 200;
 }
 
 /*
@@ -265,11 +707,11 @@ void clienterror(int fd, char *cause, char *errnum, char *shortmsg, char *longms
   sprintf(body, "%s<hr><em>The Tiny Web server</em>\r\n", body);
 
   /* Print the HTTP response */
-  sprintf(buf, "HTTP/1.0 %s %s\r\n", errnum, shortmsg);
-  Rio_writen(fd, buf, strlen(buf));
-  sprintf(buf, "Content-type: text/html\r\n");
-  Rio_writen(fd, buf, strlen(buf));
-  sprintf(buf, "Content-length: %d\r\n\r\n", (int)strlen(body));
-  Rio_writen(fd, buf, strlen(buf));
-  Rio_writen(fd, body, strlen(body));
+  // 클라이언트가 끊겼으면 (EPIPE) 나머지는 보내지 않음, 연결은 호출한 쪽이 닫음
+  sprintf(buf, "HTTP/1.0 %s %s\r\nContent-type: text/html\r\nContent-length: %d\r\n\r\n",
+          errnum, shortmsg, (int)strlen(body));
+  if (rio_writen(fd, buf, strlen(buf)) < 0) {
+    return;
+  }
+  rio_writen(fd, body, strlen(body));
 }
@@ -0,0 +1,344 @@
+/*
+ * upstream.c - 원격 서버 keep-alive 연결 풀
+ *
+ * - host:port 마다 항목 하나를 두고, 항목마다 idle 연결을 LIFO 로 쌓는다.
+ *   가장 최근에 돌려받은 연결이 원격 서버에서 닫혔을 가능성이 가장 낮다.
+ * - 테이블 전체를 mutex 하나로 보호한다. lock 안에서는 목록만 만지고,
+ *   연결 확인(poll)과 새 연결(connect)은 lock 밖에서 한다.
+ * - circuit breaker 상태도 같은 항목에 두고 같은 lock 으로 보호한다.
+ *   upstream_host 가 돌려준 항목은 upstream_report 까지 참조를 잡고 있으므로
+ *   그동안은 지워지지 않는다.
+ * - 클라이언트가 보낸 아무 host:port 로나 항목이 쌓이지 않도록, 항목은 이름
+ *   해석이나 connect 를 해 본 뒤에만 만들고, reaper 가 idle 연결도 참조도
+ *   시험 요청도 없고 실패가 없거나 UP_IDLE 초 넘게 소식이 없는 항목을 지운다.
+ */
+#include <poll.h>
+#include "upstream.h"
+#include "dnscache.h"
+#include "log.h"
+
+typedef struct up_conn {
+  int fd;
+  time_t since;                 /* idle 목록에 들어온 시각 */
+  struct up_conn *next;
+} up_conn_t;
+
+typedef struct up_host {
+  char *key;                    /* "host:port" */
+  unsigned int hash;
+  up_conn_t *idle;              /* idle 연결, 최근 것이 앞 */
+  int nidle;
+  int refs;                     /* upstream_host 로 꺼내 가서 아직 알리지 않은 요청 수 */
+  int fails;                    /* 연속 실패 수 */
+  int trial;                    /* 차단 중 보낸 시험 요청이 결과를 기다리는 중 */
+  long long until;              /* fails 가 UP_BREAK_FAILS 이상일 때 다음 시험 요청 시각 (ms) */
+  long long last;               /* 마지막으로 결과를 알린 시각 (ms) */
+  struct up_host *next;         /* 같은 버킷의 다음 항목 */
+} up_host_t;
+
+static struct {
+  int enabled;
+  pthread_mutex_t lock;
+  up_host_t *buckets[UP_NBUCKETS];
+  int nidle;                    /* 풀 전체 idle 연결 수 */
+} up;
+
+static time_t now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec;
+}
+
+static long long now_ms(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+/*
+ * hash_key - FNV-1a 문자열 해시
+ */
+static unsigned int hash_key(const char *key) {
+  unsigned int h = 2166136261u;
+
+  while (*key) {
+    h ^= (unsigned char)*key++;
+    h *= 16777619u;
+  }
+  return h;
+}
+
+/*
+ * find_host - key 항목 찾기, 없고 create 면 만듦 (lock 잡고 호출)
+ */
+static up_host_t *find_host(char *key, int create) {
+  unsigned int h = hash_key(key);
+  up_host_t *e;
+
+  for (e = up.buckets[h % UP_NBUCKETS]; e; e = e->next) {
+    if (e->hash == h && !strcmp(e->key, key)) {
+      return e;
+    }
+  }
+  if (!create) {
+    return NULL;
+  }
+  e = Calloc(1, sizeof(up_host_t));
+  e->key = Malloc(strlen(key) + 1);
+  strcpy(e->key, key);
+  e->hash = h;
+  e->next = up.buckets[h % UP_NBUCKETS];
+  up.buckets[h % UP_NBUCKETS] = e;
+  return e;
+}
+
+/*
+ * healthy - idle 연결이 아직 쓸 만한지 확인
+ *   요청을 보내기 전이므로 읽을 것이 있다면 EOF, RST 또는 엉뚱한 바이트뿐
+ */
+static int healthy(int fd) {
+  struct pollfd pfd;
+
+  pfd.fd = fd;
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+  return poll(&pfd, 1, 0) == 0;
+}
+
+/*
+ * stale - 지워도 되는 항목인지 (lock 잡고 호출)
+ *   쓰는 요청도 idle 연결도 시험 요청도 없고, 실패가 없거나 UP_IDLE 초 넘게
+ *   결과를 알린 요청이 없음
+ */
+static int stale(up_host_t *e, long long t) {
+  return e->refs == 0 && e->nidle == 0 && !e->trial &&
+         (e->fails == 0 || t - e->last > UP_IDLE * 1000LL);
+}
+
+/*
+ * reaper - UP_IDLE 초 넘게 놀고 있는 연결을 닫고, 쓸 일이 없어진 항목을 지움
+ */
+static void *reaper(void *vargp) {
+  up_conn_t *c, **pp, *dead;
+  up_host_t *e, **ep, *gone;
+  long long tms;
+  time_t t;
+  int i;
+
+  Pthread_detach(pthread_self());
+  while (1) {
+    sleep(1);
+    dead = NULL;
+    gone = NULL;
+    t = now();
+    tms = now_ms();
+
+    pthread_mutex_lock(&up.lock);
+    for (i = 0; i < UP_NBUCKETS; i++) {
+      for (e = up.buckets[i]; e; e = e->next) {
+        pp = &e->idle;
+        while ((c = *pp) != NULL) {
+          if (t - c->since > UP_IDLE) {
+            *pp = c->next;
+            e->nidle--;
+            up.nidle--;
+            c->next = dead;
+            dead = c;
+          } else {
+            pp = &c->next;
+          }
+        }
+      }
+      for (ep = &up.buckets[i]; (e = *ep) != NULL;) {
+        if (stale(e, tms)) {
+          *ep = e->next;
+          e->next = gone;
+          gone = e;
+        } else {
+          ep = &e->next;
+        }
+      }
+    }
+    pthread_mutex_unlock(&up.lock);
+
+    while ((c = dead) != NULL) {
+      dead = c->next;
+      close(c->fd);
+      Free(c);
+    }
+    while ((e = gone) != NULL) {
+      gone = e->next;
+      Free(e->key);
+      Free(e);
+    }
+  }
+  return NULL;
+}
+
+/*
+ * upstream_init - 풀 초기화, enabled 가 0 이면 항상 새로 연결하고 돌려받은 연결은 닫음
+ *   breaker 항목은 풀을 끄더라도 쓰므로 reaper 는 항상 띄움
+ */
+void upstream_init(int enabled) {
+  pthread_t tid;
+
+  memset(&up, 0, sizeof(up));
+  pthread_mutex_init(&up.lock, NULL);
+  up.enabled = enabled;
+  Pthread_create(&tid, NULL, reaper, NULL);
+}
+
+int upstream_enabled(void) {
+  return up.enabled;
+}
+
+/*
+ * upstream_get - hostname:port 로 가는 연결 하나 꺼내기
+ *   쓸 만한 idle 연결이 있으면 그것을, 없으면 새로 연결
+ *   *reused 에 idle 연결을 꺼냈는지 알려 줌
+ *   새로 연결할 때는 t 에 걸린 마감이 connect 에 적용됨
+ * @return 연결된 fd, 실패면 dns_open_clientfd 와 같은 음수
+ */
+int upstream_get(char *hostname, char *port, int *reused, dl_timer_t *t) {
+  char key[MAXLINE];
+  up_host_t *e;
+  up_conn_t *c;
+  int fd;
+
+  *reused = 0;
+  if (!up.enabled) {
+    return dns_open_clientfd(hostname, port, t);
+  }
+
+  snprintf(key, MAXLINE, "%s:%s", hostname, port);
+  while (1) {
+    pthread_mutex_lock(&up.lock);
+    if ((e = find_host(key, 0)) == NULL || (c = e->idle) == NULL) {
+      pthread_mutex_unlock(&up.lock);
+      break;
+    }
+    e->idle = c->next;
+    e->nidle--;
+    up.nidle--;
+    pthread_mutex_unlock(&up.lock);
+
+    fd = c->fd;
+    Free(c);
+    if (healthy(fd)) {
+      *reused = 1;
+      return fd;
+    }
+    close(fd);
+  }
+  return dns_open_clientfd(hostname, port, t);
+}
+
+/*
+ * upstream_put - 응답을 끝까지 읽은 연결을 idle 목록에 돌려 놓음
+ *   자리가 없거나 풀이 꺼져 있으면 닫음
+ */
+void upstream_put(char *hostname, char *port, int fd) {
+  char key[MAXLINE];
+  up_host_t *e;
+  up_conn_t *c;
+
+  if (!up.enabled) {
+    close(fd);
+    return;
+  }
+
+  snprintf(key, MAXLINE, "%s:%s", hostname, port);
+  pthread_mutex_lock(&up.lock);
+  e = find_host(key, 1);
+  if (e->nidle >= UP_MAXIDLE || up.nidle >= UP_MAXTOTAL) {
+    pthread_mutex_unlock(&up.lock);
+    close(fd);
+    return;
+  }
+  c = Malloc(sizeof(up_conn_t));
+  c->fd = fd;
+  c->since = now();
+  c->next = e->idle;
+  e->idle = c;
+  e->nidle++;
+  up.nidle++;
+  pthread_mutex_unlock(&up.lock);
+}
+
+/*
+ * upstream_host - hostname:port 의 breaker 항목을 꺼내고 참조를 잡음
+ *   create 가 0 이면 이미 있을 때만 (없으면 NULL). 이름 해석이나 connect 를
+ *   해 본 뒤에 부르고, 결과는 upstream_report 로 알려서 참조를 놓음
+ */
+up_host_t *upstream_host(char *hostname, char *port, int create) {
+  char key[MAXLINE];
+  up_host_t *e;
+
+  snprintf(key, MAXLINE, "%s:%s", hostname, port);
+  pthread_mutex_lock(&up.lock);
+  if ((e = find_host(key, create)) != NULL) {
+    e->refs++;
+  }
+  pthread_mutex_unlock(&up.lock);
+  return e;
+}
+
+/*
+ * upstream_allow - hostname:port 로 요청을 보내도 되는지 (항목을 만들지 않음)
+ *   차단 중이면 UP_BREAK_MS 가 지난 뒤 시험 요청 하나만 통과시키고, 그 요청이
+ *   upstream_report 로 결과를 알릴 때까지는 모두 거절
+ * @return 보내도 되면 1, 바로 실패시켜야 하면 0
+ */
+int upstream_allow(char *hostname, char *port) {
+  char key[MAXLINE];
+  long long t = now_ms();
+  up_host_t *e;
+  int ok = 1;
+
+  snprintf(key, MAXLINE, "%s:%s", hostname, port);
+  pthread_mutex_lock(&up.lock);
+  if ((e = find_host(key, 0)) != NULL && e->fails >= UP_BREAK_FAILS) {
+    if (e->trial || t < e->until) {
+      ok = 0;
+    } else {
+      e->trial = 1;
+    }
+  }
+  pthread_mutex_unlock(&up.lock);
+  return ok;
+}
+
+/*
+ * upstream_report - 요청 하나의 결과를 circuit breaker 에 알리고 참조를 놓음
+ *   ok 가 0 이면 connect 실패, 마감 초과, 응답 없음. e 가 NULL 이면 아무것도 안 함
+ */
+void upstream_report(up_host_t *e, int ok) {
+  int fails;
+
+  if (!e) {
+    return;
+  }
+  pthread_mutex_lock(&up.lock);
+  e->refs--;
+  e->trial = 0;
+  e->last = now_ms();
+  if (ok) {
+    fails = e->fails;
+    e->fails = 0;
+  } else {
+    fails = ++e->fails;
+    if (fails >= UP_BREAK_FAILS) {
+      e->until = now_ms() + UP_BREAK_MS;
+    }
+  }
+  pthread_mutex_unlock(&up.lock);
+
+  if (ok && fails >= UP_BREAK_FAILS) {
+    LOG(LOG_ERROR, "upstream %s recovered", e->key);
+  } else if (!ok && fails == UP_BREAK_FAILS) {
+    LOG(LOG_ERROR, "upstream %s failed %d times in a row, failing fast for %d ms", e->key,
+        fails, UP_BREAK_MS);
+  }
+}
@@ -0,0 +1,62 @@
+/*
+ * upstream.h - 원격 서버 keep-alive 연결 풀
+ *
+ * 응답을 끝까지 받은 원격 서버 연결을 닫지 않고 "host:port" 별 idle 목록에
+ * 넣어 두었다가, 같은 원격 서버로 가는 다음 miss 가 TCP 연결 과정 없이
+ * 바로 요청을 보낼 수 있게 한다.
+ *
+ * - host:port 하나에 UP_MAXIDLE 개, 풀 전체에 UP_MAXTOTAL 개까지만 idle
+ *   연결을 붙잡고, 넘치면 돌려받은 연결을 그냥 닫는다.
+ * - UP_IDLE 초 넘게 놀고 있는 연결은 reaper 쓰레드가 닫는다.
+ * - 꺼낼 때 poll 로 확인해서, 원격 서버가 그 사이 닫았거나 요청하지도 않은
+ *   바이트가 와 있는 연결은 버리고 다음 연결을 본다.
+ * - 그래도 꺼낸 연결에 요청을 보낸 직후 원격 서버가 닫을 수 있으므로,
+ *   응답을 한 바이트도 못 받았으면 호출한 쪽이 새 연결로 한 번 다시 보낸다.
+ *
+ * 원격 서버에는 HTTP/1.0 요청에 Connection: keep-alive 를 붙여 보낸다. HTTP/1.1
+ * 로 보내면 청크 인코딩 응답이 올 수 있는데, 프록시는 청크 경계를 따라가지 않고
+ * EOF 까지 읽으므로 그런 연결은 어차피 다시 쓸 수 없다. 그래서 연결을 다시 쓰는
+ * 것은 HTTP/1.0 keep-alive 를 받아 주는 원격 서버가 Content-length 가 있는
+ * 응답을 보냈을 때뿐이고, 그 밖의 원격 서버와는 예전처럼 요청마다 연결한다.
+ *
+ * 풀은 쓰레드 엔진에서만 쓴다. epoll 엔진(event.c)은 요청마다 non-blocking 으로
+ * 새로 연결하고 응답이 끝나면 닫는다. breaker 는 두 엔진이 같이 쓴다.
+ *
+ * 원격 서버마다 circuit breaker 도 둔다. connect 실패나 마감 초과(deadline.h)가
+ * UP_BREAK_FAILS 번 이어지면 UP_BREAK_MS 동안 그 원격 서버로 가는 요청은
+ * 연결을 시도하지 않고 바로 실패시킨다. 그 시간이 지나면 요청 하나만 시험으로
+ * 보내고 (결과가 나올 때까지 다른 요청은 계속 바로 실패), 성공하면 다시 열고
+ * 실패하면 UP_BREAK_MS 를 한 번 더 기다린다.
+ * 죽거나 멈춘 원격 서버 하나가 워커를 모두 붙잡지 못하게 하려는 것이다.
+ */
+#ifndef __UPSTREAM_H__
+#define __UPSTREAM_H__
+
+#include "csapp.h"
+#include "deadline.h"
+
+#define UP_NBUCKETS 64      /* 해시 버킷 개수 */
+#define UP_MAXIDLE  8       /* host:port 하나에 붙잡아 둘 최대 idle 연결 수 */
+#define UP_MAXTOTAL 256     /* 풀 전체의 최대 idle 연결 수 */
+#define UP_IDLE     30      /* idle 연결을 붙잡아 두는 시간 (초) */
+
+/* 요청 하나가 원격 서버를 기다리는 단계별 마감 (ms) */
+#define UP_CONNECT_MS 3000      /* connect (주소가 여러 개면 모두 합쳐서) */
+#define UP_TTFB_MS    10000     /* 요청을 보내고 응답 헤더를 다 받을 때까지 */
+#define UP_IDLE_MS    10000     /* 바디를 옮기는 동안 아무 진행이 없는 시간 */
+#define UP_TOTAL_MS   300000    /* connect 부터 바디 끝까지 전체 */
+
+#define UP_BREAK_FAILS 5        /* 이만큼 연속으로 실패하면 차단 */
+#define UP_BREAK_MS    5000     /* 차단 시간, 지나면 시험 요청 하나를 보냄 */
+
+typedef struct up_host up_host_t;
+
+void upstream_init(int enabled);
+int upstream_get(char *hostname, char *port, int *reused, dl_timer_t *t);
+void upstream_put(char *hostname, char *port, int fd);
+int upstream_enabled(void);
+up_host_t *upstream_host(char *hostname, char *port, int create);
+int upstream_allow(char *hostname, char *port);
+void upstream_report(up_host_t *e, int ok);
+
+#endif /* __UPSTREAM_H__ */